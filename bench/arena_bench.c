@@ -0,0 +1,302 @@
+// Page faults and TLB misses of the arena growth policies. Two loads
+// run under every policy: 'alloc' fills an arena with small allocations
+// straight through the policy, 'assemble' assembles the same source the
+// way the command line does, where the policy is that of the outer
+// arena and myass keeps the defaults for its own. Every run gets its
+// own child process, so the fault counts and the max RSS are its alone:
+//   pages    regions sized to the request, rounded to a page (the old policy)
+//   growth   the defaults, from LZARENA_DEFAULT_REGION_SIZE doubling up to
+//            LZARENA_DEFAULT_MAX_REGION_SIZE
+//   huge     the defaults plus the huge page flags of '-H'
+// dTLB misses come from perf_event_open and read 'n/a' where the
+// kernel or the hypervisor does not expose them
+
+#include "essentials/lzarena.h"
+#include "myass.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define INPUT_LEN (16 * 1024 * 1024)
+#define RUNS      3
+#define ALLOC_LEN (256 * 1024 * 1024)
+#define PAGE_SIZE 4096
+
+typedef struct policy{
+    const char *name;
+    size_t region_size;
+    size_t factor;
+    size_t max_region_size;
+    int flags;
+}Policy;
+
+static const Policy policies[] = {
+    {"pages", PAGE_SIZE, 1, PAGE_SIZE, 0},
+    {"growth", LZARENA_DEFAULT_REGION_SIZE, LZARENA_DEFAULT_FACTOR, LZARENA_DEFAULT_MAX_REGION_SIZE, 0},
+    {"huge", LZARENA_DEFAULT_REGION_SIZE, LZARENA_DEFAULT_FACTOR, LZARENA_DEFAULT_MAX_REGION_SIZE, LZARENA_FLAG_HUGETLB | LZARENA_FLAG_THP}
+};
+
+static const char *function =
+    "f%zu:\n"
+    "  cmp rdi, 2\n"
+    "  jl .f%zu_exit\n"
+    "  push r10\n"
+    "  mov r10, rdi\n"
+    "  sub rdi, 1\n"
+    "  call f%zu\n"
+    "  add rax, r10\n"
+    "  pop r10\n"
+    "  ret\n"
+    ".f%zu_exit:\n"
+    "  mov rax, rdi\n"
+    "  ret\n";
+
+static char *generate(size_t *out_len){
+    char *input = malloc(INPUT_LEN + 1024);
+    size_t len = 0;
+
+    for (size_t i = 0; len < INPUT_LEN; i++){
+        len += (size_t)sprintf(input + len, function, i, i, i, i);
+    }
+
+    *out_len = len;
+
+    return input;
+}
+
+static char *read_file(const char *pathname, size_t *out_len){
+    FILE *file = fopen(pathname, "rb");
+
+    if(!file){
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+
+    long len = ftell(file);
+    char *input = malloc((size_t)len);
+
+    rewind(file);
+
+    if(fread(input, 1, (size_t)len, file) != (size_t)len){
+        free(input);
+        fclose(file);
+
+        return NULL;
+    }
+
+    fclose(file);
+    *out_len = (size_t)len;
+
+    return input;
+}
+
+static double seconds(void){
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// -1 when the counter is not available
+static int open_dtlb_misses(void){
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void start_measure(int dtlb, struct rusage *usage, double *start){
+    *start = seconds();
+    getrusage(RUSAGE_SELF, usage);
+
+    if(dtlb != -1){
+        ioctl(dtlb, PERF_EVENT_IOC_RESET, 0);
+        ioctl(dtlb, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void end_measure(int dtlb, const struct rusage *before, double start, const char *load, const Policy *policy, LZArena *arena){
+    struct rusage after;
+    char dtlb_misses[32] = "n/a";
+    uint64_t misses = 0;
+    size_t used = 0;
+    size_t size = 0;
+
+    if(dtlb != -1){
+        ioctl(dtlb, PERF_EVENT_IOC_DISABLE, 0);
+
+        if(read(dtlb, &misses, sizeof(misses)) == sizeof(misses)){
+            snprintf(dtlb_misses, sizeof(dtlb_misses), "%"PRIu64, misses);
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &after);
+    lzarena_report(&used, &size, NULL, arena);
+
+    printf(
+        "%-8s %-6s %8.3f s  %9ld minor faults  %6ld MB max RSS  %5zu MB mapped  dTLB misses %s\n",
+        load,
+        policy->name,
+        seconds() - start,
+        after.ru_minflt - before->ru_minflt,
+        after.ru_maxrss / 1024,
+        size / (1024 * 1024),
+        dtlb_misses
+    );
+}
+
+static LZArena *create_arena(const Policy *policy){
+    LZArena *arena = lzarena_create(NULL);
+
+    if(arena){
+        lzarena_growth(policy->region_size, policy->factor, policy->max_region_size, arena);
+        lzarena_flags(policy->flags, arena);
+    }
+
+    return arena;
+}
+
+// Sizes from 16 to 1024 bytes, every byte written, ALLOC_LEN in all
+static int run_alloc(const Policy *policy){
+    LZArena *arena = create_arena(policy);
+    int dtlb = open_dtlb_misses();
+    struct rusage before;
+    double start = 0;
+
+    if(!arena){
+        return 1;
+    }
+
+    start_measure(dtlb, &before, &start);
+
+    for (size_t allocated = 0, i = 0; allocated < ALLOC_LEN; i++){
+        size_t size = 16 + (i * 48) % 1009;
+        byte *ptr = LZARENA_ALLOC(size, arena);
+
+        if(!ptr){
+            return 1;
+        }
+
+        memset(ptr, (int)i, size);
+        allocated += size;
+    }
+
+    end_measure(dtlb, &before, start, "alloc", policy, arena);
+    lzarena_destroy(arena);
+
+    return 0;
+}
+
+static int run_assemble(const Policy *policy, const char *input, size_t input_len){
+    LZArena *arena = create_arena(policy);
+
+    if(!arena){
+        return 1;
+    }
+
+    AllocatorContext allocator_context = {
+        .err_buf = NULL,
+        .behind_allocator = arena
+    };
+    Allocator allocator = {0};
+
+    MEMORY_INIT_ALLOCATOR(
+        &allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &allocator
+    );
+
+    int dtlb = open_dtlb_misses();
+    struct rusage before;
+    double start = 0;
+
+    start_measure(dtlb, &before, &start);
+
+    MyAss *myass = myass_create(&allocator);
+
+    if(!myass){
+        return 1;
+    }
+
+    // Later runs reuse the regions of the first one
+    for (size_t i = 0; i < RUNS; i++){
+        if(myass_assemble(myass, input_len, input)){
+            return 1;
+        }
+    }
+
+    end_measure(dtlb, &before, start, "assemble", policy, arena);
+    myass_destroy(myass);
+    lzarena_destroy(arena);
+
+    return 0;
+}
+
+int main(int argc, char const *argv[]){
+    size_t input_len = 0;
+    char *input = argc > 1 ? read_file(argv[1], &input_len) : generate(&input_len);
+    int failed = 0;
+
+    if(!input){
+        fprintf(stderr, "Failed to read '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    printf("alloc: %d MB, assemble: %zu bytes of input, %d times\n", ALLOC_LEN / (1024 * 1024), input_len, RUNS);
+    fflush(stdout);
+
+    for (size_t load = 0; load < 2; load++){
+        for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++){
+            pid_t pid = fork();
+
+            if(pid == -1){
+                perror("fork");
+                return EXIT_FAILURE;
+            }
+
+            if(pid == 0){
+                int result = load == 0 ? run_alloc(&policies[i]) : run_assemble(&policies[i], input, input_len);
+
+                fflush(stdout);
+                _exit(result);
+            }
+
+            int status = 0;
+
+            waitpid(pid, &status, 0);
+
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+                fprintf(stderr, "Policy '%s' failed\n", policies[i].name);
+                failed = 1;
+            }
+        }
+    }
+
+    free(input);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
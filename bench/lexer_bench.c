@@ -0,0 +1,269 @@
+// Lexing throughput, in MB/s. 'make lexer_bench' builds it once per
+// scanner (LEXER_SIMD 0, 1 and 2: scalar, SSE2 and AVX2) and runs the
+// three builds on the same inputs. Without a file it generates two:
+// dense code, one short instruction per line, and code with deep
+// indentation and long labels, where the blank and identifier runs
+// are long enough for the vector scanners to pay off
+
+#include "essentials/lzarena.h"
+#include "lexer.h"
+#include "token.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INPUT_LEN (32 * 1024 * 1024)
+#define RUNS      5
+
+#ifndef LEXER_SIMD
+    #define SCANNER "default"
+#elif LEXER_SIMD == 0
+    #define SCANNER "scalar"
+#elif LEXER_SIMD == 1
+    #define SCANNER "sse2"
+#else
+    #define SCANNER "avx2"
+#endif
+
+typedef struct keyword{
+    const char *name;
+    TokenType type;
+}Keyword;
+
+static const char *registers[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static const Keyword instructions[] = {
+    {"add", ADD_TOKEN_TYPE}, {"call", CALL_TOKEN_TYPE}, {"cmp", CMP_TOKEN_TYPE},
+    {"idiv", IDIV_TOKEN_TYPE}, {"imul", IMUL_TOKEN_TYPE}, {"je", JE_TOKEN_TYPE},
+    {"jne", JNE_TOKEN_TYPE}, {"jg", JG_TOKEN_TYPE}, {"jl", JL_TOKEN_TYPE},
+    {"jge", JGE_TOKEN_TYPE}, {"jle", JLE_TOKEN_TYPE}, {"jmp", JMP_TOKEN_TYPE},
+    {"mov", MOV_TOKEN_TYPE}, {"pop", POP_TOKEN_TYPE}, {"push", PUSH_TOKEN_TYPE},
+    {"sub", SUB_TOKEN_TYPE}, {"ret", RET_TOKEN_TYPE}, {"xor", XOR_TOKEN_TYPE}
+};
+
+static const char *dense_function =
+    "f%zu:\n"
+    "cmp rdi, 2\n"
+    "jl .f%zu_exit\n"
+    "push r10\n"
+    "mov r10, rdi\n"
+    "sub rdi, 1\n"
+    "call f%zu\n"
+    "add rax, r10\n"
+    "imul rax, 3\n"
+    "pop r10\n"
+    "ret\n"
+    ".f%zu_exit:\n"
+    "mov rax, rdi\n"
+    "ret\n";
+
+static const char *sparse_function =
+    "function_with_a_rather_long_name_%zu:\n"
+    "                                cmp         rdi,        2\n"
+    "                                jl          .function_with_a_rather_long_name_%zu_exit\n"
+    "\n"
+    "                                push        r10\n"
+    "                                mov         r10,        rdi\n"
+    "                                sub         rdi,        1\n"
+    "                                call        function_with_a_rather_long_name_%zu\n"
+    "                                add         rax,        r10\n"
+    "                                pop         r10\n"
+    "                                ret\n"
+    "\n"
+    ".function_with_a_rather_long_name_%zu_exit:\n"
+    "                                mov         rax,        rdi\n"
+    "                                ret\n"
+    "\n";
+
+static char *generate(const char *function, size_t *out_len){
+    char *input = malloc(INPUT_LEN + 1024);
+    size_t len = 0;
+
+    for (size_t i = 0; len < INPUT_LEN; i++){
+        len += (size_t)sprintf(input + len, function, i, i, i, i);
+    }
+
+    *out_len = len;
+
+    return input;
+}
+
+static char *read_file(const char *pathname, size_t *out_len){
+    FILE *file = fopen(pathname, "rb");
+
+    if(!file){
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+
+    long len = ftell(file);
+    char *input = malloc((size_t)len);
+
+    rewind(file);
+
+    if(fread(input, 1, (size_t)len, file) != (size_t)len){
+        free(input);
+        fclose(file);
+
+        return NULL;
+    }
+
+    fclose(file);
+    *out_len = (size_t)len;
+
+    return input;
+}
+
+static double seconds(void){
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Tokens are pulled one at a time with 'lexer_next', like the parser
+// does, so the numbers are not those of growing a token array
+static size_t lex_all(Lexer *lexer){
+    Token token;
+    size_t tokens_len = 0;
+
+    do{
+        lexer_next(lexer, &token);
+        tokens_len++;
+    }while(token.type != EOF_TOKEN_TYPE);
+
+    return tokens_len;
+}
+
+// Best of RUNS, the lexer gets a fresh arena every run
+static int bench(const char *name, const char *input, size_t input_len, Allocator *keywords_allocator){
+    LZOHTable *registers_keywords = MEMORY_LZOHTABLE(keywords_allocator);
+    LZOHTable *instructions_keywords = MEMORY_LZOHTABLE(keywords_allocator);
+
+    for (size_t i = 0; i < sizeof(registers) / sizeof(registers[0]); i++){
+        RegisterKeyword keyword = {.type = REGISTER_TOKEN_TYPE, .reg = (X64Register)i};
+
+        lzohtable_put_ckv(strlen(registers[i]), registers[i], sizeof(RegisterKeyword), &keyword, registers_keywords, NULL);
+    }
+
+    for (size_t i = 0; i < sizeof(instructions) / sizeof(instructions[0]); i++){
+        const Keyword *keyword = &instructions[i];
+
+        lzohtable_put_ckv(strlen(keyword->name), keyword->name, sizeof(TokenType), &keyword->type, instructions_keywords, NULL);
+    }
+
+    LZArena *arena = lzarena_create(NULL);
+    AllocatorContext allocator_context = {
+        .err_buf = NULL,
+        .behind_allocator = arena
+    };
+    Allocator allocator = {0};
+
+    MEMORY_INIT_ALLOCATOR(
+        &allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &allocator
+    );
+
+    BStr code = {.len = input_len, .buff = (char *)input};
+    double best = 0;
+    size_t tokens_len = 0;
+
+    for (size_t run = 0; run < RUNS; run++){
+        lzarena_free_all(arena);
+
+        Lexer *lexer = lexer_create(&allocator);
+
+        if(!lexer || lexer_init(lexer, registers_keywords, instructions_keywords, &code)){
+            lzarena_destroy(arena);
+            return 1;
+        }
+
+        if(setjmp(lexer->err_buf) != 0){
+            fprintf(stderr, "Failed to lex the %s input\n", name);
+            lzarena_destroy(arena);
+
+            return 1;
+        }
+
+        double start = seconds();
+
+        tokens_len = lex_all(lexer);
+
+        double elapsed = seconds() - start;
+
+        if(run == 0 || elapsed < best){
+            best = elapsed;
+        }
+    }
+
+    printf(
+        "%-6s %-8s %8.1f MB/s  %6.1f Mtokens/s  (%zu bytes, %zu tokens)\n",
+        SCANNER,
+        name,
+        (double)input_len / 1e6 / best,
+        (double)tokens_len / 1e6 / best,
+        input_len,
+        tokens_len
+    );
+
+    lzarena_destroy(arena);
+
+    return 0;
+}
+
+int main(int argc, char const *argv[]){
+    LZArena *keywords_arena = lzarena_create(NULL);
+    AllocatorContext keywords_context = {
+        .err_buf = NULL,
+        .behind_allocator = keywords_arena
+    };
+    Allocator keywords_allocator = {0};
+    int failed = 0;
+
+    MEMORY_INIT_ALLOCATOR(
+        &keywords_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &keywords_allocator
+    );
+
+    if(argc > 1){
+        size_t input_len = 0;
+        char *input = read_file(argv[1], &input_len);
+
+        if(!input){
+            fprintf(stderr, "Failed to read '%s'\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+
+        failed = bench("file", input, input_len, &keywords_allocator);
+        free(input);
+    }else{
+        size_t dense_len = 0;
+        size_t sparse_len = 0;
+        char *dense = generate(dense_function, &dense_len);
+        char *sparse = generate(sparse_function, &sparse_len);
+
+        failed = bench("dense", dense, dense_len, &keywords_allocator) ||
+                 bench("sparse", sparse, sparse_len, &keywords_allocator);
+
+        free(dense);
+        free(sparse);
+    }
+
+    lzarena_destroy(keywords_arena);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "essentials/dynarr.h"
+#include "essentials/memory.h"
+#include "essentials/lzohtable.h"
+#include "lexer.h"
+
+// Simplifies the control flow of 'instructions'. Basic blocks start at
+// labels and end at jcc, jmp and ret. Until nothing changes:
+//  - a jcc, jmp or call to a block that is only a 'jmp' goes to its target
+//  - a jcc over a 'jmp', to the block right after it, is inverted
+//  - a 'jmp' to the block right after it is dropped
+//  - blocks no entry reaches are dropped. Entries are the first block
+//    and every label not starting with '.'
+//  - labels starting with '.' that nothing jumps to are dropped
+// Returns the new instructions list, or NULL when nothing changed or
+// when a label is defined twice, which is left for the assembler to report
+DynArr *cfg_simplify(const Lexer *lexer, DynArr *instructions, const Allocator *allocator);
+// Reorders the blocks of each function by 'counts', label names to how
+// many times they ran (uint64_t). Functions start at the first block
+// and at every label not starting with '.'. Within a function that ran,
+// hot blocks follow their hottest successor so it is reached by running
+// on, and blocks that never ran move after every function. Jumps are
+// inverted, dropped or added to keep the control flow. Returns the new
+// instructions list, or NULL when nothing moved or when a label is
+// defined twice
+DynArr *cfg_layout(Lexer *lexer, DynArr *instructions, LZOHTable *counts, const Allocator *allocator);
+
+#endif
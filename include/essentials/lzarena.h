@@ -8,7 +8,15 @@
 #define LZARENA_ERR_ALLOC 1
 
 #define LZARENA_DEFAULT_ALIGNMENT 16
-#define LZARENA_DEFAULT_FACTOR 1
+#define LZARENA_DEFAULT_FACTOR 2
+#define LZARENA_DEFAULT_REGION_SIZE (64 * 1024)
+#define LZARENA_DEFAULT_MAX_REGION_SIZE (64 * 1024 * 1024)
+
+#define LZARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Only regions of at least LZARENA_HUGE_PAGE_SIZE bytes are affected
+#define LZARENA_FLAG_HUGETLB 0b00000001 // try MAP_HUGETLB first
+#define LZARENA_FLAG_THP     0b00000010 // madvise(MADV_HUGEPAGE) on a huge page aligned mapping
 
 #define LZARENA_BACKEND_MALLOC 0
 #define LZARENA_BACKEND_MMAP 1
@@ -47,7 +55,12 @@ struct lzregion{
 
 struct lzarena{
     reset_t reset;
+    int flags;
     size_t allocted_bytes;
+    size_t wasted_bytes;     // bytes left behind by reallocations that had to move
+    size_t region_size;      // minimum size of the next region
+    size_t factor;           // 'region_size' growth after each new region
+    size_t max_region_size;  // cap for 'region_size' growth
     LZRegion *head;
     LZRegion *tail;
     LZRegion *current;
@@ -56,6 +69,7 @@ struct lzarena{
 
 LZRegion *lzregion_init(size_t buff_size, void *buff);
 LZRegion *lzregion_create(size_t size);
+LZRegion *lzregion_create_flags(size_t size, int flags);
 void lzregion_destroy(LZRegion *region);
 
 #define LZREGION_FREE(region){       \
@@ -71,10 +85,16 @@ void *lzregion_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t
 LZArena *lzarena_create(LZArenaAllocator *allocator);
 void lzarena_destroy(LZArena *arena);
 
+void lzarena_growth(size_t region_size, size_t factor, size_t max_region_size, LZArena *arena);
+void lzarena_flags(int flags, LZArena *arena);
+
 #define LZARENA_OFFSET(_lzarena)((_lzarena)->current->offset)
-void lzarena_report(size_t *used, size_t *size, LZArena *arena);
+void lzarena_report(size_t *used, size_t *size, size_t *wasted, LZArena *arena);
 int lzarena_append_region(size_t size, LZArena *arena);
 void lzarena_free_all(LZArena *arena);
+// Frees every allocation and gives every region back to the system,
+// or to the arena's allocator. The arena stays usable
+void lzarena_release(LZArena *arena);
 
 void *lzarena_alloc_align(size_t size, size_t alignment, LZArena *arena);
 void *lzarena_calloc_align(size_t size, size_t alignment, LZArena *arena);
@@ -29,6 +29,8 @@ LZBBuff *lzbbuff_create(size_t len, LZBBuffAllocator *allocator);
 void lzbbuff_destroy(LZBBuff *buff);
 
 int lzbbuff_restart(LZBBuff *buff);
+// Drops the bytes past 'len', which must not exceed the used bytes
+void lzbbuff_truncate(LZBBuff *buff, size_t len);
 size_t lzbbuff_used_bytes(const LZBBuff *buff);
 void lzbbuff_print_as_hex(const LZBBuff *buff, int wprefix);
 lzbbuff_hash lzbbuff_hash_bytes(const LZBBuff *buff);
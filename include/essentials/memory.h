@@ -41,6 +41,7 @@ typedef struct allocator{
 #define MEMORY_NEW(_allocator, _type, ...)                             ((_type *)(memcpy(MEMORY_ALLOC(_type, 1, _allocator), &(_type){__VA_ARGS__}, sizeof(_type))))
 #define MEMORY_LZBSTR(_allocator)                                      (lzbstr_create((LZBStrAllocator *)(_allocator)))
 #define MEMORY_DYNARR_TYPE(_allocator, _type)                          (dynarr_create(sizeof(_type), (DynArrAllocator *)(_allocator)))
+#define MEMORY_DYNARR_TYPE_BY(_allocator, _type, _count)               (dynarr_create_by(sizeof(_type), (_count), (DynArrAllocator *)(_allocator)))
 #define MEMORY_DYNARR_PTR(_allocator)                                  (DYNARR_CREATE_PTR((DynArrAllocator *)(_allocator)))
 #define MEMORY_LZSTACK(_allocator)                                     (lzstack_create((LZStackAllocator *)(_allocator)))
 #define MEMORY_LZOHTABLE(_allocator)                                   (lzohtable_create(16, 0.85, (LZOHTableAllocator *)(_allocator)))
@@ -9,6 +9,8 @@
 
 typedef enum instruction_type{
     LABEL_INSTRUCTION_TYPE,
+    ALIGN_INSTRUCTION_TYPE,
+    COUNT_INSTRUCTION_TYPE,
 
     ADD_INSTRUCTION_TYPE,
     CALL_INSTRUCTION_TYPE,
@@ -16,6 +18,7 @@ typedef enum instruction_type{
     IDIV_INSTRUCTION_TYPE,
     IMUL_INSTRUCTION_TYPE,
     JE_INSTRUCTION_TYPE,
+    JNE_INSTRUCTION_TYPE,
     JG_INSTRUCTION_TYPE,
     JL_INSTRUCTION_TYPE,
     JGE_INSTRUCTION_TYPE,
@@ -26,32 +29,76 @@ typedef enum instruction_type{
     PUSH_INSTRUCTION_TYPE,
     SUB_INSTRUCTION_TYPE,
     RET_INSTRUCTION_TYPE,
+    TZCNT_INSTRUCTION_TYPE,
     XOR_INSTRUCTION_TYPE,
+
+    MOVDQU_INSTRUCTION_TYPE,
+    MOVQ_INSTRUCTION_TYPE,
+    PADDD_INSTRUCTION_TYPE,
+    PADDQ_INSTRUCTION_TYPE,
+    PCMPEQB_INSTRUCTION_TYPE,
+    PMOVMSKB_INSTRUCTION_TYPE,
+    PXOR_INSTRUCTION_TYPE,
+
+    VMOVDQU_INSTRUCTION_TYPE,
+    VPADDD_INSTRUCTION_TYPE,
+    VPADDQ_INSTRUCTION_TYPE,
+    VPBROADCASTB_INSTRUCTION_TYPE,
+    VPBROADCASTD_INSTRUCTION_TYPE,
+    VPBROADCASTQ_INSTRUCTION_TYPE,
+    VPCMPEQB_INSTRUCTION_TYPE,
+    VPMOVMSKB_INSTRUCTION_TYPE,
+    VPXOR_INSTRUCTION_TYPE,
+    VZEROUPPER_INSTRUCTION_TYPE,
 }InstructionType;
 
 typedef struct empty_instruction{
-    Token *token;
+    Token token;
 }EmptyInstruction;
 
+typedef struct align_instruction{
+    size_t alignment;
+    size_t max_padding;
+    Token token;
+}AlignInstruction;
+
+// Increments a block counter, see MYASS_FLAG_COUNT_BLOCKS
+typedef struct count_instruction{
+    size_t index;
+}CountInstruction;
+
 typedef struct unary_instruction{
     Location *location;
-    Token *instruction_token;
-    Token *operand_token;
+    Token instruction_token;
+    Token operand_token;
 }UnaryInstruction;
 
 typedef struct binary_instruction{
     Location *dst_location;
     Location *src_location;
-    Token *instruction_token;
-    Token *dst_token;
-    Token *src_token;
+    Token instruction_token;
+    Token dst_token;
+    Token src_token;
 }BinaryInstruction;
 
+// VEX forms with a second source: 'dst = src1 op src2'
+typedef struct ternary_instruction{
+    Location *dst_location;
+    Location *src1_location;
+    Location *src2_location;
+    Token instruction_token;
+    Token dst_token;
+    Token src1_token;
+    Token src2_token;
+}TernaryInstruction;
+
 typedef struct instruction{
 	size_t offset;
 	size_t len;
     InstructionType type;
     void *sub_instruction;
+    uint32_t source_offset;
+    uint32_t source_len;
 }Instruction;
 
 #endif
@@ -3,22 +3,30 @@
 
 #include "essentials/memory.h"
 #include "types.h"
+#include "token.h"
 #include "essentials/dynarr.h"
 #include "essentials/lzohtable.h"
+#include "essentials/lzbstr.h"
 #include <setjmp.h>
 
+typedef struct lexer_scanner LexerScanner;
+
+#define LEXER_MAX_INPUT_LEN UINT32_MAX
+#define LEXER_MAX_LEXEME_LEN UINT16_MAX
+#define LEXER_MAX_HOLE 255
+
 typedef struct lexer{
-    size_t    start_line_offset;
-    size_t    end_line_offset;
-    int32_t   start_line;
-    int32_t   end_line;
     size_t    start;
     size_t    current;
     jmp_buf   err_buf;
     BStr      *code;
     LZOHTable *registers_keywords;
     LZOHTable *instructions_keywords;
-    DynArr    *tokens;
+    Token     *token; // where the token being lexed goes, NULL once it is produced
+    DynArr    *lines; // offset where each line after the first one starts
+    int       holes;  // lexes '$' holes, cleared by 'lexer_init'
+    LZBStr    *generated; // lexemes of the generated labels
+    const LexerScanner *scanner;
     Allocator *allocator;
 }Lexer;
 
@@ -26,6 +34,16 @@ Lexer *lexer_create(Allocator *allocator);
 
 void lexer_destroy(Lexer *lexer);
 
+int lexer_init(
+    Lexer *lexer,
+    LZOHTable *registers_keywords,
+    LZOHTable *instructions_keywords,
+    BStr *code
+);
+// Lexes the next token into 'token', an EOF token once the input is exhausted.
+// Errors longjmp to 'err_buf', which the caller must have set
+void lexer_next(Lexer *lexer, Token *token);
+// Lexes the whole input at once
 int lexer_lex(
     Lexer *lexer,
     LZOHTable *registers_keywords,
@@ -34,4 +52,15 @@ int lexer_lex(
     DynArr *tokens
 );
 
+// A label no source can spell ('.@' and a number), for passes that
+// need to jump somewhere the source left unlabeled. Its lexeme is kept
+// by the lexer until the next 'lexer_init'
+Token lexer_generate_label(Lexer *lexer);
+
+TokenLocation lexer_token_location(const Lexer *lexer, const Token *token);
+const char *lexer_lexeme(const Lexer *lexer, const Token *token);
+#define LEXER_LEXEME_LEN(_token) ((int)((_token)->type == EOF_TOKEN_TYPE ? 3 : (_token)->len))
+// Expands to the arguments of a '%.*s' conversion
+#define LEXER_LEXEME_ARGS(_lexer, _token) LEXER_LEXEME_LEN(_token), lexer_lexeme((_lexer), (_token))
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include "essentials/memory.h"
+#include "types.h"
+#include <stdint.h>
+
+// Every checkpoint holds the absolute state of one row out of this many,
+// so a lookup decodes at most that many rows after its binary search
+#define LINE_TABLE_CHECKPOINT_INTERVAL 16
+
+typedef struct line_table_checkpoint{
+    uint32_t code_offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t program_offset; // where the row after this one starts
+}LineTableCheckpoint;
+
+typedef struct line_table_row{
+    uint32_t code_offset;
+    uint32_t line;
+    uint32_t column;
+    size_t   index;          // rows decoded so far
+    size_t   program_offset; // where the next row starts
+}LineTableRow;
+
+// Rows map code offsets to source positions. Each row covers the code
+// from its offset up to the next row's offset, and the last one up to
+// 'code_end'. Rows are stored as a program of deltas, like DWARF's line
+// program: ULEB128 code offset delta, SLEB128 line delta, ULEB128 column
+typedef struct line_table{
+    byte                *program;
+    size_t              program_len;
+    size_t              program_capacity;
+    LineTableCheckpoint *checkpoints;
+    size_t              checkpoints_len;
+    size_t              checkpoints_capacity;
+    size_t              rows_len;
+    uint32_t            code_end;
+    uint32_t            last_code_offset;
+    uint32_t            last_line;
+    uint32_t            last_column;
+    const Allocator     *allocator;
+}LineTable;
+
+LineTable *line_table_create(const Allocator *allocator);
+
+void line_table_destroy(LineTable *table);
+
+// Drops every row but keeps the memory
+void line_table_reset(LineTable *table);
+// Rows must be appended in increasing 'code_offset' order. A row at the
+// same position as the previous one is not stored. Returns 1 when the
+// allocator fails, leaving the table as it was
+int line_table_append(LineTable *table, uint32_t code_offset, uint32_t line, uint32_t column);
+void line_table_end(LineTable *table, uint32_t code_end);
+// Decodes the rows in order. 'row' must be zeroed before the first call.
+// Returns 1 once there are no more rows
+int line_table_next(const LineTable *table, LineTableRow *row);
+// Returns 0 and sets the source position of 'code_offset' when a row covers it, 1 otherwise
+int line_table_lookup(const LineTable *table, uint32_t code_offset, uint32_t *out_line, uint32_t *out_column);
+
+#endif
@@ -4,14 +4,20 @@
 #include "types.h"
 #include "token.h"
 
+// Register holes of stencils are assembled with this register
+#define HOLE_REGISTER R11
+
 typedef enum location_type{
     LITERAL_LOCATION_TYPE,
     REGISTER_LOCATION_TYPE,
     LABEL_LOCATION_TYPE,
+    VECTOR_LOCATION_TYPE,
+    MEMORY_LOCATION_TYPE,
 }LocationType;
 
+// 32 bits literals are kept sign extended
 typedef struct literal_location{
-    dword value;
+    qword value;
 }LiteralLocation;
 
 typedef struct register_location{
@@ -19,9 +25,21 @@ typedef struct register_location{
 }RegisterLocation;
 
 typedef struct label_location{
-    Token *label_token;
+    Token label_token;
 }LabelLocation;
 
+// xmm or ymm register
+typedef struct vector_location{
+    byte reg;
+    byte len; // in bytes, 16 or 32
+}VectorLocation;
+
+// '[base + displacement]'
+typedef struct memory_location{
+    X64Register base;
+    int32_t displacement;
+}MemoryLocation;
+
 typedef struct location{
     LocationType type;
     void *sub_location;
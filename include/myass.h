@@ -3,13 +3,134 @@
 
 #include "types.h"
 #include "memory.h"
+#include "perfmap.h"
 #include <stdint.h>
 
+#define MYASS_FLAG_RELEASE_IR  0b00000001 // free tokens and instructions once the code is emitted
+#define MYASS_FLAG_LISTING_MAP 0b00000010 // keep a listing map that survives MYASS_FLAG_RELEASE_IR
+#define MYASS_FLAG_LINE_TABLE  0b00000100 // keep a code offset to source line table that survives MYASS_FLAG_RELEASE_IR
+#define MYASS_FLAG_PREFER_MOVABS 0b00010000 // load 64 bits literals with movabs instead of the constant pool
+#define MYASS_FLAG_PATCHABLE   0b00100000 // pad call and jmp so 'myass_retarget' can rewrite them
+#define MYASS_FLAG_SIMPLIFY_CFG 0b01000000 // drop dead code and thread jumps, see 'myass_simplified_bytes'
+#define MYASS_FLAG_PROFILE_LAYOUT 0b10000000 // reorder blocks by the label counts, see 'myass_label_count'
+#define MYASS_FLAG_COUNT_BLOCKS 0b100000000 // count the runs of every label, see 'myass_block_counters'
+
+#define MYASS_CALL_PATCH_SITE 0xe8
+#define MYASS_JMP_PATCH_SITE  0xe9
+
 typedef struct myass MyAss;
+typedef struct myass_stencil MyAssStencil;
+
+// Labels of the builder API, see 'myass_label_new'
+typedef uint32_t MyAssLabel;
+
+#define MYASS_NO_LABEL UINT32_MAX
+
+// Condition codes, as encoded in the low nibble of jcc
+typedef enum myass_condition{
+    MYASS_CONDITION_E  = 0x4,
+    MYASS_CONDITION_NE = 0x5,
+    MYASS_CONDITION_L  = 0xc,
+    MYASS_CONDITION_GE = 0xd,
+    MYASS_CONDITION_LE = 0xe,
+    MYASS_CONDITION_G  = 0xf,
+}MyAssCondition;
+
+// Looks up a call target the source does not define. Returns 0 and sets
+// its address, 1 when it is unknown too
+typedef int (*MyAssResolver)(const char *name, size_t name_len, void *context, uintptr_t *out_address);
+
+// Maps emitted bytes to the source text they came from. Labels are
+// the only entries with 'len' 0
+typedef struct myass_listing_entry{
+    uint32_t offset;
+    uint32_t len;
+    uint32_t source_offset;
+    uint32_t source_len;
+}MyAssListingEntry;
+
+typedef struct myass_symbol{
+    const char *name; // not NUL terminated
+    size_t     name_len;
+    size_t     offset;
+}MyAssSymbol;
+
+// A call or jmp rel32. 'type' is its opcode
+typedef struct myass_patch_site{
+    uint32_t offset;
+    uint32_t type;
+}MyAssPatchSite;
 
 MyAss *myass_create(const Allocator *allocator);
 void myass_destroy(MyAss *myass);
 
+// Labels targeted by backward jumps get aligned to 'boundary' when that
+// takes at most 'max_padding' bytes of NOPs. A zero boundary disables it
+void myass_loop_alignment(MyAss *myass, size_t boundary, size_t max_padding);
+void myass_flags(MyAss *myass, int flags);
+void myass_resolver(MyAss *myass, MyAssResolver resolver, void *context);
+const MyAssListingEntry *myass_listing(const MyAss *myass, size_t *out_len);
+// Adds 'count' runs to the label 'name', for MYASS_FLAG_PROFILE_LAYOUT.
+// Counts are kept across assemblies. Returns 1 when out of memory
+int myass_label_count(MyAss *myass, const char *name, uint64_t count);
+// Adds the counts of a file of 'label count' lines. Blank lines and
+// lines starting with '#' are skipped. Returns 1 when the file can not
+// be read or a line is malformed, keeping the counts of the lines before
+int myass_load_profile(MyAss *myass, const char *pathname);
+void myass_clear_profile(MyAss *myass);
+// Where MYASS_FLAG_COUNT_BLOCKS counts. Every group of labels gets an
+// 'inc qword [counter]' in front of its code, 'lock' prefixed when
+// 'atomic', which clobbers the flags but CF. The counters are addressed
+// as a sign extended disp32, so they must live in the low 2 GB, as with
+// MAP_32BIT. Returns 1 when they do not
+int myass_block_counters(MyAss *myass, uint64_t *counters, size_t capacity, int atomic);
+// Counters the last assembly inserted, from index 0. Those of blocks
+// MYASS_FLAG_SIMPLIFY_CFG dropped stay in the range but never count
+size_t myass_counters_len(const MyAss *myass);
+// Returns 0 and sets the first label of the group counter 'index' counts
+// and the offset of its increment, 1 when there is no such counter or
+// its block was dropped. The name is empty when MYASS_FLAG_SIMPLIFY_CFG
+// dropped the labels only
+int myass_counter_symbol(const MyAss *myass, size_t index, MyAssSymbol *out_symbol);
+// Adds what the counters of the last assembly counted to the label counts.
+// Returns 1 when out of memory
+int myass_profile_counters(MyAss *myass);
+// Needs MYASS_FLAG_SIMPLIFY_CFG. Bytes the last assembly saved, found by
+// laying the code out before and after the pass, so the flag costs one
+// more layout. Negative when explicit alignment padding grew
+int64_t myass_simplified_bytes(const MyAss *myass);
+// Needs MYASS_FLAG_LINE_TABLE. Returns 0 and sets the source line and column
+// (both from 1) of the instruction covering 'offset', 1 when there is none
+int myass_lookup_line(const MyAss *myass, size_t offset, uint32_t *out_line, uint32_t *out_column);
+
+const byte *myass_code(const MyAss *myass, size_t *out_len);
+// Labels are kept after assembly, even with MYASS_FLAG_RELEASE_IR.
+// Returns 0 and sets the code offset of 'name', 1 when there is no such label
+int myass_symbol_offset(const MyAss *myass, const char *name, size_t *out_offset);
+// Walks the labels in code order. '*iterator' must start at 0.
+// Returns 1 once there are no more labels
+int myass_symbol_next(const MyAss *myass, size_t *iterator, MyAssSymbol *out_symbol);
+// Functions start at every label not starting with '.' and run up to
+// the next one. 'address' is where the code was copied to. Line records
+// are only written with MYASS_FLAG_LINE_TABLE. Both return 1 when
+// writing fails or the outer allocator is out of memory
+int myass_perf_map(const MyAss *myass, uintptr_t address);
+int myass_jitdump(const MyAss *myass, PerfJitDump *dump, uintptr_t address, const char *filename);
+// Needs MYASS_FLAG_PATCHABLE
+const MyAssPatchSite *myass_patch_sites(const MyAss *myass, size_t *out_len);
+// Points the call or jmp at 'site', in code that may be running on other
+// threads, to 'target'. Its rel32 is swapped with one atomic 8 bytes
+// compare and swap, so a thread runs either the old or the new target.
+// The page must be writable. Returns 1 when 'target' is out of rel32
+// range or the site was not padded by MYASS_FLAG_PATCHABLE
+int myass_retarget(byte *site, uintptr_t target);
+// Calls to targets found by the resolver go through a 'jmp [rip + slot]'
+// stub placed after the code, one per target. Once 'base', the address
+// the code will be copied to, is known, this points the calls within
+// rel32 range straight at their targets and the rest back at their
+// stubs. Run it before copying the code. Returns how many calls are direct
+size_t myass_link(MyAss *myass, uintptr_t base);
+
 void myass_print_as_hex(const MyAss *myass, int wprefix);
 void myass_formatted_print_hex(const MyAss *myass);
 
@@ -21,18 +142,31 @@ void myass_call_imm32(MyAss *myass, dword offset);
 void myass_cmp_r64_imm32(MyAss *myass, X64Register dst, dword src);
 void myass_cmp_r64_r64(MyAss *myass, X64Register dst, X64Register src);
 
+void myass_cqo(MyAss *myass);
 void myass_idiv_r64(MyAss *myass, X64Register src);
 void myass_imul_r64_r64(MyAss *myass, X64Register dst, X64Register src);
+// 'inc qword [address]', 'lock' prefixed when 'lock'
+void myass_inc_m64_abs32(MyAss *myass, int32_t address, int lock);
 
 void myass_je_imm32(MyAss *myass, dword offset);
+void myass_jne_imm32(MyAss *myass, dword offset);
 void myass_jg_imm32(MyAss *myass, dword offset);
 void myass_jl_imm32(MyAss *myass, dword offset);
 void myass_jge_imm32(MyAss *myass, dword offset);
 void myass_jle_imm32(MyAss *myass, dword offset);
 void myass_jmp_imm32(MyAss *myass, dword offset);
 
+void myass_mov_r32_imm32(MyAss *myass, X64Register dst, dword src);
 void myass_mov_r64_imm32(MyAss *myass, X64Register dst, dword src);
+// Picks the shortest of the encodings below
+void myass_mov_r64_imm64(MyAss *myass, X64Register dst, qword src);
+void myass_mov_r64_rip32(MyAss *myass, X64Register dst, dword displacement);
+void myass_movabs_r64_imm64(MyAss *myass, X64Register dst, qword src);
 void myass_mov_r64_r64(MyAss *myass, X64Register dst, X64Register src);
+// 'mov r64, [base + displacement]' and 'mov [base + displacement], r64'
+void myass_mov_r64_m64(MyAss *myass, X64Register dst, X64Register base, int32_t displacement);
+void myass_mov_m64_r64(MyAss *myass, X64Register base, int32_t displacement, X64Register src);
+void myass_mov_m64_imm32(MyAss *myass, X64Register base, int32_t displacement, dword src);
 
 void myass_pop_r64(MyAss *myass, X64Register dst);
 void myass_push_r64(MyAss *myass, X64Register src);
@@ -42,9 +176,100 @@ void myass_sub_r64_r64(MyAss *myass, X64Register dst, X64Register src);
 
 void myass_ret(MyAss *myass);
 
+void myass_tzcnt_r64_r64(MyAss *myass, X64Register dst, X64Register src);
+
 void myass_xor_r64_imm32(MyAss *myass, X64Register dst, dword src);
 void myass_xor_r64_r64(MyAss *myass, X64Register dst, X64Register src);
 
+// SSE2. Vector registers go by number, 3 is 'xmm3'. Memory operands
+// are '[base + displacement]' and need no alignment
+void myass_movdqu_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_movdqu_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement);
+void myass_movdqu_m128_xmm(MyAss *myass, X64Register base, int32_t displacement, byte src);
+
+void myass_movq_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_movq_xmm_r64(MyAss *myass, byte dst, X64Register src);
+void myass_movq_r64_xmm(MyAss *myass, X64Register dst, byte src);
+
+void myass_paddd_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_paddd_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement);
+void myass_paddq_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_paddq_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement);
+void myass_pcmpeqb_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_pcmpeqb_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement);
+void myass_pmovmskb_r32_xmm(MyAss *myass, X64Register dst, byte src);
+void myass_pxor_xmm_xmm(MyAss *myass, byte dst, byte src);
+void myass_pxor_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement);
+
+// AVX and AVX2, VEX encoded. 'len' is 16 for xmm and 32 for ymm registers
+void myass_vmovdqu_v_v(MyAss *myass, byte len, byte dst, byte src);
+void myass_vmovdqu_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement);
+void myass_vmovdqu_m_v(MyAss *myass, byte len, X64Register base, int32_t displacement, byte src);
+
+void myass_vpaddd_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2);
+void myass_vpaddd_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement);
+void myass_vpaddq_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2);
+void myass_vpaddq_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement);
+// Broadcast the low byte, dword or qword of an xmm register or memory
+void myass_vpbroadcastb_v_xmm(MyAss *myass, byte len, byte dst, byte src);
+void myass_vpbroadcastb_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement);
+void myass_vpbroadcastd_v_xmm(MyAss *myass, byte len, byte dst, byte src);
+void myass_vpbroadcastd_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement);
+void myass_vpbroadcastq_v_xmm(MyAss *myass, byte len, byte dst, byte src);
+void myass_vpbroadcastq_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement);
+void myass_vpcmpeqb_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2);
+void myass_vpcmpeqb_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement);
+void myass_vpmovmskb_r32_v(MyAss *myass, byte len, X64Register dst, byte src);
+void myass_vpxor_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2);
+void myass_vpxor_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement);
+// Clears the upper halves of the ymm registers, run it before leaving
+// AVX code for SSE code
+void myass_vzeroupper(MyAss *myass);
+
+// Builder API labels. A jump to a label that is already bound takes the
+// short rel8 form when it reaches, anything else is a rel32 that gets
+// patched when the label is bound. Every label jumped to must be bound
+// before the code is used. Labels and pending jumps live in the outer
+// allocator: 'myass_label_new' returns MYASS_NO_LABEL and the jumps
+// return 1 when it is out of memory
+MyAssLabel myass_label_new(MyAss *myass);
+void myass_label_bind(MyAss *myass, MyAssLabel label);
+// Returns 0 and sets the code offset of 'label', 1 when it is not bound yet
+int myass_label_offset(const MyAss *myass, MyAssLabel label, size_t *out_offset);
+int myass_jcc_label(MyAss *myass, MyAssCondition condition, MyAssLabel label);
+int myass_jmp_label(MyAss *myass, MyAssLabel label);
+int myass_call_label(MyAss *myass, MyAssLabel label);
+// Drops the code and labels so the builder API can start over
+void myass_restart(MyAss *myass);
+
+void myass_nop(MyAss *myass, size_t len);
+// 'alignment' is relative to the start of the code buffer
+void myass_align(MyAss *myass, size_t alignment);
+
+// 'input' is not copied, it must outlive 'myass_formatted_print_hex'
 int myass_assemble(MyAss *myass, size_t input_len, const char *input);
 
+// Assembles 'input' once into a template whose holes are filled when it
+// is copied. Holes are '$rN' registers, '$iN' immediates (sign extended
+// like any imm32) and '$tN' call or jump targets, each kind numbered from
+// 0. Labels, call stubs and the constant pool are relative, so copies run
+// anywhere. The labels stay readable through 'myass_symbol_offset' until
+// the next assembly. Returns NULL on errors
+MyAssStencil *myass_stencil_create(MyAss *myass, size_t input_len, const char *input);
+void myass_stencil_destroy(MyAssStencil *stencil);
+const byte *myass_stencil_code(const MyAssStencil *stencil, size_t *out_len);
+// How many holes of each kind, so the highest index used plus 1
+void myass_stencil_holes(const MyAssStencil *stencil, size_t *out_registers, size_t *out_immediates, size_t *out_targets);
+// Copies the stencil to 'dst', which will run at 'address', and fills
+// its holes. Returns 1 when a target is out of rel32 range, leaving
+// 'dst' partially filled
+int myass_stencil_instantiate(
+    const MyAssStencil *stencil,
+    byte *dst,
+    uintptr_t address,
+    const X64Register *registers,
+    const dword *immediates,
+    const uintptr_t *targets
+);
+
 #endif
@@ -3,12 +3,18 @@
 
 #include "essentials/dynarr.h"
 #include "essentials/memory.h"
+#include "lexer.h"
 #include <setjmp.h>
 
+// Tokens are pulled from the lexer on demand. The ring holds the
+// previous and the current token, plus room for more lookahead
+#define PARSER_RING_SIZE 4
+
 typedef struct parser{
     jmp_buf   err_buf;
     size_t    current;
-    DynArr    *tokens;
+    Token     ring[PARSER_RING_SIZE];
+    Lexer     *lexer;
     Allocator *allocator;
 }Parser;
 
@@ -16,6 +22,7 @@ Parser *parser_create(Allocator *allocator);
 
 void parser_destroy(Parser *parser);
 
-int parser_parse(Parser *parser, DynArr *tokens, DynArr *instructions);
+// 'lexer' must be initialized with 'lexer_init'
+int parser_parse(Parser *parser, Lexer *lexer, DynArr *instructions);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef PERF_MAP_H
+#define PERF_MAP_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Code that lives at 'address' once loaded
+typedef struct perf_symbol{
+    const char *name;
+    size_t     name_len;
+    uintptr_t  address;
+    size_t     size;
+}PerfSymbol;
+
+typedef struct perf_line{
+    uintptr_t address;
+    uint32_t  line;
+    uint32_t  column;
+}PerfLine;
+
+// perf only reads a jitdump whose file the process keeps mapped as executable
+typedef struct perf_jitdump{
+    int      fd;
+    void     *marker;
+    size_t   marker_len;
+    uint64_t code_index;
+}PerfJitDump;
+
+// Appends a line per symbol to /tmp/perf-<pid>.map, which
+// perf reads to name code it finds in anonymous memory
+int perf_map_append(size_t symbols_len, const PerfSymbol *symbols);
+
+// Creates '<dir>/jit-<pid>.dump'. Record with 'perf record -k mono'
+// and merge it with 'perf inject --jit' to annotate the code
+int perf_jitdump_open(const char *dir, PerfJitDump *dump);
+void perf_jitdump_close(PerfJitDump *dump);
+// 'code' is copied into the dump. Line records are only written when 'lines_len' is not 0
+int perf_jitdump_code_load(
+    PerfJitDump *dump,
+    const PerfSymbol *symbol,
+    const byte *code,
+    const char *filename,
+    size_t lines_len,
+    const PerfLine *lines
+);
+
+#endif
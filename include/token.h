@@ -1,15 +1,30 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include "types.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
 typedef enum token_type{
-    COMMA_TOKEN_TYPE, MINUS_TOKEN_TYPE, COLON_TOKEN_TYPE,
+    COMMA_TOKEN_TYPE, MINUS_TOKEN_TYPE, PLUS_TOKEN_TYPE, COLON_TOKEN_TYPE,
+    LEFT_BRACKET_TOKEN_TYPE, RIGHT_BRACKET_TOKEN_TYPE,
 
     DWORD_TYPE_TOKEN_TYPE,
+    QWORD_TYPE_TOKEN_TYPE, // literals out of the int32 range, only 'mov' takes them
 
     REGISTER_TOKEN_TYPE,
+    // Vector registers keep their number in 'reg'
+    XMM_REGISTER_TOKEN_TYPE,
+    YMM_REGISTER_TOKEN_TYPE,
+
+    // Stencil holes, 'literal' holds their index
+    REGISTER_HOLE_TOKEN_TYPE,
+    IMMEDIATE_HOLE_TOKEN_TYPE,
+    TARGET_HOLE_TOKEN_TYPE,
+
+    ALIGN_TOKEN_TYPE,
+    P2ALIGN_TOKEN_TYPE,
 
     ADD_TOKEN_TYPE,
     CALL_TOKEN_TYPE,
@@ -17,6 +32,7 @@ typedef enum token_type{
     IDIV_TOKEN_TYPE,
     IMUL_TOKEN_TYPE,
     JE_TOKEN_TYPE,
+    JNE_TOKEN_TYPE,
     JG_TOKEN_TYPE,
     JL_TOKEN_TYPE,
     JGE_TOKEN_TYPE,
@@ -27,25 +43,61 @@ typedef enum token_type{
     PUSH_TOKEN_TYPE,
     SUB_TOKEN_TYPE,
     RET_TOKEN_TYPE,
+    TZCNT_TOKEN_TYPE,
     XOR_TOKEN_TYPE,
 
+    // SSE2
+    MOVDQU_TOKEN_TYPE,
+    MOVQ_TOKEN_TYPE,
+    PADDD_TOKEN_TYPE,
+    PADDQ_TOKEN_TYPE,
+    PCMPEQB_TOKEN_TYPE,
+    PMOVMSKB_TOKEN_TYPE,
+    PXOR_TOKEN_TYPE,
+
+    // AVX and AVX2
+    VMOVDQU_TOKEN_TYPE,
+    VPADDD_TOKEN_TYPE,
+    VPADDQ_TOKEN_TYPE,
+    VPBROADCASTB_TOKEN_TYPE,
+    VPBROADCASTD_TOKEN_TYPE,
+    VPBROADCASTQ_TOKEN_TYPE,
+    VPCMPEQB_TOKEN_TYPE,
+    VPMOVMSKB_TOKEN_TYPE,
+    VPXOR_TOKEN_TYPE,
+    VZEROUPPER_TOKEN_TYPE,
+
     IDENTIFIER_TOKEN_TYPE,
+    // Labels made up by passes over the instructions, see 'lexer_generate_label'
+    GENERATED_LABEL_TOKEN_TYPE,
 
     EOF_TOKEN_TYPE
 }TokenType;
 
+// Tokens do not own their lexeme, it is read back from the source
+// at 'offset'. Lines and columns are only needed to report errors,
+// so they are computed on demand (see 'lexer_token_location')
 typedef struct token{
-    int32_t    start_line;
-    int32_t    end_line;
-    int32_t    start_col;
-    int32_t    end_col;
-    size_t     offset_start;
-    size_t     offset_end;
-    size_t     lexeme_len;
-    size_t     literal_size;
-    TokenType  type;
-    const char *lexeme;
-    const void *literal;
+    uint32_t offset;
+    uint16_t len;
+    uint16_t type;
+    union{
+        int64_t     literal;
+        X64Register reg;
+    };
 }Token;
 
+// Value of the registers keywords
+typedef struct register_keyword{
+    TokenType   type;
+    X64Register reg;
+}RegisterKeyword;
+
+typedef struct token_location{
+    int32_t start_line;
+    int32_t end_line;
+    int32_t start_col;
+    int32_t end_col;
+}TokenLocation;
+
 #endif
@@ -1,7 +1,6 @@
 #ifndef TYPES_H
 #define TYPES_H
 
-#include "token.h"
 #include "essentials/dynarr.h"
 #include <stddef.h>
 #include <stdint.h>
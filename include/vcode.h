@@ -0,0 +1,59 @@
+#ifndef VCODE_H
+#define VCODE_H
+
+#include "myass.h"
+#include "types.h"
+#include <stdint.h>
+
+#define VCODE_NO_VREG UINT32_MAX
+#define VCODE_MAX_ARGS 6
+
+typedef uint32_t VReg;
+typedef struct vcode VCode;
+
+// Code over an unlimited number of virtual registers. 'vcode_emit'
+// maps them onto physical registers with a linear scan and writes the
+// function through the builder API of 'myass'. rax, rdx and r11 are
+// kept as scratch registers, rsp and rbp are left alone and the other
+// 11 are allocated
+VCode *vcode_create(MyAss *myass, const Allocator *allocator);
+void vcode_destroy(VCode *vcode);
+// Drops every op and virtual register, to build another function
+void vcode_reset(VCode *vcode);
+
+VReg vcode_vreg(VCode *vcode);
+// The 'index'th integer argument: rdi, rsi, rdx, rcx, r8 or r9
+VReg vcode_arg(VCode *vcode, size_t index);
+
+void vcode_mov_imm(VCode *vcode, VReg dst, qword src);
+void vcode_mov(VCode *vcode, VReg dst, VReg src);
+void vcode_add(VCode *vcode, VReg dst, VReg src);
+void vcode_add_imm(VCode *vcode, VReg dst, dword src);
+void vcode_sub(VCode *vcode, VReg dst, VReg src);
+void vcode_sub_imm(VCode *vcode, VReg dst, dword src);
+void vcode_imul(VCode *vcode, VReg dst, VReg src);
+void vcode_xor(VCode *vcode, VReg dst, VReg src);
+// Signed quotient and remainder of 'dst' by 'src', through idiv
+void vcode_div(VCode *vcode, VReg dst, VReg src);
+void vcode_rem(VCode *vcode, VReg dst, VReg src);
+void vcode_cmp(VCode *vcode, VReg a, VReg b);
+void vcode_cmp_imm(VCode *vcode, VReg a, dword b);
+
+// Labels come from 'myass_label_new'
+void vcode_label_bind(VCode *vcode, MyAssLabel label);
+void vcode_jcc(VCode *vcode, MyAssCondition condition, MyAssLabel label);
+void vcode_jmp(VCode *vcode, MyAssLabel label);
+// System V call. 'dst' gets rax, unless it is VCODE_NO_VREG
+void vcode_call(VCode *vcode, MyAssLabel target, VReg dst, size_t args_len, const VReg *args);
+void vcode_ret(VCode *vcode, VReg value);
+
+// Registers live across a call prefer callee saved ones, which the
+// prologue pushes when used, and the rest caller saved ones, which
+// are pushed around the calls they are live across. Intervals that
+// do not fit are spilled whole to [rbp - ...]. Returns 1 when out of
+// memory, here or while adding the ops, 0 otherwise
+int vcode_emit(VCode *vcode);
+// Spill slots taken by the last 'vcode_emit'
+size_t vcode_spills(const VCode *vcode);
+
+#endif
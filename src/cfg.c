@@ -0,0 +1,823 @@
+#include "cfg.h"
+#include "instruction.h"
+#include "essentials/lzohtable.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define NO_TARGET UINT32_MAX
+#define NO_BLOCK UINT32_MAX
+
+typedef struct cfg{
+    const Lexer     *lexer;
+    Instruction     **instructions;
+    size_t          len;
+    LZOHTable       *labels;     // name to index in 'instructions'
+    uint32_t        *targets;    // label index of each jump, NO_TARGET for the rest
+    byte            *removed;    // dropped by 'fold_jumps'
+    byte            *reachable;
+    uint32_t        *references; // jumps to each label
+    uint32_t        *pending;    // reachable instructions not walked yet
+    const Allocator *allocator;
+}Cfg;
+
+// Instructions from 'start' up to 'end'. Labels and alignment in front
+// of the code belong to the block they name
+typedef struct block{
+    uint32_t start;
+    uint32_t end;
+    uint32_t fall;      // block running on reaches, NO_BLOCK after a jmp or ret
+    uint32_t taken;     // block the ending jcc or jmp goes to, NO_BLOCK when unknown
+    uint64_t count;
+    Token    label;     // the first label in front, when 'labeled'
+    byte     labeled;
+    byte     generated; // 'label' was made up and goes in front of the block
+    byte     function;  // has a label not starting with '.', or is the first block
+    byte     profiled;  // has a count, given or inferred
+    byte     placed;
+}Block;
+
+typedef struct layout{
+    Cfg             *cfg;
+    Lexer           *lexer;
+    Block           *blocks;
+    size_t          blocks_len;
+    uint32_t        *order; // blocks in their new order
+    size_t          order_len;
+    const Allocator *allocator;
+}Layout;
+
+//------------------------------------------------------------
+//                      PRIVATE INTERFACE                   //
+//------------------------------------------------------------
+static int is_jcc(InstructionType type);
+static InstructionType invert_jcc(InstructionType type);
+static Token *jump_target(Instruction *instruction);
+static void set_jump_target(Instruction *instruction, const Token *label_token);
+static int index_labels(Cfg *cfg);
+static int falls_to(const Cfg *cfg, size_t from, size_t label_index);
+static uint32_t final_target(const Cfg *cfg, uint32_t label_index);
+static int thread_jumps(Cfg *cfg);
+static int fold_jumps(Cfg *cfg);
+static void reach(Cfg *cfg, size_t index, size_t *pending_len);
+static void mark_reachable(Cfg *cfg);
+static int compact(Cfg *cfg);
+static int ends_block(InstructionType type);
+static int starts_block(const Cfg *cfg, size_t index);
+static void split_blocks(Layout *layout, uint32_t *block_of);
+static void count_blocks(Layout *layout, LZOHTable *counts);
+static void place_block(Layout *layout, uint32_t block_index);
+static void place_function(Layout *layout, uint32_t from, uint32_t to, uint32_t *cold, size_t *cold_len);
+static Token *block_label(Layout *layout, uint32_t block_index);
+static Instruction *create_jmp(const Token *label_token, const Allocator *allocator);
+static Instruction *link_block(Layout *layout, uint32_t block_index, uint32_t next_index);
+static int place_blocks(Layout *layout, uint32_t *cold);
+static DynArr *emit_blocks(Layout *layout, size_t len);
+
+//------------------------------------------------------------
+//                    PRIVATE IMPLEMENTATION                //
+//------------------------------------------------------------
+int is_jcc(InstructionType type){
+    switch (type){
+        case JE_INSTRUCTION_TYPE:
+        case JNE_INSTRUCTION_TYPE:
+        case JG_INSTRUCTION_TYPE:
+        case JL_INSTRUCTION_TYPE:
+        case JGE_INSTRUCTION_TYPE:
+        case JLE_INSTRUCTION_TYPE:{
+            return 1;
+        }default:{
+            return 0;
+        }
+    }
+}
+
+InstructionType invert_jcc(InstructionType type){
+    switch (type){
+        case JE_INSTRUCTION_TYPE:{
+            return JNE_INSTRUCTION_TYPE;
+        }case JNE_INSTRUCTION_TYPE:{
+            return JE_INSTRUCTION_TYPE;
+        }case JG_INSTRUCTION_TYPE:{
+            return JLE_INSTRUCTION_TYPE;
+        }case JL_INSTRUCTION_TYPE:{
+            return JGE_INSTRUCTION_TYPE;
+        }case JGE_INSTRUCTION_TYPE:{
+            return JL_INSTRUCTION_TYPE;
+        }case JLE_INSTRUCTION_TYPE:{
+            return JG_INSTRUCTION_TYPE;
+        }default:{
+            assert(0 && "Illegal instruction type");
+        }
+    }
+
+    return type;
+}
+
+// The label of a jcc, jmp or call, NULL for anything else or a stencil target hole
+Token *jump_target(Instruction *instruction){
+    if(!is_jcc(instruction->type) &&
+       instruction->type != JMP_INSTRUCTION_TYPE &&
+       instruction->type != CALL_INSTRUCTION_TYPE){
+        return NULL;
+    }
+
+    UnaryInstruction *unary_instruction = instruction->sub_instruction;
+    Location *location = unary_instruction->location;
+
+    if(location->type != LABEL_LOCATION_TYPE){
+        return NULL;
+    }
+
+    LabelLocation *label_location = location->sub_location;
+    Token *label_token = &label_location->label_token;
+
+    return label_token->type == IDENTIFIER_TOKEN_TYPE ||
+           label_token->type == GENERATED_LABEL_TOKEN_TYPE ? label_token : NULL;
+}
+
+void set_jump_target(Instruction *instruction, const Token *label_token){
+    UnaryInstruction *unary_instruction = instruction->sub_instruction;
+    LabelLocation *label_location = unary_instruction->location->sub_location;
+
+    label_location->label_token = *label_token;
+    unary_instruction->operand_token = *label_token;
+}
+
+// Also resolves the target of every jump. Returns 1 when a label is defined twice
+int index_labels(Cfg *cfg){
+    LZOHTable *labels = cfg->labels;
+
+    lzohtable_clear_help(NULL, NULL, labels);
+
+    for (uint32_t i = 0; i < cfg->len; i++){
+        Instruction *instruction = cfg->instructions[i];
+
+        if(instruction->type != LABEL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        EmptyInstruction *label_instruction = instruction->sub_instruction;
+        Token *label_token = &label_instruction->token;
+        const char *name = lexer_lexeme(cfg->lexer, label_token);
+
+        if(lzohtable_lookup(label_token->len, name, labels, NULL)){
+            return 1;
+        }
+
+        lzohtable_put_ckv(label_token->len, name, sizeof(uint32_t), &i, labels, NULL);
+    }
+
+    for (size_t i = 0; i < cfg->len; i++){
+        Token *label_token = jump_target(cfg->instructions[i]);
+        uint32_t *label_index = NULL;
+
+        // Calls the source does not define keep NO_TARGET
+        if(label_token && lzohtable_lookup(
+            label_token->len,
+            lexer_lexeme(cfg->lexer, label_token),
+            labels,
+            (void **)(&label_index)
+        )){
+            cfg->targets[i] = *label_index;
+        }else{
+            cfg->targets[i] = NO_TARGET;
+        }
+    }
+
+    return 0;
+}
+
+// Whether running on from 'from' reaches the label without executing anything
+int falls_to(const Cfg *cfg, size_t from, size_t label_index){
+    if(label_index < from){
+        return 0;
+    }
+
+    for (size_t i = from; i < label_index; i++){
+        if(!cfg->removed[i] && cfg->instructions[i]->type != LABEL_INSTRUCTION_TYPE){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Follows blocks that are only a 'jmp'. Cycles of them are left alone
+uint32_t final_target(const Cfg *cfg, uint32_t label_index){
+    uint32_t target = label_index;
+
+    for (size_t steps = 0; steps < cfg->len; steps++){
+        size_t next = target + 1;
+
+        while(next < cfg->len && cfg->instructions[next]->type == LABEL_INSTRUCTION_TYPE){
+            next++;
+        }
+
+        if(next == cfg->len ||
+           cfg->instructions[next]->type != JMP_INSTRUCTION_TYPE ||
+           cfg->targets[next] == NO_TARGET ||
+           cfg->targets[next] == target){
+            return target;
+        }
+
+        target = cfg->targets[next];
+    }
+
+    return label_index;
+}
+
+int thread_jumps(Cfg *cfg){
+    int changed = 0;
+
+    for (size_t i = 0; i < cfg->len; i++){
+        uint32_t label_index = cfg->targets[i];
+
+        if(label_index == NO_TARGET){
+            continue;
+        }
+
+        uint32_t target = final_target(cfg, label_index);
+
+        if(target != label_index){
+            EmptyInstruction *label_instruction = cfg->instructions[target]->sub_instruction;
+
+            set_jump_target(cfg->instructions[i], &label_instruction->token);
+            cfg->targets[i] = target;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+// Drops jumps to the block right after them, and turns 'jcc .a; jmp .b; .a:'
+// into 'jncc .b; .a:'
+int fold_jumps(Cfg *cfg){
+    int changed = 0;
+
+    for (size_t i = 0; i < cfg->len; i++){
+        Instruction *instruction = cfg->instructions[i];
+        uint32_t label_index = cfg->targets[i];
+
+        if(label_index == NO_TARGET || instruction->type == CALL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        if(falls_to(cfg, i + 1, label_index)){
+            cfg->removed[i] = 1;
+            changed = 1;
+
+            continue;
+        }
+
+        if(!is_jcc(instruction->type) || i + 1 == cfg->len){
+            continue;
+        }
+
+        Instruction *next = cfg->instructions[i + 1];
+
+        if(next->type == JMP_INSTRUCTION_TYPE &&
+           cfg->targets[i + 1] != NO_TARGET &&
+           falls_to(cfg, i + 2, label_index)){
+            instruction->type = invert_jcc(instruction->type);
+            set_jump_target(instruction, jump_target(next));
+            cfg->targets[i] = cfg->targets[i + 1];
+            cfg->removed[i + 1] = 1;
+            changed = 1;
+            i++;
+        }
+    }
+
+    return changed;
+}
+
+void reach(Cfg *cfg, size_t index, size_t *pending_len){
+    if(index < cfg->len && !cfg->reachable[index]){
+        cfg->reachable[index] = 1;
+        cfg->pending[(*pending_len)++] = (uint32_t)index;
+    }
+}
+
+// Also counts the jumps to each label from reachable code
+void mark_reachable(Cfg *cfg){
+    size_t len = cfg->len;
+    size_t pending_len = 0;
+
+    memset(cfg->reachable, 0, len);
+    memset(cfg->references, 0, sizeof(uint32_t) * len);
+
+    reach(cfg, 0, &pending_len);
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = cfg->instructions[i];
+
+        if(instruction->type != LABEL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        EmptyInstruction *label_instruction = instruction->sub_instruction;
+
+        if(lexer_lexeme(cfg->lexer, &label_instruction->token)[0] != '.'){
+            reach(cfg, i, &pending_len);
+        }
+    }
+
+    while(pending_len > 0){
+        size_t index = cfg->pending[--pending_len];
+        Instruction *instruction = cfg->instructions[index];
+
+        if(cfg->removed[index]){
+            reach(cfg, index + 1, &pending_len);
+            continue;
+        }
+
+        uint32_t label_index = cfg->targets[index];
+
+        if(label_index != NO_TARGET){
+            cfg->references[label_index]++;
+            reach(cfg, label_index, &pending_len);
+        }
+
+        if(instruction->type != JMP_INSTRUCTION_TYPE && instruction->type != RET_INSTRUCTION_TYPE){
+            reach(cfg, index + 1, &pending_len);
+        }
+    }
+
+    // Alignment in front of reachable code is kept
+    for (size_t i = len; i > 1; i--){
+        if(cfg->reachable[i - 1] && cfg->instructions[i - 2]->type == ALIGN_INSTRUCTION_TYPE){
+            cfg->reachable[i - 2] = 1;
+        }
+    }
+}
+
+// Returns 1 when something was dropped
+int compact(Cfg *cfg){
+    size_t len = 0;
+
+    for (size_t i = 0; i < cfg->len; i++){
+        Instruction *instruction = cfg->instructions[i];
+
+        if(cfg->removed[i] || !cfg->reachable[i]){
+            continue;
+        }
+
+        if(instruction->type == LABEL_INSTRUCTION_TYPE && cfg->references[i] == 0){
+            EmptyInstruction *label_instruction = instruction->sub_instruction;
+
+            if(lexer_lexeme(cfg->lexer, &label_instruction->token)[0] == '.'){
+                continue;
+            }
+        }
+
+        cfg->instructions[len++] = instruction;
+    }
+
+    int changed = len != cfg->len;
+
+    cfg->len = len;
+    memset(cfg->removed, 0, len);
+
+    return changed;
+}
+
+int ends_block(InstructionType type){
+    return is_jcc(type) || type == JMP_INSTRUCTION_TYPE || type == RET_INSTRUCTION_TYPE;
+}
+
+// Labels, and the alignment in front of them, start a block unless
+// they follow other labels or alignment
+int starts_block(const Cfg *cfg, size_t index){
+    if(index == 0){
+        return 1;
+    }
+
+    InstructionType type = cfg->instructions[index]->type;
+    InstructionType previous_type = cfg->instructions[index - 1]->type;
+
+    if(ends_block(previous_type)){
+        return 1;
+    }
+
+    return (type == LABEL_INSTRUCTION_TYPE || type == ALIGN_INSTRUCTION_TYPE) &&
+           previous_type != LABEL_INSTRUCTION_TYPE &&
+           previous_type != ALIGN_INSTRUCTION_TYPE;
+}
+
+// 'block_of' maps every instruction to its block
+void split_blocks(Layout *layout, uint32_t *block_of){
+    Cfg *cfg = layout->cfg;
+    Block *blocks = layout->blocks;
+    size_t len = 0;
+
+    for (uint32_t i = 0; i < cfg->len; i++){
+        if(starts_block(cfg, i)){
+            blocks[len++] = (Block){.start = i, .fall = NO_BLOCK, .taken = NO_BLOCK};
+        }
+
+        blocks[len - 1].end = i + 1;
+        block_of[i] = (uint32_t)(len - 1);
+    }
+
+    blocks[0].function = 1;
+
+    for (size_t i = 0; i < len; i++){
+        Block *block = &blocks[i];
+        InstructionType last_type = cfg->instructions[block->end - 1]->type;
+        uint32_t target = cfg->targets[block->end - 1];
+
+        for (uint32_t j = block->start; j < block->end; j++){
+            Instruction *instruction = cfg->instructions[j];
+
+            if(instruction->type == ALIGN_INSTRUCTION_TYPE){
+                continue;
+            }
+
+            if(instruction->type != LABEL_INSTRUCTION_TYPE){
+                break;
+            }
+
+            EmptyInstruction *label_instruction = instruction->sub_instruction;
+
+            if(!block->labeled){
+                block->label = label_instruction->token;
+                block->labeled = 1;
+            }
+
+            if(lexer_lexeme(cfg->lexer, &label_instruction->token)[0] != '.'){
+                block->function = 1;
+            }
+        }
+
+        if(last_type != JMP_INSTRUCTION_TYPE && last_type != RET_INSTRUCTION_TYPE && i + 1 < len){
+            block->fall = (uint32_t)(i + 1);
+        }
+
+        if(last_type != CALL_INSTRUCTION_TYPE && target != NO_TARGET){
+            block->taken = block_of[target];
+        }
+    }
+
+    layout->blocks_len = len;
+}
+
+// A block takes the largest count of its labels. Unlabeled blocks, and
+// labels the profile misses, take what their predecessor in the source
+// passes on by running on: all of its count, or what is left once its
+// jcc took the count of its target
+void count_blocks(Layout *layout, LZOHTable *counts){
+    Cfg *cfg = layout->cfg;
+    Block *blocks = layout->blocks;
+
+    for (size_t i = 0; i < layout->blocks_len; i++){
+        Block *block = &blocks[i];
+
+        for (uint32_t j = block->start; j < block->end; j++){
+            Instruction *instruction = cfg->instructions[j];
+
+            if(instruction->type != LABEL_INSTRUCTION_TYPE){
+                continue;
+            }
+
+            EmptyInstruction *label_instruction = instruction->sub_instruction;
+            Token *label_token = &label_instruction->token;
+            uint64_t *count = NULL;
+
+            if(lzohtable_lookup(
+                label_token->len,
+                lexer_lexeme(cfg->lexer, label_token),
+                counts,
+                (void **)(&count)
+            )){
+                block->count = block->profiled && block->count > *count ? block->count : *count;
+                block->profiled = 1;
+            }
+        }
+
+        if(block->profiled || i == 0 || block->function){
+            continue;
+        }
+
+        Block *previous = &blocks[i - 1];
+
+        if(previous->fall != i || !previous->profiled){
+            continue;
+        }
+
+        block->count = previous->count;
+        block->profiled = 1;
+
+        if(previous->taken != NO_BLOCK && blocks[previous->taken].profiled){
+            uint64_t taken_count = blocks[previous->taken].count;
+
+            block->count = previous->count > taken_count ? previous->count - taken_count : 0;
+        }
+    }
+}
+
+void place_block(Layout *layout, uint32_t block_index){
+    layout->blocks[block_index].placed = 1;
+    layout->order[layout->order_len++] = block_index;
+}
+
+// Chains the hot blocks of the function from its first one: each block
+// is followed by its hottest successor not placed yet, or, when there
+// is none, by the first hot block left. Blocks that never ran go to
+// 'cold'. Functions without counts keep their order
+void place_function(Layout *layout, uint32_t from, uint32_t to, uint32_t *cold, size_t *cold_len){
+    Block *blocks = layout->blocks;
+    int profiled = 0;
+
+    for (uint32_t i = from; i < to; i++){
+        profiled |= blocks[i].count > 0;
+    }
+
+    if(!profiled){
+        for (uint32_t i = from; i < to; i++){
+            place_block(layout, i);
+        }
+
+        return;
+    }
+
+    uint32_t current = from;
+    uint32_t first_left = from + 1;
+
+    place_block(layout, current);
+
+    for (;;){
+        Block *block = &blocks[current];
+        uint32_t successors[] = {block->fall, block->taken};
+        uint32_t next = NO_BLOCK;
+
+        for (size_t i = 0; i < sizeof(successors) / sizeof(successors[0]); i++){
+            uint32_t successor = successors[i];
+
+            if(successor == NO_BLOCK || successor < from || successor >= to ||
+               blocks[successor].placed || blocks[successor].count == 0){
+                continue;
+            }
+
+            if(next == NO_BLOCK || blocks[successor].count > blocks[next].count){
+                next = successor;
+            }
+        }
+
+        if(next == NO_BLOCK){
+            while(first_left < to && (blocks[first_left].placed || blocks[first_left].count == 0)){
+                first_left++;
+            }
+
+            if(first_left == to){
+                break;
+            }
+
+            next = first_left;
+        }
+
+        place_block(layout, next);
+        current = next;
+    }
+
+    for (uint32_t i = from; i < to; i++){
+        if(!blocks[i].placed){
+            cold[(*cold_len)++] = i;
+        }
+    }
+}
+
+// Makes up a label for blocks without one
+Token *block_label(Layout *layout, uint32_t block_index){
+    Block *block = &layout->blocks[block_index];
+
+    if(!block->labeled){
+        block->label = lexer_generate_label(layout->lexer);
+        block->labeled = 1;
+        block->generated = 1;
+    }
+
+    return &block->label;
+}
+
+Instruction *create_jmp(const Token *label_token, const Allocator *allocator){
+    LabelLocation *label_location = MEMORY_NEW(allocator, LabelLocation, *label_token);
+    Location *location = MEMORY_NEW(allocator, Location, LABEL_LOCATION_TYPE, label_location);
+    UnaryInstruction *unary_instruction = MEMORY_NEW(
+        allocator,
+        UnaryInstruction,
+        location,
+        *label_token,
+        *label_token
+    );
+
+    // Like alignment padding, it has no source
+    return MEMORY_NEW(allocator, Instruction, 0, 0, JMP_INSTRUCTION_TYPE, unary_instruction, 0, 0);
+}
+
+// Keeps the block going where it went now that 'next_index' follows it.
+// A jmp to the next block is dropped, a jcc to it inverted, and a block
+// that ran on into another one gets a jmp to it, which is returned
+Instruction *link_block(Layout *layout, uint32_t block_index, uint32_t next_index){
+    Block *block = &layout->blocks[block_index];
+    Instruction *last = layout->cfg->instructions[block->end - 1];
+
+    if(last->type == JMP_INSTRUCTION_TYPE && block->taken == next_index){
+        block->end--;
+        return NULL;
+    }
+
+    if(block->fall == NO_BLOCK || block->fall == next_index){
+        return NULL;
+    }
+
+    Token *fall_label = block_label(layout, block->fall);
+
+    if(is_jcc(last->type) && block->taken == next_index){
+        last->type = invert_jcc(last->type);
+        set_jump_target(last, fall_label);
+
+        return NULL;
+    }
+
+    return create_jmp(fall_label, layout->allocator);
+}
+
+// Places every function in turn, then the cold blocks of all of them.
+// 'cold' must fit every block. Returns 1 when any block moved
+int place_blocks(Layout *layout, uint32_t *cold){
+    size_t cold_len = 0;
+
+    for (uint32_t from = 0; from < layout->blocks_len;){
+        uint32_t to = from + 1;
+
+        while(to < layout->blocks_len && !layout->blocks[to].function){
+            to++;
+        }
+
+        place_function(layout, from, to, cold, &cold_len);
+        from = to;
+    }
+
+    memcpy(layout->order + layout->order_len, cold, sizeof(uint32_t) * cold_len);
+    layout->order_len += cold_len;
+
+    for (size_t i = 0; i < layout->order_len; i++){
+        if(layout->order[i] != i){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+DynArr *emit_blocks(Layout *layout, size_t len){
+    const Allocator *allocator = layout->allocator;
+    size_t order_len = layout->order_len;
+    Instruction **jmps = MEMORY_ALLOC(Instruction *, order_len, allocator);
+
+    // Linking makes up the labels blocks need before any is emitted
+    for (size_t i = 0; i < order_len; i++){
+        uint32_t next_index = i + 1 < order_len ? layout->order[i + 1] : NO_BLOCK;
+
+        jmps[i] = link_block(layout, layout->order[i], next_index);
+    }
+
+    DynArr *laid_out_instructions = dynarr_create_by(
+        sizeof(uintptr_t),
+        len + order_len * 2,
+        (DynArrAllocator *)allocator
+    );
+
+    for (size_t i = 0; i < order_len; i++){
+        Block *block = &layout->blocks[layout->order[i]];
+
+        if(block->generated){
+            EmptyInstruction *label_instruction = MEMORY_NEW(allocator, EmptyInstruction, block->label);
+
+            dynarr_insert_ptr(
+                MEMORY_NEW(allocator, Instruction, 0, 0, LABEL_INSTRUCTION_TYPE, label_instruction, 0, 0),
+                laid_out_instructions
+            );
+        }
+
+        for (uint32_t j = block->start; j < block->end; j++){
+            dynarr_insert_ptr(layout->cfg->instructions[j], laid_out_instructions);
+        }
+
+        if(jmps[i]){
+            dynarr_insert_ptr(jmps[i], laid_out_instructions);
+        }
+    }
+
+    MEMORY_DEALLOC(jmps, Instruction *, order_len, allocator);
+
+    return laid_out_instructions;
+}
+
+//------------------------------------------------------------
+//                    PUBLIC IMPLEMENTATION                 //
+//------------------------------------------------------------
+DynArr *cfg_simplify(const Lexer *lexer, DynArr *instructions, const Allocator *allocator){
+    size_t len = DYNARR_LEN(instructions);
+    Cfg cfg = {
+        .lexer = lexer,
+        .instructions = MEMORY_ALLOC(Instruction *, len, allocator),
+        .len = len,
+        .labels = MEMORY_LZOHTABLE(allocator),
+        .targets = MEMORY_ALLOC(uint32_t, len, allocator),
+        .removed = MEMORY_ALLOC(byte, len, allocator),
+        .reachable = MEMORY_ALLOC(byte, len, allocator),
+        .references = MEMORY_ALLOC(uint32_t, len, allocator),
+        .pending = MEMORY_ALLOC(uint32_t, len, allocator),
+        .allocator = allocator
+    };
+    int changed = 0;
+    int duplicated = 0;
+
+    for (size_t i = 0; i < len; i++){
+        cfg.instructions[i] = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+    }
+
+    memset(cfg.removed, 0, len);
+
+    // Every round that changes something drops or retargets at least one
+    // instruction, so the rounds are bounded
+    while(!(duplicated = index_labels(&cfg))){
+        int round_changed = thread_jumps(&cfg);
+
+        round_changed |= fold_jumps(&cfg);
+        mark_reachable(&cfg);
+        round_changed |= compact(&cfg);
+
+        if(!round_changed){
+            break;
+        }
+
+        changed = 1;
+    }
+
+    DynArr *simplified_instructions = NULL;
+
+    if(changed && !duplicated){
+        simplified_instructions = dynarr_create_by(sizeof(uintptr_t), cfg.len, (DynArrAllocator *)allocator);
+
+        for (size_t i = 0; i < cfg.len; i++){
+            dynarr_insert_ptr(cfg.instructions[i], simplified_instructions);
+        }
+    }
+
+    MEMORY_DEALLOC(cfg.instructions, Instruction *, len, allocator);
+    LZOHTABLE_DESTROY(cfg.labels);
+    MEMORY_DEALLOC(cfg.targets, uint32_t, len, allocator);
+    MEMORY_DEALLOC(cfg.removed, byte, len, allocator);
+    MEMORY_DEALLOC(cfg.reachable, byte, len, allocator);
+    MEMORY_DEALLOC(cfg.references, uint32_t, len, allocator);
+    MEMORY_DEALLOC(cfg.pending, uint32_t, len, allocator);
+
+    return simplified_instructions;
+}
+
+DynArr *cfg_layout(Lexer *lexer, DynArr *instructions, LZOHTable *counts, const Allocator *allocator){
+    size_t len = DYNARR_LEN(instructions);
+    Cfg cfg = {
+        .lexer = lexer,
+        .instructions = MEMORY_ALLOC(Instruction *, len, allocator),
+        .len = len,
+        .labels = MEMORY_LZOHTABLE(allocator),
+        .targets = MEMORY_ALLOC(uint32_t, len, allocator),
+        .allocator = allocator
+    };
+    Layout layout = {
+        .cfg = &cfg,
+        .lexer = lexer,
+        .blocks = MEMORY_ALLOC(Block, len, allocator),
+        .order = MEMORY_ALLOC(uint32_t, len, allocator),
+        .allocator = allocator
+    };
+    uint32_t *block_of = MEMORY_ALLOC(uint32_t, len, allocator);
+    DynArr *laid_out_instructions = NULL;
+
+    for (size_t i = 0; i < len; i++){
+        cfg.instructions[i] = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+    }
+
+    if(len > 0 && !index_labels(&cfg)){
+        split_blocks(&layout, block_of);
+        count_blocks(&layout, counts);
+
+        // 'block_of' is not needed anymore and fits the cold blocks
+        if(place_blocks(&layout, block_of)){
+            laid_out_instructions = emit_blocks(&layout, len);
+        }
+    }
+
+    MEMORY_DEALLOC(cfg.instructions, Instruction *, len, allocator);
+    LZOHTABLE_DESTROY(cfg.labels);
+    MEMORY_DEALLOC(cfg.targets, uint32_t, len, allocator);
+    MEMORY_DEALLOC(layout.blocks, Block, len, allocator);
+    MEMORY_DEALLOC(layout.order, uint32_t, len, allocator);
+    MEMORY_DEALLOC(block_of, uint32_t, len, allocator);
+
+    return laid_out_instructions;
+}
@@ -53,9 +53,47 @@ static inline void lzdealloc(void *ptr, size_t size, LZArenaAllocator *allocator
     }
 }
 
-static LZRegion *create_region(size_t requested_size, LZArenaAllocator *allocator){
+#if LZARENA_BACKEND == LZARENA_BACKEND_MMAP
+static void *mmap_aligned(size_t size, size_t alignment){
+    size_t padded_size = size + alignment;
+    char *raw = (char *)mmap(
+        NULL,
+        padded_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+
+    if(raw == MAP_FAILED){
+        return MAP_FAILED;
+    }
+
+    uintptr_t start = align_forward((uintptr_t)raw, alignment);
+    size_t head = start - (uintptr_t)raw;
+    size_t tail = padded_size - head - size;
+
+    if(head > 0){
+        munmap(raw, head);
+    }
+
+    if(tail > 0){
+        munmap((char *)start + size, tail);
+    }
+
+    return (void *)start;
+}
+#endif
+
+static LZRegion *create_region(size_t requested_size, LZArena *arena){
+    LZArenaAllocator *allocator = arena->allocator;
+
     requested_size += REGION_SIZE;
 
+    if(requested_size < arena->region_size){
+        requested_size = arena->region_size;
+    }
+
     size_t page_size = (size_t)PAGE_SIZE;
     size_t needed_pages = requested_size / page_size;
     size_t pre_needed_size = needed_pages * page_size;
@@ -74,16 +112,23 @@ static LZRegion *create_region(size_t requested_size, LZArenaAllocator *allocato
         return lzregion_init(needed_size, buff);
     }
 
-    return lzregion_create(needed_size);
+    return lzregion_create_flags(needed_size, arena->flags);
 }
 
 static int append_region(size_t size, LZArena *arena){
-    LZRegion *region = create_region(size, arena->allocator);
+    LZRegion *region = create_region(size, arena);
 
     if(!region){
         return LZARENA_ERR_ALLOC;
     }
 
+    size_t next_region_size = arena->region_size * arena->factor;
+
+    arena->region_size =
+        next_region_size > arena->max_region_size ?
+        arena->max_region_size :
+        next_region_size;
+
     region->reset = arena->reset;
 
     if(arena->tail){
@@ -98,6 +143,23 @@ static int append_region(size_t size, LZArena *arena){
     return LZARENA_OK;
 }
 
+static void destroy_regions(LZArena *arena){
+    LZArenaAllocator *allocator = arena->allocator;
+    LZRegion *current = arena->head;
+
+    while(current){
+		LZRegion *next = current->next;
+
+        if(allocator){
+            lzdealloc(current, current->region_size, allocator);
+        }else{
+            lzregion_destroy(current);
+        }
+
+		current = next;
+	}
+}
+
 LZRegion *lzregion_init(size_t buff_size, void *buffer){
 	uintptr_t buff_start = (uintptr_t)buffer;
 	uintptr_t buff_end = buff_start + buff_size;
@@ -121,7 +183,11 @@ LZRegion *lzregion_init(size_t buff_size, void *buffer){
     return region;
 }
 
-LZRegion *lzregion_create(size_t size){
+inline LZRegion *lzregion_create(size_t size){
+    return lzregion_create_flags(size, 0);
+}
+
+LZRegion *lzregion_create_flags(size_t size, int flags){
 #ifndef LZARENA_BACKEND
     #error "A backend must be defined"
 #endif
@@ -133,14 +199,47 @@ LZRegion *lzregion_create(size_t size){
         return NULL;
     }
 #elif LZARENA_BACKEND == LZARENA_BACKEND_MMAP
-    char *buffer = (char *)mmap(
-		NULL,
-		size,
-		PROT_READ | PROT_WRITE,
-		MAP_PRIVATE | MAP_ANONYMOUS,
-		-1,
-		0
-    );
+    char *buffer = MAP_FAILED;
+    int huge = size >= LZARENA_HUGE_PAGE_SIZE && (flags & (LZARENA_FLAG_HUGETLB | LZARENA_FLAG_THP));
+
+    if(huge){
+        size = align_forward(size, LZARENA_HUGE_PAGE_SIZE);
+    }
+
+#ifdef MAP_HUGETLB
+    if(huge && (flags & LZARENA_FLAG_HUGETLB)){
+        // Fails unless the system has huge pages reserved
+        buffer = (char *)mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+            -1,
+            0
+        );
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    if(buffer == MAP_FAILED && huge && (flags & LZARENA_FLAG_THP)){
+        buffer = (char *)mmap_aligned(size, LZARENA_HUGE_PAGE_SIZE);
+
+        if(buffer != MAP_FAILED){
+            madvise(buffer, size, MADV_HUGEPAGE);
+        }
+    }
+#endif
+
+    if(buffer == MAP_FAILED){
+        buffer = (char *)mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0
+        );
+    }
 
     if(buffer == MAP_FAILED){
         return NULL;
@@ -187,7 +286,7 @@ void lzregion_destroy(LZRegion *region){
 
 size_t lzregion_available(LZRegion *region){
     uintptr_t offset = (uintptr_t)region->offset;
-    uintptr_t chunk_end = offset + region->chunk_size;
+    uintptr_t chunk_end = (uintptr_t)region->chunk + region->chunk_size;
 
     return offset >= chunk_end ? 0 : chunk_end - offset;
 }
@@ -208,7 +307,7 @@ void *lzregion_alloc_align(size_t size, size_t alignment, LZRegion *region, size
     }
 
     uintptr_t old_offset = (uintptr_t)region->offset;
-    uintptr_t chunk_end = old_offset + region->chunk_size;
+    uintptr_t chunk_end = (uintptr_t)region->chunk + region->chunk_size;
     uintptr_t area_start = align_forward(old_offset, alignment);
     uintptr_t area_end = area_start + size;
 
@@ -235,6 +334,25 @@ void *lzregion_calloc_align(size_t size, size_t alignment, LZRegion *region){
     return ptr;
 }
 
+// Grows 'ptr' in place when it is the last allocation of 'region'
+static int region_extend(void *ptr, size_t old_size, size_t new_size, LZRegion *region){
+    uintptr_t area_start = (uintptr_t)ptr;
+    uintptr_t chunk_start = (uintptr_t)region->chunk;
+    uintptr_t chunk_end = chunk_start + region->chunk_size;
+
+    if(area_start < chunk_start || area_start + old_size != (uintptr_t)region->offset){
+        return 0;
+    }
+
+    if(new_size > chunk_end - area_start){
+        return 0;
+    }
+
+    region->offset = (void *)(area_start + new_size);
+
+    return 1;
+}
+
 void *lzregion_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t alignment, LZRegion *region){
     if(!ptr){
         return lzregion_alloc_align(new_size, alignment, region, NULL);
@@ -248,6 +366,10 @@ void *lzregion_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t
         return ptr;
     }
 
+    if(region_extend(ptr, old_size, new_size, region)){
+        return ptr;
+    }
+
 	void *new_ptr = lzregion_alloc_align(new_size, alignment, region, NULL);
 
 	if(new_ptr){
@@ -265,7 +387,12 @@ LZArena *lzarena_create(LZArenaAllocator *allocator){
     }
 
     arena->reset = 0;
+    arena->flags = 0;
     arena->allocted_bytes = 0;
+    arena->wasted_bytes = 0;
+    arena->region_size = LZARENA_DEFAULT_REGION_SIZE;
+    arena->factor = LZARENA_DEFAULT_FACTOR;
+    arena->max_region_size = LZARENA_DEFAULT_MAX_REGION_SIZE;
     arena->head = NULL;
     arena->tail = NULL;
     arena->current = NULL;
@@ -279,25 +406,21 @@ void lzarena_destroy(LZArena *arena){
         return;
     }
 
-    LZArenaAllocator *allocator = arena->allocator;
-    LZRegion *current = arena->head;
-
-    while(current){
-		LZRegion *next = current->next;
-
-        if(allocator){
-            lzdealloc(current, current->region_size, allocator);
-        }else{
-            lzregion_destroy(current);
-        }
+    destroy_regions(arena);
+    lzdealloc(arena, ARENA_SIZE, arena->allocator);
+}
 
-		current = next;
-	}
+void lzarena_growth(size_t region_size, size_t factor, size_t max_region_size, LZArena *arena){
+    arena->region_size = region_size;
+    arena->factor = factor == 0 ? 1 : factor;
+    arena->max_region_size = max_region_size < region_size ? region_size : max_region_size;
+}
 
-    lzdealloc(arena, ARENA_SIZE, allocator);
+inline void lzarena_flags(int flags, LZArena *arena){
+    arena->flags = flags;
 }
 
-void lzarena_report(size_t *used, size_t *size, LZArena *arena){
+void lzarena_report(size_t *used, size_t *size, size_t *wasted, LZArena *arena){
     size_t u = 0;
     size_t s = 0;
     LZRegion *current = arena->head;
@@ -312,18 +435,33 @@ void lzarena_report(size_t *used, size_t *size, LZArena *arena){
 
 	*used = u;
 	*size = s;
+
+	if(wasted){
+		*wasted = arena->wasted_bytes;
+	}
 }
 
 inline int lzarena_append_region(size_t size, LZArena *arena){
     return append_region(size, arena);
 }
 
+void lzarena_release(LZArena *arena){
+    destroy_regions(arena);
+
+    arena->allocted_bytes = 0;
+    arena->wasted_bytes = 0;
+    arena->head = NULL;
+    arena->tail = NULL;
+    arena->current = NULL;
+}
+
 inline void lzarena_free_all(LZArena *arena){
     if(!arena->current){
         return;
     }
 
     arena->allocted_bytes = 0;
+    arena->wasted_bytes = 0;
 
     if(arena->head == arena->tail){
         arena->current->offset = arena->current->chunk;
@@ -387,10 +525,19 @@ void *lzarena_realloc_align(void *ptr, size_t old_size, size_t new_size, size_t
         return ptr;
     }
 
+    LZRegion *current = arena->current;
+
+    // A stale region may still hold an offset from before the last lzarena_free_all
+    if(current && current->reset == arena->reset && region_extend(ptr, old_size, new_size, current)){
+        arena->allocted_bytes += new_size - old_size;
+        return ptr;
+    }
+
 	void *new_ptr = lzarena_alloc_align(new_size, alignment, arena);
 
 	if(new_ptr){
         memcpy(new_ptr, ptr, old_size);
+        arena->wasted_bytes += old_size;
     }
 
     return new_ptr;
@@ -144,6 +144,10 @@ inline int lzbbuff_restart(LZBBuff *buff){
     return used_bytes;
 }
 
+inline void lzbbuff_truncate(LZBBuff *buff, size_t len){
+    buff->offset = buff->raw_buff + len;
+}
+
 inline size_t lzbbuff_used_bytes(const LZBBuff *buff){
     return buff->offset - buff->raw_buff;
 }
@@ -10,14 +10,71 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+// 0 keeps only the scalar scanner and 1 only the SSE2 one. 2 also
+// builds the AVX2 one, picked at run time when the CPU has it
+#ifndef LEXER_SIMD
+    #if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+        #define LEXER_SIMD 2
+    #else
+        #define LEXER_SIMD 0
+    #endif
+#endif
+
+#if LEXER_SIMD
+    #include <immintrin.h>
+#endif
+
 #define ALLOCATOR (lexer->allocator)
 
-static int64_t decimal_str_to_i64(size_t str_len, const char *str);
+// Scanners classify whole runs of characters at once. Every function
+// returns the offset of the first character that does not belong to
+// the run, never reading past 'len'. 'blanks' appends to 'lines' the
+// offset following every newline of the run.
+struct lexer_scanner{
+    size_t (*blanks)(const char *buff, size_t from, size_t len, DynArr *lines);
+    size_t (*identifier)(const char *buff, size_t from, size_t len);
+    size_t (*digits)(const char *buff, size_t from, size_t len);
+};
+
+static int str_to_literal(size_t str_len, const char *str, int64_t *out_literal);
+static int hex_digit_value(char c);
 static int is_digit(char c);
 static int is_alpha(char c);
 static int is_alpha_numeric(char c);
 
+static size_t scalar_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+);
+static size_t scalar_identifier(const char *buff, size_t from, size_t len);
+static size_t scalar_digits(const char *buff, size_t from, size_t len);
+#if LEXER_SIMD
+static size_t sse2_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+);
+static size_t sse2_identifier(const char *buff, size_t from, size_t len);
+static size_t sse2_digits(const char *buff, size_t from, size_t len);
+#endif
+#if LEXER_SIMD >= 2
+static size_t avx2_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+);
+static size_t avx2_identifier(const char *buff, size_t from, size_t len);
+static size_t avx2_digits(const char *buff, size_t from, size_t len);
+#endif
+static const LexerScanner *select_scanner();
+
+static void report(const char *fmt, va_list args);
 static void error(Lexer *lexer, const char *fmt, ...);
+static int init_error(const char *fmt, ...);
 static int is_at_end(const Lexer *lexer);
 static char previous(const Lexer *lexer);
 static char advance(Lexer *lexer);
@@ -29,51 +86,72 @@ static const char *code_slice(
 	size_t end,
 	size_t *out_len
 );
-static char *clone_range_code_slice(
-	const Lexer *lexer,
-	size_t start,
-	size_t end,
-	size_t *out_len
-);
-static char *clone_current_lexeme(const Lexer *lexer, size_t *out_len);
-static void add_token_raw_l(
-    Lexer *lexer,
-    size_t lexeme_len,
-    const char *lexeme,
-    size_t literal_size,
-    TokenType type,
-    const void *literal
-);
-static void add_token_raw_h(
-	Lexer *lexer,
-	size_t literal_size,
-	TokenType type,
-	const void *literal
-);
+static void add_token_raw(Lexer *lexer, TokenType type, int64_t literal);
 static void add_token(Lexer *lexer, TokenType type);
-static inline TokenType *get_keyword_type(
-	const Lexer *lexer,
-	size_t keyword_size,
-	const char *keyword
-);
 
-int64_t decimal_str_to_i64(size_t str_len, const char *str){
-    int64_t value = 0;
+// Literals are 64 bit patterns: anything from INT64_MIN to UINT64_MAX,
+// in decimal or in hexadecimal with a '0x' prefix. Returns 1 when the
+// literal does not fit in 64 bits or has a non hexadecimal digit
+int str_to_literal(size_t str_len, const char *str, int64_t *out_literal){
     int is_negative = str[0] == '-';
+    size_t i = is_negative ? 1 : 0;
+    uint64_t value = 0;
+
+    if(str_len - i >= 2 && str[i] == '0' && str[i + 1] == 'x'){
+        i += 2;
 
-    for(size_t i = is_negative ? 1 : 0; i < str_len; i++){
-        char c = str[i];
-        int64_t digit = ((int64_t)c) - 48;
+        if(i == str_len || str_len - i > 16){
+            return 1;
+        }
+
+        for(; i < str_len; i++){
+            int digit = hex_digit_value(str[i]);
+
+            if(digit == -1){
+                return 1;
+            }
+
+            value = (value << 4) | (uint64_t)digit;
+        }
+    }else{
+        for(; i < str_len; i++){
+            uint64_t digit = (uint64_t)(str[i] - '0');
+
+            if(value > (UINT64_MAX - digit) / 10){
+                return 1;
+            }
 
-        value *= 10;
-        value += digit;
+            value = (value * 10) + digit;
+        }
     }
 
-    if(is_negative == 1){
-        value *= -1;
+    if(is_negative){
+        if(value > ((uint64_t)INT64_MAX) + 1){
+            return 1;
+        }
+
+        value = ~value + 1;
     }
 
-    return value;
+    *out_literal = (int64_t)value;
+
+    return 0;
+}
+
+int hex_digit_value(char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    }
+
+    if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+
+    if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+
+    return -1;
 }
 
 inline int is_digit(char c){
@@ -88,19 +166,293 @@ inline int is_alpha_numeric(char c){
     return is_alpha(c) || is_digit(c) || c == '_';
 }
 
-void error(Lexer *lexer, const char *fmt, ...){
-    va_list args;
-    va_start(args, fmt);
+size_t scalar_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+){
+    for (; from < len; from++){
+        char c = buff[from];
+
+        if(c == '\n'){
+            uint32_t line_offset = (uint32_t)(from + 1);
+            dynarr_insert(&line_offset, lines);
+        }else if(c != ' ' && c != '\t'){
+            break;
+        }
+    }
+
+    return from;
+}
+
+size_t scalar_identifier(const char *buff, size_t from, size_t len){
+    while(from < len && is_alpha_numeric(buff[from])){
+        from++;
+    }
+
+    return from;
+}
+
+size_t scalar_digits(const char *buff, size_t from, size_t len){
+    while(from < len && is_digit(buff[from])){
+        from++;
+    }
+
+    return from;
+}
+
+#if LEXER_SIMD
+// Masks produced by 'movemask' have one bit per byte. A run ends at the
+// first clear bit, and newlines inside the run are walked bit by bit
+// so the line bookkeeping never falls back to a per byte loop.
+static inline void record_blank_lines(size_t from, uint32_t nl_mask, DynArr *lines){
+    while(nl_mask){
+        uint32_t line_offset = (uint32_t)(from + __builtin_ctz(nl_mask) + 1);
+
+        dynarr_insert(&line_offset, lines);
+        nl_mask &= nl_mask - 1;
+    }
+}
+
+static inline __m128i sse2_digit_mask(__m128i chunk){
+    __m128i above = _mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1));
+    __m128i below = _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1));
+
+    return _mm_and_si128(above, below);
+}
+
+static inline __m128i sse2_alpha_numeric_mask(__m128i chunk){
+    // Setting bit 5 folds upper case letters into lower case ones. Bytes
+    // above 0x7f are negative for the signed compares, so they never match
+    __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    __m128i above = _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1));
+    __m128i below = _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1));
+    __m128i alpha = _mm_and_si128(above, below);
+    __m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+
+    return _mm_or_si128(_mm_or_si128(alpha, underscore), sse2_digit_mask(chunk));
+}
+
+size_t sse2_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+){
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    while(from + 16 <= len){
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buff + from));
+        __m128i nl = _mm_cmpeq_epi8(chunk, newline);
+        __m128i blank = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+            nl
+        );
+        uint32_t nl_mask = (uint32_t)_mm_movemask_epi8(nl);
+        uint32_t stop_mask = ~((uint32_t)_mm_movemask_epi8(blank)) & 0xffff;
+
+        if(stop_mask){
+            uint32_t run_len = (uint32_t)__builtin_ctz(stop_mask);
+
+            record_blank_lines(from, nl_mask & ((1u << run_len) - 1), lines);
+
+            return from + run_len;
+        }
+
+        record_blank_lines(from, nl_mask, lines);
+        from += 16;
+    }
+
+    return scalar_blanks(buff, from, len, lines);
+}
+
+size_t sse2_identifier(const char *buff, size_t from, size_t len){
+    while(from + 16 <= len){
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buff + from));
+        uint32_t stop_mask = ~((uint32_t)_mm_movemask_epi8(sse2_alpha_numeric_mask(chunk))) & 0xffff;
+
+        if(stop_mask){
+            return from + __builtin_ctz(stop_mask);
+        }
+
+        from += 16;
+    }
+
+    return scalar_identifier(buff, from, len);
+}
+
+size_t sse2_digits(const char *buff, size_t from, size_t len){
+    while(from + 16 <= len){
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buff + from));
+        uint32_t stop_mask = ~((uint32_t)_mm_movemask_epi8(sse2_digit_mask(chunk))) & 0xffff;
+
+        if(stop_mask){
+            return from + __builtin_ctz(stop_mask);
+        }
+
+        from += 16;
+    }
+
+    return scalar_digits(buff, from, len);
+}
+#endif
+
+#if LEXER_SIMD >= 2
+__attribute__((target("avx2")))
+static inline __m256i avx2_digit_mask(__m256i chunk){
+    __m256i above = _mm256_cmpgt_epi8(chunk, _mm256_set1_epi8('0' - 1));
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chunk);
+
+    return _mm256_and_si256(above, below);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_alpha_numeric_mask(__m256i chunk){
+    __m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    __m256i above = _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1));
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower);
+    __m256i alpha = _mm256_and_si256(above, below);
+    __m256i underscore = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_'));
+
+    return _mm256_or_si256(_mm256_or_si256(alpha, underscore), avx2_digit_mask(chunk));
+}
+
+__attribute__((target("avx2")))
+size_t avx2_blanks(
+	const char *buff,
+	size_t from,
+	size_t len,
+	DynArr *lines
+){
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    while(from + 32 <= len){
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buff + from));
+        __m256i nl = _mm256_cmpeq_epi8(chunk, newline);
+        __m256i blank = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+            nl
+        );
+        uint32_t nl_mask = (uint32_t)_mm256_movemask_epi8(nl);
+        uint32_t stop_mask = ~((uint32_t)_mm256_movemask_epi8(blank));
+
+        if(stop_mask){
+            uint32_t run_len = (uint32_t)__builtin_ctz(stop_mask);
+            uint32_t run_mask = run_len == 0 ? 0 : (0xffffffffu >> (32 - run_len));
+
+            record_blank_lines(from, nl_mask & run_mask, lines);
+
+            return from + run_len;
+        }
+
+        record_blank_lines(from, nl_mask, lines);
+        from += 32;
+    }
+
+    return sse2_blanks(buff, from, len, lines);
+}
+
+__attribute__((target("avx2")))
+size_t avx2_identifier(const char *buff, size_t from, size_t len){
+    while(from + 32 <= len){
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buff + from));
+        uint32_t stop_mask = ~((uint32_t)_mm256_movemask_epi8(avx2_alpha_numeric_mask(chunk)));
+
+        if(stop_mask){
+            return from + __builtin_ctz(stop_mask);
+        }
+
+        from += 32;
+    }
+
+    return sse2_identifier(buff, from, len);
+}
+
+__attribute__((target("avx2")))
+size_t avx2_digits(const char *buff, size_t from, size_t len){
+    while(from + 32 <= len){
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buff + from));
+        uint32_t stop_mask = ~((uint32_t)_mm256_movemask_epi8(avx2_digit_mask(chunk)));
+
+        if(stop_mask){
+            return from + __builtin_ctz(stop_mask);
+        }
+
+        from += 32;
+    }
+
+    return sse2_digits(buff, from, len);
+}
+
+static const LexerScanner avx2_scanner = {
+    .blanks = avx2_blanks,
+    .identifier = avx2_identifier,
+    .digits = avx2_digits
+};
+#endif
+
+#if LEXER_SIMD
+static const LexerScanner sse2_scanner = {
+    .blanks = sse2_blanks,
+    .identifier = sse2_identifier,
+    .digits = sse2_digits
+};
+#else
+static const LexerScanner scalar_scanner = {
+    .blanks = scalar_blanks,
+    .identifier = scalar_identifier,
+    .digits = scalar_digits
+};
+#endif
+
+const LexerScanner *select_scanner(){
+#if LEXER_SIMD >= 2
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")){
+        return &avx2_scanner;
+    }
+#endif
+#if LEXER_SIMD
+    return &sse2_scanner;
+#else
+    return &scalar_scanner;
+#endif
+}
 
+void report(const char *fmt, va_list args){
     fprintf(stderr, "LEXER ERROR\n\t");
     vfprintf(stderr, fmt, args);
     fprintf(stderr, "\n");
+}
+
+void error(Lexer *lexer, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+
+    report(fmt, args);
 
     va_end(args);
 
     longjmp(lexer->err_buf, 1);
 }
 
+int init_error(const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+
+    report(fmt, args);
+
+    va_end(args);
+
+    return 1;
+}
+
 inline int is_at_end(const Lexer *lexer){
     return ((size_t)lexer->current) >= lexer->code->len;
 }
@@ -146,141 +498,152 @@ const char *code_slice(const Lexer *lexer, size_t start, size_t end, size_t *out
     return &(lexer->code->buff[start]);
 }
 
-char *clone_range_code_slice(const Lexer *lexer, size_t start, size_t end, size_t *out_len){
-    assert(end > start && "'start' must be less than 'end'");
+void add_token_raw(Lexer *lexer, TokenType type, int64_t literal){
+    size_t len = lexer->current - lexer->start;
 
-    size_t len = end - start;
-    char *cloned_code_slice = MEMORY_ALLOC(char, len + 1, ALLOCATOR);
-
-    memcpy(cloned_code_slice, lexer->code->buff + start, len);
-    cloned_code_slice[len] = 0;
-
-    if(out_len){
-        *out_len = len;
+    if(len > LEXER_MAX_LEXEME_LEN){
+        error(lexer, "Token too long, at most %d characters are allowed", LEXER_MAX_LEXEME_LEN);
     }
 
-    return cloned_code_slice;
+    *lexer->token = (Token){
+        .offset = (uint32_t)lexer->start,
+        .len = (uint16_t)len,
+        .type = (uint16_t)type,
+        .literal = literal
+    };
+    lexer->token = NULL;
 }
 
-inline char *clone_current_lexeme(const Lexer *lexer, size_t *out_len){
-    return clone_range_code_slice(lexer, lexer->start, lexer->current, out_len);
+inline void add_token(Lexer *lexer, TokenType type){
+    add_token_raw(lexer, type, 0);
 }
 
-static void add_token_raw_l(
-    Lexer *lexer,
-    size_t lexeme_len,
-    const char *lexeme,
-    size_t literal_size,
-    TokenType type,
-    const void *literal
-){
-    char *cloned_lexeme = MEMORY_ALLOC(char, lexeme_len + 1, ALLOCATOR);
-
-    memcpy(cloned_lexeme, lexeme, lexeme_len);
-    cloned_lexeme[lexeme_len] = 0;
-
-    Token *token = MEMORY_NEW(
-        ALLOCATOR,
-        Token,
-        lexer->start_line,
-        lexer->end_line,
-        lexer->start - lexer->start_line_offset + 1,
-        lexer->current - lexer->end_line_offset,
+static void blanks(Lexer *lexer){
+    lexer->current = lexer->scanner->blanks(
+        lexer->code->buff,
         lexer->start,
-        lexer->current - 1,
-        lexeme_len,
-        literal_size,
-        type,
-        cloned_lexeme,
-        literal
+        lexer->code->len,
+        lexer->lines
     );
-
-    dynarr_insert_ptr(token, lexer->tokens);
 }
 
-inline void add_token_raw_h(
-	Lexer *lexer,
-	size_t literal_size,
-	TokenType type,
-	const void *literal
-){
-    size_t lexeme_len;
-    const char *lexeme = code_slice(lexer, lexer->start, lexer->current, &lexeme_len);
+static void number(Lexer *lexer){
+    lexer->current = lexer->scanner->digits(
+        lexer->code->buff,
+        lexer->current,
+        lexer->code->len
+    );
 
-    add_token_raw_l(lexer, lexeme_len, lexeme, literal_size, type, literal);
-}
+    // A lone '0' followed by 'x' starts a hexadecimal literal, whose
+    // digits are taken like an identifier and validated when converted
+    if(peek(lexer) == 'x' && previous(lexer) == '0' &&
+       lexer->current - lexer->start == (lexer->code->buff[lexer->start] == '-' ? 2 : 1)){
+        advance(lexer);
 
-inline void add_token(Lexer *lexer, TokenType type){
-    add_token_raw_h(lexer, 0, type, NULL);
-}
+        lexer->current = lexer->scanner->identifier(
+            lexer->code->buff,
+            lexer->current,
+            lexer->code->len
+        );
+    }
 
-TokenType *get_keyword_type(
-	const Lexer *lexer,
-	size_t keyword_size,
-	const char *keyword
-){
-    void *value = NULL;
+    size_t slice_len;
+    const char *slice = code_slice(lexer, lexer->start, lexer->current, &slice_len);
+    int64_t literal = 0;
+
+    if(str_to_literal(slice_len, slice, &literal)){
+        error(
+            lexer,
+            "Invalid literal, expect a decimal or '0x' hexadecimal value that fits in 64 bits, but got: '%.*s'",
+            (int)slice_len,
+            slice
+        );
 
-    if(lzohtable_lookup(keyword_size, keyword, lexer->registers_keywords, &value)){
-        return value;
+        return;
     }
 
-    if(lzohtable_lookup(keyword_size, keyword, lexer->instructions_keywords, &value)){
-        return value;
+    if(literal < INT32_MIN || literal > INT32_MAX){
+        add_token_raw(lexer, QWORD_TYPE_TOKEN_TYPE, literal);
+        return;
     }
 
-    return NULL;
+    add_token_raw(lexer, DWORD_TYPE_TOKEN_TYPE, literal);
 }
 
-static void number(Lexer *lexer){
-    while (is_digit(peek(lexer))){
-        advance(lexer);
-    }
+// '$' followed by the kind of the hole and its index: '$r0' for a
+// register, '$i0' for an immediate and '$t0' for a call or jump target
+static void hole(Lexer *lexer){
+    lexer->current = lexer->scanner->identifier(
+        lexer->code->buff,
+        lexer->current,
+        lexer->code->len
+    );
 
     size_t slice_len;
     const char *slice = code_slice(lexer, lexer->start, lexer->current, &slice_len);
-    int64_t literal = decimal_str_to_i64(slice_len, slice);
+    TokenType type = EOF_TOKEN_TYPE;
+    int64_t index = 0;
 
-    if(literal < INT32_MIN){
-        error(
-            lexer,
-            "Literal value out of range, must be bigger or equals to %"PRIu32", but got: %" PRIu64,
-            INT32_MIN,
-            literal
-        );
+    switch (slice_len > 1 ? slice[1] : '\0'){
+        case 'r':{
+            type = REGISTER_HOLE_TOKEN_TYPE;
+            break;
+        }case 'i':{
+            type = IMMEDIATE_HOLE_TOKEN_TYPE;
+            break;
+        }case 't':{
+            type = TARGET_HOLE_TOKEN_TYPE;
+            break;
+        }
+    }
 
-        return;
+    for(size_t i = 2; i < slice_len && index <= LEXER_MAX_HOLE; i++){
+        if(!is_digit(slice[i])){
+            type = EOF_TOKEN_TYPE;
+            break;
+        }
+
+        index = index * 10 + (slice[i] - '0');
     }
 
-    if(literal > INT32_MAX){
+    if(type == EOF_TOKEN_TYPE || slice_len < 3 || index > LEXER_MAX_HOLE){
         error(
             lexer,
-            "Literal value out of range, must be less or equals to %"PRIu32", but got: %" PRIu64,
-            INT32_MAX,
-            literal
+            "Invalid hole, expect '$r', '$i' or '$t' followed by an index up to %d, but got: '%.*s'",
+            LEXER_MAX_HOLE,
+            (int)slice_len,
+            slice
         );
 
         return;
     }
 
-    add_token_raw_h(
-    	lexer,
-        sizeof(int32_t),
-        DWORD_TYPE_TOKEN_TYPE,
-        MEMORY_NEW(ALLOCATOR, int32_t, (int32_t)literal)
-    );
+    add_token_raw(lexer, type, index);
 }
 
 static void identifier(Lexer *lexer){
-    while(is_alpha_numeric(peek(lexer))){
-        advance(lexer);
-    }
+    lexer->current = lexer->scanner->identifier(
+        lexer->code->buff,
+        lexer->current,
+        lexer->code->len
+    );
 
     size_t slice_len;
     const char *slice = code_slice(lexer, lexer->start, lexer->current, &slice_len);
-    TokenType *type = get_keyword_type(lexer, slice_len, slice);
+    void *value = NULL;
+
+    if(lzohtable_lookup(slice_len, slice, lexer->registers_keywords, &value)){
+        RegisterKeyword *keyword = value;
+        add_token_raw(lexer, keyword->type, keyword->reg);
+        return;
+    }
+
+    if(lzohtable_lookup(slice_len, slice, lexer->instructions_keywords, &value)){
+        add_token(lexer, *(TokenType *)value);
+        return;
+    }
 
-    add_token(lexer, type ? *type : IDENTIFIER_TOKEN_TYPE);
+    add_token(lexer, IDENTIFIER_TOKEN_TYPE);
 }
 
 static void lex(Lexer *lexer){
@@ -289,19 +652,43 @@ static void lex(Lexer *lexer){
     switch (c){
         case ' ':
         case '\t':
-            break;
         case '\n':{
-            lexer->end_line_offset = lexer->current;
-            lexer->end_line++;
+            blanks(lexer);
             break;
         }case ',':{
             add_token(lexer, COMMA_TOKEN_TYPE);
             break;
         }case '-':{
-            number(lexer);
+            // Attached to a literal it is its sign, as in '-8'. Otherwise it
+            // is the operator of a memory operand, as in '[rbp - 8]'
+            if(is_digit(peek(lexer))){
+                number(lexer);
+                break;
+            }
+
+            add_token(lexer, MINUS_TOKEN_TYPE);
+
+            break;
+        }case '+':{
+            add_token(lexer, PLUS_TOKEN_TYPE);
+            break;
+        }case '[':{
+            add_token(lexer, LEFT_BRACKET_TOKEN_TYPE);
+            break;
+        }case ']':{
+            add_token(lexer, RIGHT_BRACKET_TOKEN_TYPE);
             break;
         }case ':':{
             add_token(lexer, COLON_TOKEN_TYPE);
+            break;
+        }case '$':{
+            if(lexer->holes){
+                hole(lexer);
+                break;
+            }
+
+            error(lexer, "Holes are only allowed in stencils");
+
             break;
         }default:{
             if(is_digit(c)){
@@ -326,6 +713,7 @@ Lexer *lexer_create(Allocator *allocator){
         return NULL;
     }
 
+    lexer->scanner = select_scanner();
     lexer->allocator = allocator;
 
     return lexer;
@@ -339,6 +727,43 @@ void lexer_destroy(Lexer *lexer){
     MEMORY_DEALLOC(lexer, Lexer, 1, lexer->allocator);
 }
 
+int lexer_init(
+    Lexer *lexer,
+    LZOHTable *registers_keywords,
+    LZOHTable *instructions_keywords,
+    BStr *code
+){
+    if(code->len > LEXER_MAX_INPUT_LEN){
+        return init_error("Input too large, at most %"PRIu32" bytes are allowed", LEXER_MAX_INPUT_LEN);
+    }
+
+    lexer->start = 0;
+    lexer->current = 0;
+    lexer->code = code;
+    lexer->registers_keywords = registers_keywords;
+    lexer->instructions_keywords = instructions_keywords;
+    lexer->token = NULL;
+    lexer->holes = 0;
+    lexer->lines = MEMORY_DYNARR_TYPE(ALLOCATOR, uint32_t);
+    lexer->generated = MEMORY_LZBSTR(ALLOCATOR);
+
+    return 0;
+}
+
+void lexer_next(Lexer *lexer, Token *token){
+    lexer->token = token;
+
+    // Blanks do not produce tokens
+    while(lexer->token && !is_at_end(lexer)){
+        lex(lexer);
+        lexer->start = lexer->current;
+    }
+
+    if(lexer->token){
+        add_token(lexer, EOF_TOKEN_TYPE);
+    }
+}
+
 int lexer_lex(
     Lexer *lexer,
     LZOHTable *registers_keywords,
@@ -346,29 +771,74 @@ int lexer_lex(
     BStr *code,
     DynArr *tokens
 ){
+    if(lexer_init(lexer, registers_keywords, instructions_keywords, code)){
+        return 1;
+    }
+
     if(setjmp(lexer->err_buf) == 0){
-        lexer->start_line_offset = 0;
-        lexer->end_line_offset = 0;
-        lexer->start_line = 1;
-        lexer->end_line = 1;
-        lexer->start = 0;
-        lexer->current = 0;
-        lexer->code = code;
-        lexer->registers_keywords = registers_keywords;
-        lexer->instructions_keywords = instructions_keywords;
-        lexer->tokens = tokens;
-
-        while(!is_at_end(lexer)){
-            lex(lexer);
-            lexer->start_line_offset = lexer->end_line_offset;
-            lexer->start_line = lexer->end_line;
-            lexer->start = lexer->current;
-        }
+        Token token;
 
-        add_token_raw_l(lexer, 3, "EOF", 0, EOF_TOKEN_TYPE, NULL);
+        do{
+            lexer_next(lexer, &token);
+            dynarr_insert(&token, tokens);
+        }while(token.type != EOF_TOKEN_TYPE);
 
         return 0;
     }else{
         return 1;
     }
 }
+
+TokenLocation lexer_token_location(const Lexer *lexer, const Token *token){
+    DynArr *lines = lexer->lines;
+    size_t left = 0;
+    size_t right = DYNARR_LEN(lines);
+
+    // Count the lines that start at or before the token
+    while(left < right){
+        size_t middle = left + (right - left) / 2;
+
+        if(DYNARR_GET_AS(uint32_t, middle, lines) <= token->offset){
+            left = middle + 1;
+        }else{
+            right = middle;
+        }
+    }
+
+    size_t line_offset = left == 0 ? 0 : DYNARR_GET_AS(uint32_t, left - 1, lines);
+    int32_t line = (int32_t)left + 1;
+
+    // Tokens never span lines
+    return (TokenLocation){
+        .start_line = line,
+        .end_line = line,
+        .start_col = (int32_t)(token->offset - line_offset + 1),
+        .end_col = (int32_t)(token->offset + token->len - line_offset)
+    };
+}
+
+Token lexer_generate_label(Lexer *lexer){
+    LZBStr *generated = lexer->generated;
+    size_t offset = generated->offset;
+    Token token = {0};
+
+    lzbstr_append_args(generated, ".@%zu", offset);
+
+    token.offset = (uint32_t)offset;
+    token.len = (uint16_t)(generated->offset - offset);
+    token.type = GENERATED_LABEL_TOKEN_TYPE;
+
+    return token;
+}
+
+const char *lexer_lexeme(const Lexer *lexer, const Token *token){
+    if(token->type == EOF_TOKEN_TYPE){
+        return "EOF";
+    }
+
+    if(token->type == GENERATED_LABEL_TOKEN_TYPE){
+        return lexer->generated->buff + token->offset;
+    }
+
+    return lexer->code->buff + token->offset;
+}
@@ -0,0 +1,279 @@
+#include "linetable.h"
+
+#include <assert.h>
+
+// A row takes at most 5 + 5 + 5 bytes
+#define MAX_ROW_LEN 15
+
+//------------------------------------------------------------
+//                      PRIVATE INTERFACE                   //
+//------------------------------------------------------------
+static size_t write_uleb(uint32_t value, byte *buff);
+static size_t write_sleb(int32_t value, byte *buff);
+static uint32_t read_uleb(const byte *buff, size_t *offset);
+static int32_t read_sleb(const byte *buff, size_t *offset);
+
+//------------------------------------------------------------
+//                    PRIVATE IMPLEMENTATION                //
+//------------------------------------------------------------
+size_t write_uleb(uint32_t value, byte *buff){
+    size_t len = 0;
+
+    do{
+        byte b = value & 0x7f;
+
+        value >>= 7;
+
+        if(value != 0){
+            b |= 0x80;
+        }
+
+        buff[len++] = b;
+    }while(value != 0);
+
+    return len;
+}
+
+size_t write_sleb(int32_t value, byte *buff){
+    size_t len = 0;
+
+    while(1){
+        byte b = value & 0x7f;
+
+        value >>= 7;
+
+        if((value == 0 && !(b & 0x40)) || (value == -1 && (b & 0x40))){
+            buff[len++] = b;
+            return len;
+        }
+
+        buff[len++] = b | 0x80;
+    }
+}
+
+uint32_t read_uleb(const byte *buff, size_t *offset){
+    uint32_t value = 0;
+    unsigned int shift = 0;
+    byte b;
+
+    do{
+        b = buff[(*offset)++];
+        value |= ((uint32_t)(b & 0x7f)) << shift;
+        shift += 7;
+    }while(b & 0x80);
+
+    return value;
+}
+
+int32_t read_sleb(const byte *buff, size_t *offset){
+    uint32_t value = 0;
+    unsigned int shift = 0;
+    byte b;
+
+    do{
+        b = buff[(*offset)++];
+        value |= ((uint32_t)(b & 0x7f)) << shift;
+        shift += 7;
+    }while(b & 0x80);
+
+    if(shift < 32 && (b & 0x40)){
+        value |= ~((uint32_t)0) << shift;
+    }
+
+    return (int32_t)value;
+}
+
+//------------------------------------------------------------
+//                    PUBLIC IMPLEMENTATION                 //
+//------------------------------------------------------------
+LineTable *line_table_create(const Allocator *allocator){
+    LineTable *table = MEMORY_ALLOC(LineTable, 1, allocator);
+
+    if(!table){
+        return NULL;
+    }
+
+    table->program = NULL;
+    table->program_len = 0;
+    table->program_capacity = 0;
+    table->checkpoints = NULL;
+    table->checkpoints_len = 0;
+    table->checkpoints_capacity = 0;
+    table->rows_len = 0;
+    table->code_end = 0;
+    table->last_code_offset = 0;
+    table->last_line = 0;
+    table->last_column = 0;
+    table->allocator = allocator;
+
+    return table;
+}
+
+void line_table_destroy(LineTable *table){
+    if(!table){
+        return;
+    }
+
+    const Allocator *allocator = table->allocator;
+
+    MEMORY_DEALLOC(table->program, byte, table->program_capacity, allocator);
+    MEMORY_DEALLOC(table->checkpoints, LineTableCheckpoint, table->checkpoints_capacity, allocator);
+    MEMORY_DEALLOC(table, LineTable, 1, allocator);
+}
+
+void line_table_reset(LineTable *table){
+    table->program_len = 0;
+    table->checkpoints_len = 0;
+    table->rows_len = 0;
+    table->code_end = 0;
+    table->last_code_offset = 0;
+    table->last_line = 0;
+    table->last_column = 0;
+}
+
+int line_table_append(LineTable *table, uint32_t code_offset, uint32_t line, uint32_t column){
+    const Allocator *allocator = table->allocator;
+    size_t rows_len = table->rows_len;
+
+    if(rows_len > 0){
+        assert(code_offset >= table->last_code_offset && "rows out of order");
+
+        if(line == table->last_line && column == table->last_column){
+            return 0;
+        }
+    }
+
+    // Both grow before the row is written, so a failure leaves the table as it was
+    if(table->program_len + MAX_ROW_LEN > table->program_capacity){
+        size_t new_capacity = table->program_capacity == 0 ? 256 : table->program_capacity * 2;
+        byte *program = MEMORY_REALLOC(
+            byte,
+            table->program_capacity,
+            new_capacity,
+            table->program,
+            allocator
+        );
+
+        if(!program){
+            return 1;
+        }
+
+        table->program = program;
+        table->program_capacity = new_capacity;
+    }
+
+    if(rows_len % LINE_TABLE_CHECKPOINT_INTERVAL == 0 && table->checkpoints_len == table->checkpoints_capacity){
+        size_t new_capacity = table->checkpoints_capacity == 0 ? 16 : table->checkpoints_capacity * 2;
+        LineTableCheckpoint *checkpoints = MEMORY_REALLOC(
+            LineTableCheckpoint,
+            table->checkpoints_capacity,
+            new_capacity,
+            table->checkpoints,
+            allocator
+        );
+
+        if(!checkpoints){
+            return 1;
+        }
+
+        table->checkpoints = checkpoints;
+        table->checkpoints_capacity = new_capacity;
+    }
+
+    byte *row = table->program + table->program_len;
+    size_t row_len = 0;
+
+    row_len += write_uleb(code_offset - table->last_code_offset, row + row_len);
+    row_len += write_sleb((int32_t)(line - table->last_line), row + row_len);
+    row_len += write_uleb(column, row + row_len);
+
+    table->program_len += row_len;
+
+    if(rows_len % LINE_TABLE_CHECKPOINT_INTERVAL == 0){
+        table->checkpoints[table->checkpoints_len++] = (LineTableCheckpoint){
+            .code_offset = code_offset,
+            .line = line,
+            .column = column,
+            .program_offset = (uint32_t)table->program_len
+        };
+    }
+
+    table->rows_len++;
+    table->last_code_offset = code_offset;
+    table->last_line = line;
+    table->last_column = column;
+
+    return 0;
+}
+
+inline void line_table_end(LineTable *table, uint32_t code_end){
+    table->code_end = code_end;
+}
+
+int line_table_next(const LineTable *table, LineTableRow *row){
+    if(row->index == table->rows_len){
+        return 1;
+    }
+
+    row->code_offset += read_uleb(table->program, &row->program_offset);
+    row->line += (uint32_t)read_sleb(table->program, &row->program_offset);
+    row->column = read_uleb(table->program, &row->program_offset);
+    row->index++;
+
+    return 0;
+}
+
+int line_table_lookup(const LineTable *table, uint32_t code_offset, uint32_t *out_line, uint32_t *out_column){
+    const LineTableCheckpoint *checkpoints = table->checkpoints;
+    size_t left = 0;
+    size_t right = table->checkpoints_len;
+
+    if(code_offset >= table->code_end){
+        return 1;
+    }
+
+    // Count the checkpoints at or before 'code_offset'
+    while(left < right){
+        size_t middle = left + (right - left) / 2;
+
+        if(checkpoints[middle].code_offset <= code_offset){
+            left = middle + 1;
+        }else{
+            right = middle;
+        }
+    }
+
+    if(left == 0){
+        return 1;
+    }
+
+    size_t checkpoint_index = left - 1;
+    const LineTableCheckpoint *checkpoint = &checkpoints[checkpoint_index];
+    size_t first_row = checkpoint_index * LINE_TABLE_CHECKPOINT_INTERVAL;
+    size_t rows_left = table->rows_len - first_row - 1;
+    size_t program_offset = checkpoint->program_offset;
+    uint32_t row_code_offset = checkpoint->code_offset;
+    uint32_t line = checkpoint->line;
+    uint32_t column = checkpoint->column;
+
+    if(rows_left > LINE_TABLE_CHECKPOINT_INTERVAL - 1){
+        rows_left = LINE_TABLE_CHECKPOINT_INTERVAL - 1;
+    }
+
+    for (size_t i = 0; i < rows_left; i++){
+        uint32_t next_code_offset = row_code_offset + read_uleb(table->program, &program_offset);
+
+        if(next_code_offset > code_offset){
+            break;
+        }
+
+        row_code_offset = next_code_offset;
+        line += (uint32_t)read_sleb(table->program, &program_offset);
+        column = read_uleb(table->program, &program_offset);
+    }
+
+    *out_line = line;
+    *out_column = column;
+
+    return 0;
+}
@@ -1,82 +1,443 @@
+#ifdef __linux__
+    // sched_setaffinity
+    #define _GNU_SOURCE
+#endif
+
 #include "essentials/lzarena.h"
 #include "myass.h"
 #include "types.h"
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sched.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/wait.h>
+#endif
+
 #define ARG_FORMATTED_PRINT 0b00000001
+#define ARG_ALIGN_LOOPS     0b00000010
+#define ARG_HUGE_PAGES      0b00000100
+#define ARG_SIMPLIFY_CFG    0b00001000
+#define ARG_PROFILE_LAYOUT  0b00010000
+#define ARG_BENCH           0b00100000
+
+#define LOOP_ALIGNMENT      16
+#define LOOP_MAX_PADDING    10
+
+#define READ_CHUNK_SIZE     65536
+
+#define BENCH_CALLS         10000
+#define BENCH_WARM_UP       1000
+
+// '-bench' calls 'label' as 'uint64_t label(uint64_t rdi, uint64_t rsi)'
+typedef struct bench{
+	const char *label;
+	size_t calls;
+	size_t warm_up;
+	int cpu; // -1 leaves the choice to the scheduler
+	uint64_t rdi;
+	uint64_t rsi;
+}Bench;
 
 typedef struct args{
 	byte flags;
 	const char *input;
+	const char *profile;
+	Bench bench;
 }Args;
 
+// 'mapping' is set when the code is a read-only mapping of the input file,
+// otherwise the code was read in chunks into the arena
+typedef struct source{
+	BStr code;
+	void *mapping;
+	size_t mapping_len;
+}Source;
+
+// Decimal or 0x prefixed hexadecimal. Negative values wrap around
+uint64_t parse_number(const char *option, const char *value){
+	char *end = NULL;
+	uint64_t number = (uint64_t)strtoull(value, &end, 0);
+
+	if(end == value || *end != '\0'){
+		fprintf(stderr, "'%s' expects a number, not '%s'\n", option, value);
+		exit(EXIT_FAILURE);
+	}
+
+	return number;
+}
+
 Args parse_args(int argc, char const *argv[]){
 	byte flags = 0;
 	const char *input = NULL;
+	const char *profile = NULL;
+	Bench bench = {
+		.label = NULL,
+		.calls = BENCH_CALLS,
+		.warm_up = BENCH_WARM_UP,
+		.cpu = -1,
+		.rdi = 0,
+		.rsi = 0
+	};
 
-	for (int i = 0; i < argc; i++) {
+	for (int i = 1; i < argc; i++) {
 		const char *arg = argv[i];
 		size_t arg_len = strlen(arg);
 
 		if(arg_len == 2 && (strncmp(arg, "-f", 2) == 0)){
 			flags |= ARG_FORMATTED_PRINT;
+		}else if(arg_len == 2 && (strncmp(arg, "-a", 2) == 0)){
+			flags |= ARG_ALIGN_LOOPS;
+		}else if(arg_len == 2 && (strncmp(arg, "-H", 2) == 0)){
+			flags |= ARG_HUGE_PAGES;
+		}else if(arg_len == 2 && (strncmp(arg, "-s", 2) == 0)){
+			flags |= ARG_SIMPLIFY_CFG;
+		}else if(arg_len == 2 && (strncmp(arg, "-p", 2) == 0) && i + 1 < argc){
+			flags |= ARG_PROFILE_LAYOUT;
+			profile = argv[++i];
+		}else if(strcmp(arg, "-bench") == 0 && i + 1 < argc){
+			flags |= ARG_BENCH;
+			bench.label = argv[++i];
+		}else if(strcmp(arg, "-n") == 0 && i + 1 < argc){
+			bench.calls = (size_t)parse_number(arg, argv[++i]);
+		}else if(strcmp(arg, "-w") == 0 && i + 1 < argc){
+			bench.warm_up = (size_t)parse_number(arg, argv[++i]);
+		}else if(strcmp(arg, "-cpu") == 0 && i + 1 < argc){
+			const char *value = argv[++i];
+			uint64_t cpu = parse_number(arg, value);
+
+#ifdef __linux__
+			// CPU_SET takes indexes below CPU_SETSIZE, anything larger
+			// would also wrap around the cast to int
+			if(cpu >= CPU_SETSIZE){
+				fprintf(stderr, "'%s' expects a number below %d, not '%s'\n", arg, CPU_SETSIZE, value);
+				exit(EXIT_FAILURE);
+			}
+#endif
+
+			bench.cpu = (int)cpu;
+		}else if(strcmp(arg, "-rdi") == 0 && i + 1 < argc){
+			bench.rdi = parse_number(arg, argv[++i]);
+		}else if(strcmp(arg, "-rsi") == 0 && i + 1 < argc){
+			bench.rsi = parse_number(arg, argv[++i]);
 		}else{
 			input = arg;
 		}
 	}
 
-	return (Args){.flags = flags, .input = input};
+	if(bench.calls == 0){
+		fprintf(stderr, "'-n' takes at least 1 call\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return (Args){.flags = flags, .input = input, .profile = profile, .bench = bench};
+}
+
+Source read_stream(const Allocator *allocator, FILE *stream, const char *name){
+	size_t capacity = READ_CHUNK_SIZE;
+	size_t len = 0;
+	char *buff = MEMORY_ALLOC(char, capacity, allocator);
+
+	while(1){
+		if(len == capacity){
+			buff = MEMORY_REALLOC(char, capacity, capacity * 2, buff, allocator);
+			capacity *= 2;
+		}
+
+		size_t read_len = fread(buff + len, 1, capacity - len, stream);
+
+		len += read_len;
+
+		if(read_len == 0){
+			break;
+		}
+	}
+
+	if(ferror(stream)){
+		fprintf(stderr, "Failed to read from '%s'\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	return (Source){.code = {.len = len, .buff = buff}, .mapping = NULL, .mapping_len = 0};
+}
+
+#ifdef __linux__
+int map_source(const char *pathname, Source *source){
+	int fd = open(pathname, O_RDONLY);
+
+	if(fd == -1){
+		return 1;
+	}
+
+	struct stat st;
+
+	if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0){
+		close(fd);
+		return 1;
+	}
+
+	size_t len = (size_t)st.st_size;
+	void *mapping = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if(mapping == MAP_FAILED){
+		return 1;
+	}
+
+	madvise(mapping, len, MADV_SEQUENTIAL);
+
+	source->code.len = len;
+	source->code.buff = mapping;
+	source->mapping = mapping;
+	source->mapping_len = len;
+
+	return 0;
 }
+#endif
+
+Source read_source(const Allocator *allocator, const char *pathname){
+	if(!pathname || strcmp(pathname, "-") == 0){
+		return read_stream(allocator, stdin, "stdin");
+	}
 
-BStr *read_source(const Allocator *allocator, const char *pathname){
+#ifdef __linux__
+	Source source;
+
+	if(map_source(pathname, &source) == 0){
+		return source;
+	}
+#endif
+
+	// Pipes, devices and empty files can not be mapped
 	FILE *source_file = fopen(pathname, "r");
 
     if(!source_file){
         fprintf(
             stderr,
-            "Failed to open pathname: '%s'. Check if exists or read permision",
+            "Failed to open pathname: '%s'. Check if exists or read permision\n",
             pathname
         );
         exit(EXIT_FAILURE);
-
-        return NULL;
     }
 
-	fseek(source_file, 0, SEEK_END);
+	Source stream_source = read_stream(allocator, source_file, pathname);
 
-	size_t source_size = (size_t)ftell(source_file);
-    char *buff = MEMORY_ALLOC(char, source_size + 1, allocator);
-	BStr *rstr = MEMORY_ALLOC(BStr, 1, allocator);
-
-	fseek(source_file, 0, SEEK_SET);
-	fread(buff, 1, source_size, source_file);
 	fclose(source_file);
 
-	buff[source_size] = '\0';
+	return stream_source;
+}
+
+void release_source(Source *source){
+#ifdef __linux__
+	if(source->mapping){
+		munmap(source->mapping, source->mapping_len);
+	}
+#endif
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+typedef uint64_t (*BenchFn)(uint64_t rdi, uint64_t rsi);
+
+// lfence keeps earlier instructions from running past rdtsc, and
+// rdtscp waits for the call to retire before reading the counter
+static inline uint64_t bench_start(void){
+	uint32_t low;
+	uint32_t high;
+
+	__asm__ volatile("lfence\n\trdtsc\n\tlfence" : "=a"(low), "=d"(high) :: "memory");
 
-	rstr->len = source_size;
-	rstr->buff = buff;
+	return ((uint64_t)high << 32) | low;
+}
+
+static inline uint64_t bench_stop(void){
+	uint32_t low;
+	uint32_t high;
+
+	__asm__ volatile("rdtscp\n\tlfence" : "=a"(low), "=d"(high) :: "rcx", "memory");
+
+	return ((uint64_t)high << 32) | low;
+}
+
+int compare_cycles(const void *a, const void *b){
+	uint64_t a_cycles = *(const uint64_t *)a;
+	uint64_t b_cycles = *(const uint64_t *)b;
 
-	return rstr;
+	return (a_cycles > b_cycles) - (a_cycles < b_cycles);
 }
 
+// Sorted cycles of each call into 'samples'. Returns what the last call returned
+uint64_t time_calls(BenchFn fn, const Bench *bench, uint64_t *samples){
+	uint64_t result = 0;
+
+	for (size_t i = 0; i < bench->warm_up; i++){
+		result = fn(bench->rdi, bench->rsi);
+	}
+
+	for (size_t i = 0; i < bench->calls; i++){
+		uint64_t start = bench_start();
+
+		result = fn(bench->rdi, bench->rsi);
+
+		samples[i] = bench_stop() - start;
+	}
+
+	qsort(samples, bench->calls, sizeof(uint64_t), compare_cycles);
+
+	return result;
+}
+
+// Runs in the child. The code gets a 'ret' appended, whose calls measure
+// the timing overhead that is taken off every sample
+int run_bench(MyAss *myass, const Bench *bench, size_t offset){
+	if(bench->cpu >= 0){
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(bench->cpu, &cpus);
+
+		if(sched_setaffinity(0, sizeof(cpus), &cpus) == -1){
+			fprintf(stderr, "Failed to pin to CPU %d\n", bench->cpu);
+			return 1;
+		}
+	}
+
+	size_t code_len;
+
+	myass_code(myass, &code_len);
+
+	byte *mapping = mmap(NULL, code_len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(mapping == MAP_FAILED){
+		fprintf(stderr, "Failed to map the code\n");
+		return 1;
+	}
+
+	myass_link(myass, (uintptr_t)mapping);
+	memcpy(mapping, myass_code(myass, &code_len), code_len);
+	mapping[code_len] = 0xc3;
+
+	uint64_t *samples = malloc(sizeof(uint64_t) * bench->calls);
+
+	if(!samples || mprotect(mapping, code_len + 1, PROT_READ | PROT_EXEC) == -1){
+		fprintf(stderr, "Failed to set up the benchmark\n");
+		return 1;
+	}
+
+	time_calls((BenchFn)(mapping + code_len), bench, samples);
+
+	uint64_t overhead = samples[0];
+	uint64_t result = time_calls((BenchFn)(mapping + offset), bench, samples);
+	uint64_t min = samples[0];
+	uint64_t median = samples[bench->calls / 2];
+
+	printf(
+		"%s: %zu calls after %zu warm-up calls, returned %"PRIu64"\n",
+		bench->label,
+		bench->calls,
+		bench->warm_up,
+		result
+	);
+	printf(
+		"min %"PRIu64" cycles, median %"PRIu64" cycles per call (%"PRIu64" cycles of timing overhead taken off)\n",
+		min > overhead ? min - overhead : 0,
+		median > overhead ? median - overhead : 0,
+		overhead
+	);
+
+	free(samples);
+	munmap(mapping, code_len + 1);
+
+	return 0;
+}
+
+// The code runs in a forked child, so crashing it only fails the benchmark
+int bench(MyAss *myass, const Bench *bench){
+	size_t offset;
+
+	if(myass_symbol_offset(myass, bench->label, &offset)){
+		fprintf(stderr, "No label '%s' to benchmark\n", bench->label);
+		return 1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t pid = fork();
+
+	if(pid == -1){
+		fprintf(stderr, "Failed to fork the benchmark\n");
+		return 1;
+	}
+
+	if(pid == 0){
+		exit(run_bench(myass, bench, offset) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	int status;
+
+	if(waitpid(pid, &status, 0) == -1){
+		fprintf(stderr, "Failed to wait for the benchmark\n");
+		return 1;
+	}
+
+	if(WIFSIGNALED(status)){
+		fprintf(stderr, "Benchmarked code crashed: %s\n", strsignal(WTERMSIG(status)));
+		return 1;
+	}
+
+	return WEXITSTATUS(status) != EXIT_SUCCESS;
+}
+#else
+int bench(MyAss *myass, const Bench *bench){
+	fprintf(stderr, "'-bench' needs Linux on x86-64\n");
+	return 1;
+}
+#endif
+
 int main(int argc, char const *argv[]){
     if(argc < 2){
-        fprintf(stderr, "Usage: myass <source file>\n");
+        fprintf(stderr, "Usage: myass <source file | ->\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Arguments\n");
         fprintf(stderr, "  -f\n");
         fprintf(stderr, "                      Format output\n");
+        fprintf(stderr, "  -a\n");
+        fprintf(stderr, "                      Align loop heads to %d bytes (at most %d bytes of padding)\n", LOOP_ALIGNMENT, LOOP_MAX_PADDING);
+        fprintf(stderr, "  -H\n");
+        fprintf(stderr, "                      Back large arena regions with huge pages when available\n");
+        fprintf(stderr, "  -s\n");
+        fprintf(stderr, "                      Drop dead code and thread jumps, reporting the bytes saved\n");
+        fprintf(stderr, "  -p <profile file>\n");
+        fprintf(stderr, "                      Reorder blocks by the 'label count' lines of the file\n");
+        fprintf(stderr, "  -bench <label>\n");
+        fprintf(stderr, "                      Time calls to the label in a child process, in TSC cycles\n");
+        fprintf(stderr, "  -n <calls>, -w <calls>\n");
+        fprintf(stderr, "                      Timed calls (default %d) and warm-up calls before them (default %d)\n", BENCH_CALLS, BENCH_WARM_UP);
+        fprintf(stderr, "  -rdi <value>, -rsi <value>\n");
+        fprintf(stderr, "                      Arguments of the benchmarked calls (default 0)\n");
+        fprintf(stderr, "  -cpu <index>\n");
+        fprintf(stderr, "                      Pin the benchmark to a CPU\n");
 
         exit(EXIT_FAILURE);
     }
 
     Args args = parse_args(argc, argv);
     LZArena *arena = lzarena_create(NULL);
+
+    if(args.flags & ARG_HUGE_PAGES){
+        lzarena_flags(LZARENA_FLAG_HUGETLB | LZARENA_FLAG_THP, arena);
+    }
+
     AllocatorContext allocator_context = {
         .err_buf = NULL,
         .behind_allocator = arena
@@ -91,10 +452,44 @@ int main(int argc, char const *argv[]){
         &allocator
     );
 
-    BStr *input = read_source(&allocator, args.input);
+    Source source = read_source(&allocator, args.input);
     MyAss *myass = myass_create(&allocator);
 
-    myass_assemble(myass, input->len, input->buff);
+    if(args.flags & ARG_ALIGN_LOOPS){
+        myass_loop_alignment(myass, LOOP_ALIGNMENT, LOOP_MAX_PADDING);
+    }
+
+    int flags = 0;
+
+    if(args.flags & ARG_SIMPLIFY_CFG){
+        flags |= MYASS_FLAG_SIMPLIFY_CFG;
+    }
+
+    if(args.flags & ARG_PROFILE_LAYOUT){
+        if(myass_load_profile(myass, args.profile)){
+            fprintf(stderr, "Failed to load profile: '%s'\n", args.profile);
+            exit(EXIT_FAILURE);
+        }
+
+        flags |= MYASS_FLAG_PROFILE_LAYOUT;
+    }
+
+    myass_flags(myass, flags);
+
+    int failed = myass_assemble(myass, source.code.len, source.code.buff);
+
+    if(args.flags & ARG_SIMPLIFY_CFG){
+        fprintf(stderr, "Simplified: %"PRId64" bytes saved\n", myass_simplified_bytes(myass));
+    }
+
+    if(args.flags & ARG_BENCH){
+        failed = failed || bench(myass, &args.bench);
+
+        release_source(&source);
+        lzarena_destroy(arena);
+
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     if(args.flags & ARG_FORMATTED_PRINT){
    		myass_formatted_print_hex(myass);
@@ -102,6 +497,7 @@ int main(int argc, char const *argv[]){
     	myass_print_as_hex(myass, 0);
     }
 
+    release_source(&source);
     lzarena_destroy(arena);
 
     return 0;
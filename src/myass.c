@@ -9,6 +9,8 @@
 #include "token.h"
 #include "lexer.h"
 #include "parser.h"
+#include "cfg.h"
+#include "linetable.h"
 
 #include "location.h"
 #include "instruction.h"
@@ -17,6 +19,8 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <inttypes.h>
@@ -36,24 +40,203 @@ typedef struct label_symbol{
 
 typedef struct jump{
     size_t offset;
+    InstructionType type;
     Token *label_token;
 }Jmp;
 
+// A 'mov r64, [rip + disp32]' whose displacement ends at 'offset'
+// and must point to the constant pool slot 'slot'
+typedef struct constant_load{
+    size_t offset;
+    size_t slot;
+}ConstantLoad;
+
+// A call target found by the resolver
+typedef struct external_symbol{
+    size_t    stub_offset;
+    uintptr_t address;
+}ExternalSymbol;
+
+// A call to an external symbol whose rel32 ends at 'offset'
+typedef struct external_call{
+    uint32_t  offset;
+    uint32_t  stub_offset;
+    uintptr_t address;
+}ExternalCall;
+
+// A builder API label. 'fixups' heads the chain of the rel32
+// waiting for it to be bound
+typedef struct label{
+    uint32_t offset;
+    uint32_t fixups;
+}Label;
+
+// A rel32 ending at 'offset'. 'next' is the following
+// fixup of the same label
+typedef struct label_fixup{
+    uint32_t offset;
+    uint32_t next;
+}LabelFixup;
+
+// Labels in code order, frozen once assembly is done. Their
+// names live in 'symbol_names'
+typedef struct frozen_symbol{
+    uint32_t offset;
+    uint32_t name_offset;
+    uint32_t name_len;
+}FrozenSymbol;
+
+// Where counter 'index' of a group of labels is incremented, and the
+// first label of the group in 'frozen_symbols', NO_SYMBOL once it was
+// dropped. Counters of dropped blocks have no entry
+typedef struct counter_symbol{
+    uint32_t offset;
+    uint32_t index;
+    uint32_t symbol;
+}CounterSymbol;
+
+// The same labels sorted by name, for 'myass_symbol_offset'
+typedef struct symbol_name{
+    const char *name;
+    uint32_t   name_len;
+    uint32_t   offset;
+}SymbolName;
+
+typedef enum stencil_patch_type{
+    REGISTER_PATCH_TYPE,
+    IMMEDIATE_PATCH_TYPE,
+    TARGET_PATCH_TYPE,
+}StencilPatchType;
+
+// A stencil field filled by 'myass_stencil_instantiate'. A register
+// hole takes one patch per instruction bit that follows one of its
+// bits: 'mask' in the byte at 'offset' is set when register bit 'bit'
+// differs from 'inverted'. Immediate and target holes take one patch
+// for the dword at 'offset', targets being a rel32 that ends after it
+typedef struct stencil_patch{
+    uint32_t offset;
+    byte     type;
+    byte     hole;
+    byte     mask;
+    byte     bit;
+    byte     inverted;
+}StencilPatch;
+
+struct myass_stencil{
+    byte            *code;
+    size_t          code_len;
+    StencilPatch    *patches;
+    size_t          patches_len;
+    size_t          holes[TARGET_PATCH_TYPE + 1]; // per patch type
+    const Allocator *allocator;
+};
+
 typedef struct myass{
     jmp_buf          err_buf;
     LZOHTable        *registers_keywords;
     LZOHTable        *instructions_keywords;
     size_t           largest_instruction;
+    int64_t          simplified_bytes;
+    size_t           loop_alignment;
+    size_t           loop_max_padding;
+    int              flags;
+    const char       *source;
+    MyAssListingEntry *listing;
+    size_t           listing_len;
+    size_t           listing_capacity;
+    LineTable        *line_table;
+    FrozenSymbol     *frozen_symbols;
+    SymbolName       *symbols_by_name;
+    size_t           symbols_by_name_capacity;
+    size_t           frozen_symbols_len;
+    size_t           frozen_symbols_capacity;
+    char             *symbol_names;
+    size_t           symbol_names_capacity;
+    MyAssPatchSite   *patch_sites;
+    size_t           patch_sites_len;
+    size_t           patch_sites_capacity;
+    MyAssResolver    resolver;
+    void             *resolver_context;
+    LZOHTable        *label_counts; // label name to uint64_t, kept across assemblies
+    uint64_t         *counters; // see 'myass_block_counters'
+    size_t           counters_capacity;
+    size_t           counters_len; // inserted by the last assembly
+    int              atomic_counters;
+    CounterSymbol    *counter_symbols;
+    size_t           counter_symbols_len;
+    size_t           counter_symbols_capacity;
+    ExternalCall     *external_calls;
+    size_t           external_calls_len;
+    size_t           external_calls_capacity;
+    Label            *labels;
+    size_t           labels_len;
+    size_t           labels_capacity;
+    LabelFixup       *label_fixups;
+    size_t           label_fixups_len;
+    size_t           label_fixups_capacity;
+    int              stencil; // assembling for 'myass_stencil_create'
+    StencilPatch     *stencil_patches;
+    size_t           stencil_patches_len;
+    size_t           stencil_patches_capacity;
+    size_t           text_len;  // code before the call stubs
+    size_t           stubs_len;
+    size_t           pool_offset;
+    size_t           pool_len;
     DynArr           *instructions;
     LZOHTable        *symbols;
     LZStack          *jumps_to_resolve;
+    LZOHTable        *constant_uses;
+    LZOHTable        *constants; // value to pool slot
+    DynArr           *constant_values;
+    LZStack          *constant_loads;
+    LZOHTable        *externals; // name to ExternalSymbol
     LZBBuff          *bbuff;
+    Lexer            *lexer;
     LZArena          *arena;
     AllocatorContext *arena_allocator_context;
     Allocator        arena_allocator;
     const Allocator  *allocator;
 }MyAss;
 
+// A pool load takes 7 bytes plus the 8 of its slot, shared by all of
+// them, against the 10 bytes of a movabs
+#define CONSTANT_POOL_MIN_USES 3
+#define CONSTANT_POOL_ALIGNMENT 8
+
+// 'jmp qword [rip + disp32]'
+#define CALL_STUB_LEN 6
+
+// Longest 'label count' line 'myass_load_profile' takes
+#define PROFILE_MAX_LINE_LEN 1024
+
+#define UNBOUND_LABEL UINT32_MAX
+#define NO_SYMBOL     UINT32_MAX
+#define NO_FIXUP      UINT32_MAX
+
+// The rel32 of a patchable site never crosses one of these
+#define PATCH_SITE_ALIGNMENT 8
+
+// VEX.pp, the implied mandatory prefix, and VEX.mmmmm, the opcode map
+#define VEX_PP_NONE  0b00
+#define VEX_PP_66    0b01
+#define VEX_PP_F3    0b10
+#define VEX_MAP_0F   0b00001
+#define VEX_MAP_0F38 0b00010
+
+// Recommended multi-byte NOP sequences (Intel SDM, NOP instruction),
+// indexed by length - 1
+static const byte nops[9][9] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0f, 0x1f, 0x00},
+    {0x0f, 0x1f, 0x40, 0x00},
+    {0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
 typedef enum mod{
     MEM_MODE_NO_DISPLACEMENT,
     MEM_MODE_8BIT_DISPLACEMENT,
@@ -67,8 +250,10 @@ typedef enum mod{
 #define ARENA (myass->arena)
 #define ALLOCATOR (&(myass->arena_allocator))
 #define BBUFF (myass->bbuff)
+#define LEXEME(_token) LEXER_LEXEME_ARGS(myass->lexer, (_token))
 
 static void error(MyAss *myass, Token *token, char *msg, ...);
+static void out_of_memory(MyAss *myass);
 
 static byte rex(
     byte w, // 64 bits mode
@@ -77,14 +262,23 @@ static byte rex(
     byte b  // extend r/m base field
 );
 static byte mod_rm(Mod mod, X64Register dest, X64Register source);
+static void write_memory_operand(MyAss *myass, X64Register reg, X64Register base, int32_t displacement);
+static void write_0f_prefix(MyAss *myass, byte prefix, byte w, byte reg, byte base);
+static void write_0f_register(MyAss *myass, byte prefix, byte w, byte opcode, byte reg, byte rm);
+static void write_0f_memory(MyAss *myass, byte prefix, byte w, byte opcode, byte reg, X64Register base, int32_t displacement);
+static void write_vex_prefix(MyAss *myass, byte pp, byte map, byte len, byte reg, byte vvvv, byte base);
+static void write_vex_register(MyAss *myass, byte pp, byte map, byte len, byte opcode, byte reg, byte vvvv, byte rm);
+static void write_vex_memory(MyAss *myass, byte pp, byte map, byte len, byte opcode, byte reg, byte vvvv, X64Register base, int32_t displacement);
 static void add_keyword(LZOHTable *keywords, const char *name, TokenType type);
+static void add_register(LZOHTable *keywords, const char *name, TokenType type, X64Register reg);
 static LZOHTable *create_registers_keywords(const Allocator *allocator);
 static LZOHTable *create_instructions_keywords(const Allocator *allocator);
 
 static void reg_to_str(LZBStr *lzbstr, X64Register reg);
-static void location_to_str(LZBStr *lzbstr, Location *location);
-static void instruction_to_str(LZBStr *lzbstr, Instruction *instruction);
+static void location_to_str(const MyAss *myass, LZBStr *lzbstr, Location *location);
+static void instruction_to_str(const MyAss *myass, LZBStr *lzbstr, Instruction *instruction);
 
+static void assemble_align_instruction(MyAss *myass, AlignInstruction *instruction);
 static void assemble_add_instruction(MyAss *myass, BinaryInstruction *instruction);
 static void assemble_call_instruction(MyAss *myass, UnaryInstruction *instruction);
 static void assemble_cmp_instruction(MyAss *myass, BinaryInstruction *instruction);
@@ -101,11 +295,65 @@ static void assemble_pop_instruction(MyAss *myass, UnaryInstruction *instruction
 static void assemble_push_instruction(MyAss *myass, UnaryInstruction *instruction);
 static void assemble_sub_instruction(MyAss *myass, BinaryInstruction *instruction);
 static void assemble_ret_instruction(MyAss *myass);
+static void assemble_tzcnt_instruction(MyAss *myass, BinaryInstruction *instruction);
 static void assemble_xor_instruction(MyAss *myass, BinaryInstruction *instruction);
+static void assemble_movdqu_instruction(MyAss *myass, BinaryInstruction *instruction);
+static void assemble_movq_instruction(MyAss *myass, BinaryInstruction *instruction);
+static void assemble_sse_instruction(
+    MyAss *myass,
+    BinaryInstruction *instruction,
+    void (*xmm_xmm)(MyAss *myass, byte dst, byte src),
+    void (*xmm_m128)(MyAss *myass, byte dst, X64Register base, int32_t displacement)
+);
+static void assemble_pmovmskb_instruction(MyAss *myass, BinaryInstruction *instruction);
+static void assemble_vmovdqu_instruction(MyAss *myass, BinaryInstruction *instruction);
+static void assemble_vex_instruction(
+    MyAss *myass,
+    TernaryInstruction *instruction,
+    void (*v_v_v)(MyAss *myass, byte len, byte dst, byte src1, byte src2),
+    void (*v_v_m)(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement)
+);
+static void assemble_vpbroadcast_instruction(
+    MyAss *myass,
+    BinaryInstruction *instruction,
+    void (*v_xmm)(MyAss *myass, byte len, byte dst, byte src),
+    void (*v_m)(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement)
+);
+static void assemble_vpmovmskb_instruction(MyAss *myass, BinaryInstruction *instruction);
+
+static void count_constant_uses(MyAss *myass, DynArr *instructions);
+static size_t constant_slot(MyAss *myass, qword value);
+static void load_constant(MyAss *myass, X64Register dst, qword value);
+static void assemble_mov_literal(MyAss *myass, X64Register dst, qword value);
+static void emit_call_stubs(MyAss *myass);
+static void emit_constant_pool(MyAss *myass);
+static void print_call_stubs(const MyAss *myass, size_t largest_line_len);
+static void print_constant_pool(const MyAss *myass, size_t largest_line_len);
+
+static void pad_patch_site(MyAss *myass);
+static void add_jump(MyAss *myass, InstructionType type, Location *location);
+static void add_stencil_patch(MyAss *myass, StencilPatch patch);
+static void record_register_hole(MyAss *myass, Instruction *instruction, Location *location, Token *hole_token);
+static void record_holes(MyAss *myass, Instruction *instruction);
 
 static void assemble_instruction(MyAss *myass, Instruction *instruction);
 static void assemble_instructions(MyAss *myass, DynArr *instructions);
+static void reassemble_instructions(MyAss *myass, DynArr *instructions);
+static DynArr *align_loop_heads(MyAss *myass, DynArr *instructions);
+static DynArr *insert_block_counters(MyAss *myass, DynArr *instructions);
+static void link_external_call(MyAss *myass, size_t offset, ExternalSymbol *external);
 static void resolve_jumps(MyAss *myass);
+static void build_listing(MyAss *myass, DynArr *instructions);
+static int compare_symbol_names(const void *a, const void *b);
+static void freeze_symbols(MyAss *myass, DynArr *instructions);
+static void freeze_counters(MyAss *myass, DynArr *instructions);
+static size_t next_function(const MyAss *myass, size_t from);
+static PerfSymbol function_symbol(const MyAss *myass, size_t index, uintptr_t address);
+static void build_patch_sites(MyAss *myass, DynArr *instructions);
+static size_t print_code_bytes(const MyAss *myass, size_t offset, size_t len);
+static int jump_to_bound_label(MyAss *myass, byte short_opcode, Label *label);
+static int add_label_fixup(MyAss *myass, Label *label);
+static int add_label_count(MyAss *myass, const char *name, size_t name_len, uint64_t count);
 
 //------------------------------------------------------------------------------------//
 //                               PRIVATE IMPLEMENTATION                               //
@@ -114,13 +362,15 @@ void error(MyAss *myass, Token *token, char *msg, ...){
 	va_list args;
 	va_start(args, msg);
 
+	TokenLocation location = lexer_token_location(myass->lexer, token);
+
 	fprintf(
 		stderr,
 		"MYASS ERROR - from line(col: %"PRId32"): %"PRId32", to line (col: %"PRId32"): %"PRId32":\n\t",
-		token->start_col,
-		token->start_line,
-		token->end_col,
-		token->end_line
+		location.start_col,
+		location.start_line,
+		location.end_col,
+		location.end_line
 	);
 	vfprintf(stderr, msg, args);
 	fprintf(stderr, "\n");
@@ -130,6 +380,12 @@ void error(MyAss *myass, Token *token, char *msg, ...){
 	longjmp(myass->err_buf, 1);
 }
 
+// Outer allocator failures while assembling unwind like those of the arena
+void out_of_memory(MyAss *myass){
+	fprintf(stderr, "MYASS ERROR - Out of memory\n");
+	longjmp(myass->err_buf, 1);
+}
+
 inline byte rex(
     byte w, // 64bit mode
     byte r, // extend reg field (ModRM)
@@ -149,6 +405,98 @@ inline byte mod_rm(Mod mod, X64Register dest, X64Register source){
     return (((byte)(mod & 0x3)) << 6) | (((byte)(dest & 0x7)) << 3) | (source & 0x7);
 }
 
+// ModRM, SIB and displacement of '[base + displacement]'. rsp and r12
+// as base need a SIB byte, and rbp and r13 always take a displacement
+// since their no displacement form means rip relative
+void write_memory_operand(MyAss *myass, X64Register reg, X64Register base, int32_t displacement){
+    LZBBuff *bbuff = BBUFF;
+    Mod mod = MEM_MODE_32BIT_DISPLACEMENT;
+
+    if(displacement == 0 && (base & 0x7) != RBP){
+        mod = MEM_MODE_NO_DISPLACEMENT;
+    }else if(displacement >= INT8_MIN && displacement <= INT8_MAX){
+        mod = MEM_MODE_8BIT_DISPLACEMENT;
+    }
+
+    lzbbuff_write_byte(bbuff, 0, mod_rm(mod, reg, base));
+
+    if((base & 0x7) == RSP){
+        lzbbuff_write_byte(bbuff, 0, 0x24);
+    }
+
+    if(mod == MEM_MODE_8BIT_DISPLACEMENT){
+        lzbbuff_write_byte(bbuff, 0, (byte)displacement);
+    }else if(mod == MEM_MODE_32BIT_DISPLACEMENT){
+        lzbbuff_write_dword(bbuff, 0, (dword)displacement);
+    }
+}
+
+// Legacy encodings of the 0F opcode map: mandatory prefix, if any, REX
+// and the 0F escape. Stencils always take the REX, so flipping a bit
+// of a register hole keeps the length of the instruction
+void write_0f_prefix(MyAss *myass, byte prefix, byte w, byte reg, byte base){
+    LZBBuff *bbuff = BBUFF;
+
+    if(prefix) lzbbuff_write_byte(bbuff, 0, prefix);
+
+    if(w || reg > 7 || base > 7 || myass->stencil){
+        lzbbuff_write_byte(bbuff, 0, rex(w, reg > 7, 0, base > 7));
+    }
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+}
+
+void write_0f_register(MyAss *myass, byte prefix, byte w, byte opcode, byte reg, byte rm){
+    LZBBuff *bbuff = BBUFF;
+
+    write_0f_prefix(myass, prefix, w, reg, rm);
+    lzbbuff_write_byte(bbuff, 0, opcode);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, reg, rm));
+}
+
+void write_0f_memory(MyAss *myass, byte prefix, byte w, byte opcode, byte reg, X64Register base, int32_t displacement){
+    LZBBuff *bbuff = BBUFF;
+
+    write_0f_prefix(myass, prefix, w, reg, base);
+    lzbbuff_write_byte(bbuff, 0, opcode);
+    write_memory_operand(myass, reg, base, displacement);
+}
+
+// The 2 bytes VEX (C5) only holds R, vvvv, L and pp, so it is taken
+// for the 0F map when the base needs no extension. Everything else
+// takes the 3 bytes one (C4). R, X, B and vvvv are stored inverted,
+// and every form used here is W0
+void write_vex_prefix(MyAss *myass, byte pp, byte map, byte len, byte reg, byte vvvv, byte base){
+    LZBBuff *bbuff = BBUFF;
+    byte last = (byte)(((~vvvv & 0xf) << 3) | ((len == 32) << 2) | pp);
+
+    if(map == VEX_MAP_0F && base <= 7){
+        lzbbuff_write_byte(bbuff, 0, 0xc5);
+        lzbbuff_write_byte(bbuff, 0, (byte)(((reg <= 7) << 7) | last));
+        return;
+    }
+
+    lzbbuff_write_byte(bbuff, 0, 0xc4);
+    lzbbuff_write_byte(bbuff, 0, (byte)(((reg <= 7) << 7) | (1 << 6) | ((base <= 7) << 5) | map));
+    lzbbuff_write_byte(bbuff, 0, last);
+}
+
+void write_vex_register(MyAss *myass, byte pp, byte map, byte len, byte opcode, byte reg, byte vvvv, byte rm){
+    LZBBuff *bbuff = BBUFF;
+
+    write_vex_prefix(myass, pp, map, len, reg, vvvv, rm);
+    lzbbuff_write_byte(bbuff, 0, opcode);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, reg, rm));
+}
+
+void write_vex_memory(MyAss *myass, byte pp, byte map, byte len, byte opcode, byte reg, byte vvvv, X64Register base, int32_t displacement){
+    LZBBuff *bbuff = BBUFF;
+
+    write_vex_prefix(myass, pp, map, len, reg, vvvv, base);
+    lzbbuff_write_byte(bbuff, 0, opcode);
+    write_memory_operand(myass, reg, base, displacement);
+}
+
 void add_keyword(LZOHTable *keywords, const char *name, TokenType type){
     lzohtable_put_ckv(
         strlen(name),
@@ -160,25 +508,49 @@ void add_keyword(LZOHTable *keywords, const char *name, TokenType type){
     );
 }
 
+void add_register(LZOHTable *keywords, const char *name, TokenType type, X64Register reg){
+    RegisterKeyword keyword = {.type = type, .reg = reg};
+
+    lzohtable_put_ckv(
+        strlen(name),
+        name,
+        sizeof(RegisterKeyword),
+        &keyword,
+        keywords,
+        NULL
+    );
+}
+
 LZOHTable *create_registers_keywords(const Allocator *allocator){
     LZOHTable *registers = MEMORY_LZOHTABLE(allocator);
 
-    add_keyword(registers, "rax", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rcx", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rdx", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rbx", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rsp", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rbp", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rsi", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "rdi", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r8", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r9", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r10", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r11", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r12", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r13", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r14", REGISTER_TOKEN_TYPE);
-    add_keyword(registers, "r15", REGISTER_TOKEN_TYPE);
+    add_register(registers, "rax", REGISTER_TOKEN_TYPE, RAX);
+    add_register(registers, "rcx", REGISTER_TOKEN_TYPE, RCX);
+    add_register(registers, "rdx", REGISTER_TOKEN_TYPE, RDX);
+    add_register(registers, "rbx", REGISTER_TOKEN_TYPE, RBX);
+    add_register(registers, "rsp", REGISTER_TOKEN_TYPE, RSP);
+    add_register(registers, "rbp", REGISTER_TOKEN_TYPE, RBP);
+    add_register(registers, "rsi", REGISTER_TOKEN_TYPE, RSI);
+    add_register(registers, "rdi", REGISTER_TOKEN_TYPE, RDI);
+    add_register(registers, "r8", REGISTER_TOKEN_TYPE, R8);
+    add_register(registers, "r9", REGISTER_TOKEN_TYPE, R9);
+    add_register(registers, "r10", REGISTER_TOKEN_TYPE, R10);
+    add_register(registers, "r11", REGISTER_TOKEN_TYPE, R11);
+    add_register(registers, "r12", REGISTER_TOKEN_TYPE, R12);
+    add_register(registers, "r13", REGISTER_TOKEN_TYPE, R13);
+    add_register(registers, "r14", REGISTER_TOKEN_TYPE, R14);
+    add_register(registers, "r15", REGISTER_TOKEN_TYPE, R15);
+
+    char name[] = "xmm00";
+
+    for (int i = 0; i < 16; i++){
+        snprintf(name + 3, sizeof(name) - 3, "%d", i);
+
+        name[0] = 'x';
+        add_register(registers, name, XMM_REGISTER_TOKEN_TYPE, (X64Register)i);
+        name[0] = 'y';
+        add_register(registers, name, YMM_REGISTER_TOKEN_TYPE, (X64Register)i);
+    }
 
     return registers;
 }
@@ -186,12 +558,15 @@ LZOHTable *create_registers_keywords(const Allocator *allocator){
 LZOHTable *create_instructions_keywords(const Allocator *allocator){
     LZOHTable *instructions = MEMORY_LZOHTABLE(allocator);
 
+    add_keyword(instructions, ".align", ALIGN_TOKEN_TYPE);
+    add_keyword(instructions, ".p2align", P2ALIGN_TOKEN_TYPE);
     add_keyword(instructions, "add", ADD_TOKEN_TYPE);
     add_keyword(instructions, "call", CALL_TOKEN_TYPE);
     add_keyword(instructions, "cmp", CMP_TOKEN_TYPE);
     add_keyword(instructions, "idiv", IDIV_TOKEN_TYPE);
     add_keyword(instructions, "imul", IMUL_TOKEN_TYPE);
     add_keyword(instructions, "je", JE_TOKEN_TYPE);
+    add_keyword(instructions, "jne", JNE_TOKEN_TYPE);
     add_keyword(instructions, "jg", JG_TOKEN_TYPE);
     add_keyword(instructions, "jl", JL_TOKEN_TYPE);
     add_keyword(instructions, "jge", JGE_TOKEN_TYPE);
@@ -202,7 +577,25 @@ LZOHTable *create_instructions_keywords(const Allocator *allocator){
     add_keyword(instructions, "pop", POP_TOKEN_TYPE);
     add_keyword(instructions, "sub", SUB_TOKEN_TYPE);
     add_keyword(instructions, "ret", RET_TOKEN_TYPE);
+    add_keyword(instructions, "tzcnt", TZCNT_TOKEN_TYPE);
     add_keyword(instructions, "xor", XOR_TOKEN_TYPE);
+    add_keyword(instructions, "movdqu", MOVDQU_TOKEN_TYPE);
+    add_keyword(instructions, "movq", MOVQ_TOKEN_TYPE);
+    add_keyword(instructions, "paddd", PADDD_TOKEN_TYPE);
+    add_keyword(instructions, "paddq", PADDQ_TOKEN_TYPE);
+    add_keyword(instructions, "pcmpeqb", PCMPEQB_TOKEN_TYPE);
+    add_keyword(instructions, "pmovmskb", PMOVMSKB_TOKEN_TYPE);
+    add_keyword(instructions, "pxor", PXOR_TOKEN_TYPE);
+    add_keyword(instructions, "vmovdqu", VMOVDQU_TOKEN_TYPE);
+    add_keyword(instructions, "vpaddd", VPADDD_TOKEN_TYPE);
+    add_keyword(instructions, "vpaddq", VPADDQ_TOKEN_TYPE);
+    add_keyword(instructions, "vpbroadcastb", VPBROADCASTB_TOKEN_TYPE);
+    add_keyword(instructions, "vpbroadcastd", VPBROADCASTD_TOKEN_TYPE);
+    add_keyword(instructions, "vpbroadcastq", VPBROADCASTQ_TOKEN_TYPE);
+    add_keyword(instructions, "vpcmpeqb", VPCMPEQB_TOKEN_TYPE);
+    add_keyword(instructions, "vpmovmskb", VPMOVMSKB_TOKEN_TYPE);
+    add_keyword(instructions, "vpxor", VPXOR_TOKEN_TYPE);
+    add_keyword(instructions, "vzeroupper", VZEROUPPER_TOKEN_TYPE);
 
     return instructions;
 }
@@ -261,12 +654,18 @@ void reg_to_str(LZBStr *lzbstr, X64Register reg){
 	}
 }
 
-void location_to_str(LZBStr *lzbstr, Location *location){
+void location_to_str(const MyAss *myass, LZBStr *lzbstr, Location *location){
 	switch (location->type) {
 		case LITERAL_LOCATION_TYPE:{
 			LiteralLocation *literal_location = location->sub_location;
 
-			lzbstr_append_args(lzbstr, "%"PRId32, literal_location->value);
+			int64_t value = (int64_t)literal_location->value;
+
+			if(value >= INT32_MIN && value <= INT32_MAX){
+				lzbstr_append_args(lzbstr, "%"PRId64, value);
+			}else{
+				lzbstr_append_args(lzbstr, "0x%"PRIx64, literal_location->value);
+			}
 
 			break;
 		}case REGISTER_LOCATION_TYPE:{
@@ -278,132 +677,187 @@ void location_to_str(LZBStr *lzbstr, Location *location){
 		}case LABEL_LOCATION_TYPE:{
 			LabelLocation *label_location = location->sub_location;
 
-			lzbstr_append_args(lzbstr, "%s", label_location->label_token->lexeme);
+			lzbstr_append_args(lzbstr, "%.*s", LEXEME(&label_location->label_token));
+
+			break;
+		}case VECTOR_LOCATION_TYPE:{
+			VectorLocation *vector_location = location->sub_location;
+
+			lzbstr_append_args(
+				lzbstr,
+				"%cmm%d",
+				vector_location->len == 32 ? 'y' : 'x',
+				vector_location->reg
+			);
+
+			break;
+		}case MEMORY_LOCATION_TYPE:{
+			MemoryLocation *memory_location = location->sub_location;
+			int64_t displacement = memory_location->displacement;
+
+			lzbstr_append("[", lzbstr);
+			reg_to_str(lzbstr, memory_location->base);
+
+			if(displacement > 0){
+				lzbstr_append_args(lzbstr, " + %"PRId64, displacement);
+			}else if(displacement < 0){
+				lzbstr_append_args(lzbstr, " - %"PRId64, -displacement);
+			}
+
+			lzbstr_append("]", lzbstr);
 
 			break;
 		}
     }
 }
 
-void instruction_to_str(LZBStr *lzbstr, Instruction *instruction){
+void instruction_to_str(const MyAss *myass, LZBStr *lzbstr, Instruction *instruction){
 	switch (instruction->type) {
 		case LABEL_INSTRUCTION_TYPE:{
+			break;
+		}case ALIGN_INSTRUCTION_TYPE:{
+			AlignInstruction *align_instruction = instruction->sub_instruction;
+
+			lzbstr_append_args(lzbstr, ".align %zu", align_instruction->alignment);
+
+			if(align_instruction->max_padding < align_instruction->alignment - 1){
+				lzbstr_append_args(lzbstr, " (max %zu)", align_instruction->max_padding);
+			}
+
+			break;
+		}case COUNT_INSTRUCTION_TYPE:{
+			CountInstruction *count_instruction = instruction->sub_instruction;
+
+			lzbstr_append_args(
+				lzbstr,
+				"%sinc qword [%p]",
+				myass->atomic_counters ? "lock " : "",
+				(void *)(myass->counters + count_instruction->index)
+			);
+
 			break;
 		}case ADD_INSTRUCTION_TYPE:{
 			BinaryInstruction *add_instruction = instruction->sub_instruction;
 
 			lzbstr_append("add ", lzbstr);
-			location_to_str(lzbstr, add_instruction->dst_location);
+			location_to_str(myass, lzbstr, add_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, add_instruction->src_location);
+			location_to_str(myass, lzbstr, add_instruction->src_location);
 
 			break;
 		}case CALL_INSTRUCTION_TYPE:{
 			UnaryInstruction *call_instruction = instruction->sub_instruction;
 
 			lzbstr_append("call ", lzbstr);
-			location_to_str(lzbstr, call_instruction->location);
+			location_to_str(myass, lzbstr, call_instruction->location);
 
 		    break;
 	    }case CMP_INSTRUCTION_TYPE:{
 			BinaryInstruction *cmp_instruction = instruction->sub_instruction;
 
 			lzbstr_append("cmp ", lzbstr);
-			location_to_str(lzbstr, cmp_instruction->dst_location);
+			location_to_str(myass, lzbstr, cmp_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, cmp_instruction->src_location);
+			location_to_str(myass, lzbstr, cmp_instruction->src_location);
 
    			break;
 	    }case IDIV_INSTRUCTION_TYPE:{
 			BinaryInstruction *div_instruction = instruction->sub_instruction;
 
 			lzbstr_append("div ", lzbstr);
-			location_to_str(lzbstr, div_instruction->dst_location);
+			location_to_str(myass, lzbstr, div_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, div_instruction->src_location);
+			location_to_str(myass, lzbstr, div_instruction->src_location);
 
 		    break;
 	    }case IMUL_INSTRUCTION_TYPE:{
 			BinaryInstruction *imul_instruction = instruction->sub_instruction;
 
 			lzbstr_append("imul ", lzbstr);
-			location_to_str(lzbstr, imul_instruction->dst_location);
+			location_to_str(myass, lzbstr, imul_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, imul_instruction->src_location);
+			location_to_str(myass, lzbstr, imul_instruction->src_location);
 
 		    break;
 	    }case JE_INSTRUCTION_TYPE:{
 			UnaryInstruction *je_instruction = instruction->sub_instruction;
 
 			lzbstr_append("je ", lzbstr);
-			location_to_str(lzbstr, je_instruction->location);
+			location_to_str(myass, lzbstr, je_instruction->location);
+
+			break;
+	    }case JNE_INSTRUCTION_TYPE:{
+			UnaryInstruction *jne_instruction = instruction->sub_instruction;
+
+			lzbstr_append("jne ", lzbstr);
+			location_to_str(myass, lzbstr, jne_instruction->location);
 
 			break;
 	    }case JG_INSTRUCTION_TYPE:{
 			UnaryInstruction *jg_instruction = instruction->sub_instruction;
 
 			lzbstr_append("jg ", lzbstr);
-			location_to_str(lzbstr, jg_instruction->location);
+			location_to_str(myass, lzbstr, jg_instruction->location);
 
 			break;
 	    }case JL_INSTRUCTION_TYPE:{
 			UnaryInstruction *jl_instruction = instruction->sub_instruction;
 
 			lzbstr_append("jl ", lzbstr);
-			location_to_str(lzbstr, jl_instruction->location);
+			location_to_str(myass, lzbstr, jl_instruction->location);
 
 		    break;
 	    }case JGE_INSTRUCTION_TYPE:{
 			UnaryInstruction *jge_instruction = instruction->sub_instruction;
 
 			lzbstr_append("jge ", lzbstr);
-			location_to_str(lzbstr, jge_instruction->location);
+			location_to_str(myass, lzbstr, jge_instruction->location);
 
 		    break;
 	    }case JLE_INSTRUCTION_TYPE:{
 			UnaryInstruction *jle_instruction = instruction->sub_instruction;
 
 			lzbstr_append("jle ", lzbstr);
-			location_to_str(lzbstr, jle_instruction->location);
+			location_to_str(myass, lzbstr, jle_instruction->location);
 
 		    break;
 	    }case JMP_INSTRUCTION_TYPE:{
 			UnaryInstruction *jmp_instruction = instruction->sub_instruction;
 
 			lzbstr_append("jmp ", lzbstr);
-			location_to_str(lzbstr, jmp_instruction->location);
+			location_to_str(myass, lzbstr, jmp_instruction->location);
 
 		    break;
 	    }case MOV_INSTRUCTION_TYPE:{
 			BinaryInstruction *mov_instruction = instruction->sub_instruction;
 
 			lzbstr_append("mov ", lzbstr);
-			location_to_str(lzbstr, mov_instruction->dst_location);
+			location_to_str(myass, lzbstr, mov_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, mov_instruction->src_location);
+			location_to_str(myass, lzbstr, mov_instruction->src_location);
 
 		    break;
 	    }case POP_INSTRUCTION_TYPE:{
 			UnaryInstruction *pop_instruction = instruction->sub_instruction;
 
 			lzbstr_append("pop ", lzbstr);
-			location_to_str(lzbstr, pop_instruction->location);
+			location_to_str(myass, lzbstr, pop_instruction->location);
 
 		    break;
 	    }case PUSH_INSTRUCTION_TYPE:{
 			UnaryInstruction *push_instruction = instruction->sub_instruction;
 
 			lzbstr_append("push ", lzbstr);
-			location_to_str(lzbstr, push_instruction->location);
+			location_to_str(myass, lzbstr, push_instruction->location);
 
 		    break;
 	    }case SUB_INSTRUCTION_TYPE:{
 			BinaryInstruction *sub_instruction = instruction->sub_instruction;
 
 			lzbstr_append("sub ", lzbstr);
-			location_to_str(lzbstr, sub_instruction->dst_location);
+			location_to_str(myass, lzbstr, sub_instruction->dst_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, sub_instruction->src_location);
+			location_to_str(myass, lzbstr, sub_instruction->src_location);
 
 			break;
 	    }case RET_INSTRUCTION_TYPE:{
@@ -413,15 +867,63 @@ void instruction_to_str(LZBStr *lzbstr, Instruction *instruction){
 			BinaryInstruction *xor_instruction = instruction->sub_instruction;
 
 			lzbstr_append("xor ", lzbstr);
-			location_to_str(lzbstr, xor_instruction->dst_location);
+			location_to_str(myass, lzbstr, xor_instruction->dst_location);
+			lzbstr_append(", ", lzbstr);
+			location_to_str(myass, lzbstr, xor_instruction->src_location);
+
+		    break;
+	    }case TZCNT_INSTRUCTION_TYPE:
+	     case MOVDQU_INSTRUCTION_TYPE:
+	     case MOVQ_INSTRUCTION_TYPE:
+	     case PADDD_INSTRUCTION_TYPE:
+	     case PADDQ_INSTRUCTION_TYPE:
+	     case PCMPEQB_INSTRUCTION_TYPE:
+	     case PMOVMSKB_INSTRUCTION_TYPE:
+	     case PXOR_INSTRUCTION_TYPE:
+	     case VMOVDQU_INSTRUCTION_TYPE:
+	     case VPBROADCASTB_INSTRUCTION_TYPE:
+	     case VPBROADCASTD_INSTRUCTION_TYPE:
+	     case VPBROADCASTQ_INSTRUCTION_TYPE:
+	     case VPMOVMSKB_INSTRUCTION_TYPE:{
+			BinaryInstruction *binary_instruction = instruction->sub_instruction;
+
+			lzbstr_append_args(lzbstr, "%.*s ", LEXEME(&binary_instruction->instruction_token));
+			location_to_str(myass, lzbstr, binary_instruction->dst_location);
+			lzbstr_append(", ", lzbstr);
+			location_to_str(myass, lzbstr, binary_instruction->src_location);
+
+		    break;
+	    }case VPADDD_INSTRUCTION_TYPE:
+	     case VPADDQ_INSTRUCTION_TYPE:
+	     case VPCMPEQB_INSTRUCTION_TYPE:
+	     case VPXOR_INSTRUCTION_TYPE:{
+			TernaryInstruction *ternary_instruction = instruction->sub_instruction;
+
+			lzbstr_append_args(lzbstr, "%.*s ", LEXEME(&ternary_instruction->instruction_token));
+			location_to_str(myass, lzbstr, ternary_instruction->dst_location);
+			lzbstr_append(", ", lzbstr);
+			location_to_str(myass, lzbstr, ternary_instruction->src1_location);
 			lzbstr_append(", ", lzbstr);
-			location_to_str(lzbstr, xor_instruction->src_location);
+			location_to_str(myass, lzbstr, ternary_instruction->src2_location);
 
 		    break;
+	    }case VZEROUPPER_INSTRUCTION_TYPE:{
+			lzbstr_append("vzeroupper", lzbstr);
+		    break;
 	    }
 	}
 }
 
+void assemble_align_instruction(MyAss *myass, AlignInstruction *instruction){
+    size_t alignment = instruction->alignment;
+    size_t offset = lzbbuff_used_bytes(BBUFF);
+    size_t padding = (alignment - (offset & (alignment - 1))) & (alignment - 1);
+
+    if(padding <= instruction->max_padding){
+        myass_nop(myass, padding);
+    }
+}
+
 void assemble_add_instruction(MyAss *myass, BinaryInstruction *instruction){
     Location *dst_location = instruction->dst_location;
     Location *src_location = instruction->src_location;
@@ -434,7 +936,7 @@ void assemble_add_instruction(MyAss *myass, BinaryInstruction *instruction){
                 case LITERAL_LOCATION_TYPE:{
                     LiteralLocation *src = src_location->sub_location;
 
-                    myass_add_r64_imm32(myass, dst->reg, src->value);
+                    myass_add_r64_imm32(myass, dst->reg, (dword)src->value);
 
                     break;
                 }case REGISTER_LOCATION_TYPE:{
@@ -460,19 +962,9 @@ void assemble_call_instruction(MyAss *myass, UnaryInstruction *instruction){
 
     switch (location->type){
         case LABEL_LOCATION_TYPE:{
+            pad_patch_site(myass);
             myass_call_imm32(myass, 0);
-
-            LabelLocation *label_location = location->sub_location;
-            size_t offset = lzbbuff_used_bytes(myass->bbuff);
-            Token *label_token = label_location->label_token;
-            Jmp *jmp = MEMORY_NEW(
-                ALLOCATOR,
-                Jmp,
-                offset,
-                label_token
-            );
-
-            lzstack_push(jmp, myass->jumps_to_resolve);
+            add_jump(myass, CALL_INSTRUCTION_TYPE, location);
 
             break;
         }default:{
@@ -493,7 +985,7 @@ void assemble_cmp_instruction(MyAss *myass, BinaryInstruction *instruction){
                 case LITERAL_LOCATION_TYPE:{
                     LiteralLocation *src = src_location->sub_location;
 
-                    myass_cmp_r64_imm32(myass, dst->reg, src->value);
+                    myass_cmp_r64_imm32(myass, dst->reg, (dword)src->value);
 
                     break;
                 }case REGISTER_LOCATION_TYPE:{
@@ -578,6 +1070,9 @@ void assemble_jcc_instructions(
                 case JE_INSTRUCTION_TYPE:{
                     myass_je_imm32(myass, 0);
                     break;
+                }case JNE_INSTRUCTION_TYPE:{
+                    myass_jne_imm32(myass, 0);
+                    break;
                 }case JG_INSTRUCTION_TYPE:{
                     myass_jg_imm32(myass, 0);
                     break;
@@ -595,17 +1090,7 @@ void assemble_jcc_instructions(
                 }
             }
 
-            LabelLocation *label_location = location->sub_location;
-            size_t offset = lzbbuff_used_bytes(myass->bbuff);
-            Token *label_token = label_location->label_token;
-            Jmp *jmp = MEMORY_NEW(
-                ALLOCATOR,
-                Jmp,
-                offset,
-                label_token
-            );
-
-            lzstack_push(jmp, myass->jumps_to_resolve);
+            add_jump(myass, type, location);
 
             break;
         }default:{
@@ -619,19 +1104,9 @@ void assemble_jmp_instruction(MyAss *myass, UnaryInstruction *instruction){
 
     switch (location->type){
         case LABEL_LOCATION_TYPE:{
+            pad_patch_site(myass);
             myass_jmp_imm32(myass, 0);
-
-            LabelLocation *label_location = location->sub_location;
-            size_t offset = lzbbuff_used_bytes(myass->bbuff);
-            Token *label_token = label_location->label_token;
-            Jmp *jmp = MEMORY_NEW(
-                ALLOCATOR,
-                Jmp,
-                offset,
-                label_token
-            );
-
-            lzstack_push(jmp, myass->jumps_to_resolve);
+            add_jump(myass, JMP_INSTRUCTION_TYPE, location);
 
             break;
         }default:{
@@ -640,640 +1115,3133 @@ void assemble_jmp_instruction(MyAss *myass, UnaryInstruction *instruction){
     }
 }
 
-void assemble_mov_instruction(MyAss *myass, BinaryInstruction *instruction){
-    Location *dst_location = instruction->dst_location;
-    Location *src_location = instruction->src_location;
+// Keeps the rel32 of the call or jmp about to be written inside one
+// aligned qword, which is what 'myass_retarget' swaps
+void pad_patch_site(MyAss *myass){
+    if(!(myass->flags & MYASS_FLAG_PATCHABLE)){
+        return;
+    }
 
-    switch (dst_location->type){
-        case REGISTER_LOCATION_TYPE:{
-            RegisterLocation *dst = dst_location->sub_location;
+    size_t displacement_offset = lzbbuff_used_bytes(BBUFF) + 1;
+    size_t misalignment = displacement_offset & (PATCH_SITE_ALIGNMENT - 1);
 
-            switch (src_location->type){
-                case LITERAL_LOCATION_TYPE:{
-                    LiteralLocation *src = src_location->sub_location;
+    if(misalignment > PATCH_SITE_ALIGNMENT - sizeof(dword)){
+        myass_nop(myass, PATCH_SITE_ALIGNMENT - misalignment);
+    }
+}
 
-                    myass_mov_r64_imm32(myass, dst->reg, src->value);
+// Queues the rel32 just written for 'resolve_jumps', unless it
+// is a target hole of the stencil being assembled
+void add_jump(MyAss *myass, InstructionType type, Location *location){
+    LabelLocation *label_location = location->sub_location;
+    size_t offset = lzbbuff_used_bytes(BBUFF);
+    Token *label_token = &label_location->label_token;
 
-                    break;
-                }case REGISTER_LOCATION_TYPE:{
-                    RegisterLocation *src = src_location->sub_location;
+    if(label_token->type == TARGET_HOLE_TOKEN_TYPE){
+        add_stencil_patch(myass, (StencilPatch){
+            .offset = (uint32_t)(offset - sizeof(dword)),
+            .type = TARGET_PATCH_TYPE,
+            .hole = (byte)label_token->literal
+        });
 
-                    myass_mov_r64_r64(myass, dst->reg, src->reg);
+        return;
+    }
 
-                    break;
-                }default:{
-                    assert(0 && "Illegal location type");
-                }
-            }
+    Jmp *jmp = MEMORY_NEW(
+        ALLOCATOR,
+        Jmp,
+        offset,
+        type,
+        label_token
+    );
 
-            break;
-        }default:{
-            assert(0 && "Illegal location type");
-        }
-    }
+    lzstack_push(jmp, myass->jumps_to_resolve);
 }
 
-void assemble_pop_instruction(MyAss *myass, UnaryInstruction *instruction){
-	Location *dst_location = instruction->location;
+// Patches live in the outer allocator, 'myass_stencil_create' copies them
+void add_stencil_patch(MyAss *myass, StencilPatch patch){
+    const Allocator *allocator = myass->allocator;
 
-	switch (dst_location->type) {
-		case REGISTER_LOCATION_TYPE:{
-			RegisterLocation *reg_location = dst_location->sub_location;
+    if(myass->stencil_patches_len == myass->stencil_patches_capacity){
+        size_t new_capacity = myass->stencil_patches_capacity == 0 ? 16 : myass->stencil_patches_capacity * 2;
 
-			myass_pop_r64(myass, reg_location->reg);
+        StencilPatch *stencil_patches = MEMORY_REALLOC(
+            StencilPatch,
+            myass->stencil_patches_capacity,
+            new_capacity,
+            myass->stencil_patches,
+            allocator
+        );
 
-			break;
-		}default:{
-			assert(0 && "Illegal location type");
-		}
-	}
+        if(!stencil_patches){
+            out_of_memory(myass);
+        }
+
+        myass->stencil_patches = stencil_patches;
+        myass->stencil_patches_capacity = new_capacity;
+    }
+
+    myass->stencil_patches[myass->stencil_patches_len++] = patch;
 }
 
-void assemble_push_instruction(MyAss *myass, UnaryInstruction *instruction){
-	Location *src_location = instruction->location;
+// The instruction is written again after itself with one bit of the
+// hole register flipped at a time. The bytes that change are the ones
+// following that bit, whatever the encoding: REX, ModRM or opcode
+void record_register_hole(MyAss *myass, Instruction *instruction, Location *location, Token *hole_token){
+    RegisterLocation *register_location = location->sub_location;
+    LZBBuff *bbuff = BBUFF;
+    size_t start = instruction->offset;
+    size_t end = start + instruction->len;
 
-	switch (src_location->type) {
-		case REGISTER_LOCATION_TYPE:{
-			RegisterLocation *reg_location = src_location->sub_location;
+    for (byte bit = 0; bit < 4; bit++){
+        register_location->reg = (X64Register)(HOLE_REGISTER ^ (1 << bit));
+        assemble_instruction(myass, instruction);
+        register_location->reg = HOLE_REGISTER;
+
+        if(lzbbuff_used_bytes(bbuff) - end != instruction->len){
+            error(
+                myass,
+                hole_token,
+                "Register hole '%.*s' changes the length of its instruction",
+                LEXEME(hole_token)
+            );
+        }
 
-			myass_push_r64(myass, reg_location->reg);
+        const byte *code = bbuff->raw_buff;
+        byte hole_bit = (HOLE_REGISTER >> bit) & 1;
 
-			break;
-		}default:{
-			assert(0 && "Illegal location type");
-		}
-	}
-}
+        for (size_t i = 0; i < instruction->len; i++){
+            byte diff = code[start + i] ^ code[end + i];
 
-void assemble_sub_instruction(MyAss *myass, BinaryInstruction *instruction){
-    Location *dst_location = instruction->dst_location;
-    Location *src_location = instruction->src_location;
+            while(diff){
+                byte mask = diff & -diff;
 
-    switch (dst_location->type){
-        case REGISTER_LOCATION_TYPE:{
-            RegisterLocation *dst = dst_location->sub_location;
+                add_stencil_patch(myass, (StencilPatch){
+                    .offset = (uint32_t)(start + i),
+                    .type = REGISTER_PATCH_TYPE,
+                    .hole = (byte)hole_token->literal,
+                    .mask = mask,
+                    .bit = bit,
+                    .inverted = ((code[start + i] & mask) != 0) != hole_bit
+                });
 
-            switch (src_location->type){
-                case LITERAL_LOCATION_TYPE:{
-                    LiteralLocation *src = src_location->sub_location;
+                diff &= diff - 1;
+            }
+        }
 
-                    myass_sub_r64_imm32(myass, dst->reg, src->value);
+        lzbbuff_truncate(bbuff, end);
+    }
+}
 
-                    break;
-                }case REGISTER_LOCATION_TYPE:{
-                    RegisterLocation *src = src_location->sub_location;
+// Target holes are recorded by 'add_jump'
+void record_holes(MyAss *myass, Instruction *instruction){
+    switch (instruction->type){
+        case ADD_INSTRUCTION_TYPE:
+        case CMP_INSTRUCTION_TYPE:
+        case IMUL_INSTRUCTION_TYPE:
+        case MOV_INSTRUCTION_TYPE:
+        case SUB_INSTRUCTION_TYPE:
+        case TZCNT_INSTRUCTION_TYPE:
+        case XOR_INSTRUCTION_TYPE:
+        case MOVQ_INSTRUCTION_TYPE:
+        case PMOVMSKB_INSTRUCTION_TYPE:
+        case VPMOVMSKB_INSTRUCTION_TYPE:{
+            BinaryInstruction *binary_instruction = instruction->sub_instruction;
+
+            if(binary_instruction->dst_token.type == REGISTER_HOLE_TOKEN_TYPE){
+                record_register_hole(
+                    myass,
+                    instruction,
+                    binary_instruction->dst_location,
+                    &binary_instruction->dst_token
+                );
+            }
 
-                    myass_sub_r64_r64(myass, dst->reg, src->reg);
+            if(binary_instruction->src_token.type == REGISTER_HOLE_TOKEN_TYPE){
+                record_register_hole(
+                    myass,
+                    instruction,
+                    binary_instruction->src_location,
+                    &binary_instruction->src_token
+                );
+            }else if(binary_instruction->src_token.type == IMMEDIATE_HOLE_TOKEN_TYPE){
+                // Every imm32 form ends with its immediate
+                add_stencil_patch(myass, (StencilPatch){
+                    .offset = (uint32_t)(instruction->offset + instruction->len - sizeof(dword)),
+                    .type = IMMEDIATE_PATCH_TYPE,
+                    .hole = (byte)binary_instruction->src_token.literal
+                });
+            }
 
-                    break;
-                }default:{
-                    assert(0 && "Illegal location type");
-                }
+            break;
+        }case IDIV_INSTRUCTION_TYPE:
+         case POP_INSTRUCTION_TYPE:
+         case PUSH_INSTRUCTION_TYPE:{
+            UnaryInstruction *unary_instruction = instruction->sub_instruction;
+
+            if(unary_instruction->operand_token.type == REGISTER_HOLE_TOKEN_TYPE){
+                record_register_hole(
+                    myass,
+                    instruction,
+                    unary_instruction->location,
+                    &unary_instruction->operand_token
+                );
             }
 
             break;
         }default:{
-            assert(0 && "Illegal location type");
+            break;
         }
     }
 }
 
-inline void assemble_ret_instruction(MyAss *myass){
-    myass_ret(myass);
-}
-
-void assemble_xor_instruction(MyAss *myass, BinaryInstruction *instruction){
-    Location *dst_location = instruction->dst_location;
-    Location *src_location = instruction->src_location;
+// Only values that need all 64 bits are worth counting
+void count_constant_uses(MyAss *myass, DynArr *instructions){
+    LZOHTable *constant_uses = myass->constant_uses;
+    size_t len = DYNARR_LEN(instructions);
 
-    switch (dst_location->type){
-        case REGISTER_LOCATION_TYPE:{
-            RegisterLocation *dst = dst_location->sub_location;
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
 
-            switch (src_location->type){
-                case LITERAL_LOCATION_TYPE:{
-                    LiteralLocation *src = src_location->sub_location;
+        if(instruction->type != MOV_INSTRUCTION_TYPE){
+            continue;
+        }
 
-                    myass_xor_r64_imm32(myass, dst->reg, src->value);
+        BinaryInstruction *mov_instruction = instruction->sub_instruction;
+        Location *src_location = mov_instruction->src_location;
 
-                    break;
-                }case REGISTER_LOCATION_TYPE:{
-                    RegisterLocation *src = src_location->sub_location;
+        if(src_location->type != LITERAL_LOCATION_TYPE){
+            continue;
+        }
 
-                    myass_xor_r64_r64(myass, dst->reg, src->reg);
+        LiteralLocation *src = src_location->sub_location;
+        qword value = src->value;
+        size_t *uses = NULL;
 
-                    break;
-                }default:{
-                    assert(0 && "Illegal location type");
-                }
-            }
+        if(value <= UINT32_MAX || ((int64_t)value >= INT32_MIN && (int64_t)value <= INT32_MAX)){
+            continue;
+        }
 
-            break;
-        }default:{
-            assert(0 && "Illegal location type");
+        if(lzohtable_lookup(sizeof(qword), &value, constant_uses, (void **)(&uses))){
+            (*uses)++;
+            continue;
         }
+
+        size_t first_use = 1;
+
+        lzohtable_put_ckv(sizeof(qword), &value, sizeof(size_t), &first_use, constant_uses, NULL);
     }
 }
 
-void assemble_instruction(MyAss *myass, Instruction *instruction){
-    switch (instruction->type){
-        case LABEL_INSTRUCTION_TYPE:{
-       		LZOHTable *symbols = myass->symbols;
+// Each value gets one slot, added the first time it is asked for
+size_t constant_slot(MyAss *myass, qword value){
+    LZOHTable *constants = myass->constants;
+    DynArr *constant_values = myass->constant_values;
+    size_t *slot = NULL;
 
-         	EmptyInstruction *label_instruction = instruction->sub_instruction;
-            Token *label_token = label_instruction->token;
+    if(lzohtable_lookup(sizeof(qword), &value, constants, (void **)(&slot))){
+        return *slot;
+    }
 
-            LabelSymbol *label_symbol = MEMORY_NEW(
-                ALLOCATOR,
-                LabelSymbol,
-                lzbbuff_used_bytes(myass->bbuff)
-            );
-            Symbol symbol = {
-                .type = LABEL_SYMBOL_TYPE,
-                .sub_symbol = label_symbol
-            };
+    size_t new_slot = DYNARR_LEN(constant_values);
 
-            size_t key_size = label_token->lexeme_len;
-            const char *key = label_token->lexeme;
+    dynarr_insert(&value, constant_values);
+    lzohtable_put_ckv(sizeof(qword), &value, sizeof(size_t), &new_slot, constants, NULL);
 
-            if(lzohtable_lookup(key_size, key, symbols, NULL)){
-           		error(
-             		myass,
-               		label_token,
-               		"Already exists symbol '%s'",
-                 	key
-             	);
-            }
+    return new_slot;
+}
 
-            lzohtable_put_ckv(
-                key_size,
-                key,
-                sizeof(Symbol),
-                &symbol,
-                myass->symbols,
-                NULL
-            );
+void load_constant(MyAss *myass, X64Register dst, qword value){
+    size_t slot = constant_slot(myass, value);
 
-            break;
-        }case ADD_INSTRUCTION_TYPE:{
-            assemble_add_instruction(myass, instruction->sub_instruction);
-            break;
-        }case CALL_INSTRUCTION_TYPE:{
-            assemble_call_instruction(myass, instruction->sub_instruction);
-            break;
-        }case CMP_INSTRUCTION_TYPE:{
-            assemble_cmp_instruction(myass, instruction->sub_instruction);
-            break;
-        }case IDIV_INSTRUCTION_TYPE:{
-            assemble_idiv_instruction(myass, instruction->sub_instruction);
-            break;
-        }case JE_INSTRUCTION_TYPE:
-         case JG_INSTRUCTION_TYPE:
-         case JL_INSTRUCTION_TYPE:
-         case JGE_INSTRUCTION_TYPE:
-         case JLE_INSTRUCTION_TYPE:{
-            assemble_jcc_instructions(
-            	myass,
-             	instruction->type,
-              	instruction->sub_instruction
-            );
-            break;
-        }case JMP_INSTRUCTION_TYPE:{
-            assemble_jmp_instruction(myass, instruction->sub_instruction);
-            break;
-        }case MOV_INSTRUCTION_TYPE:{
-            assemble_mov_instruction(myass, instruction->sub_instruction);
-            break;
-        }case POP_INSTRUCTION_TYPE:{
-            assemble_pop_instruction(myass, instruction->sub_instruction);
-            break;
-        }case PUSH_INSTRUCTION_TYPE:{
-            assemble_push_instruction(myass, instruction->sub_instruction);
-            break;
-        }case IMUL_INSTRUCTION_TYPE:{
-            assemble_imul_instruction(myass, instruction->sub_instruction);
-            break;
-        }case SUB_INSTRUCTION_TYPE:{
-            assemble_sub_instruction(myass, instruction->sub_instruction);
-            break;
-        }case RET_INSTRUCTION_TYPE:{
-            assemble_ret_instruction(myass);
-            break;
-        }case XOR_INSTRUCTION_TYPE:{
-            assemble_xor_instruction(myass, instruction->sub_instruction);
-            break;
-        }
+    myass_mov_r64_rip32(myass, dst, 0);
+
+    ConstantLoad *constant_load = MEMORY_NEW(
+        ALLOCATOR,
+        ConstantLoad,
+        lzbbuff_used_bytes(BBUFF),
+        slot
+    );
+
+    lzstack_push(constant_load, myass->constant_loads);
+}
+
+// Zero extension covers 0 to UINT32_MAX and sign extension the negative
+// int32 values. Anything else comes from the constant pool when it is
+// used often enough to pay for its slot
+void assemble_mov_literal(MyAss *myass, X64Register dst, qword value){
+    size_t *uses = NULL;
+
+    if(value <= UINT32_MAX){
+        myass_mov_r32_imm32(myass, dst, (dword)value);
+    }else if((int64_t)value >= INT32_MIN && (int64_t)value <= INT32_MAX){
+        myass_mov_r64_imm32(myass, dst, (dword)value);
+    }else if(!(myass->flags & MYASS_FLAG_PREFER_MOVABS) &&
+             lzohtable_lookup(sizeof(qword), &value, myass->constant_uses, (void **)(&uses)) &&
+             *uses >= CONSTANT_POOL_MIN_USES){
+        load_constant(myass, dst, value);
+    }else{
+        myass_movabs_r64_imm64(myass, dst, value);
     }
 }
 
-void assemble_instructions(MyAss *myass, DynArr *instructions){
-	LZBBuff *bbuff = BBUFF;
-	size_t len = DYNARR_LEN(instructions);
+// Call targets the source does not define are asked to the resolver.
+// Each one found gets a stub right after the code that jumps to the
+// address held in its constant pool slot. Calls are pointed at the
+// stubs by 'resolve_jumps'
+void emit_call_stubs(MyAss *myass){
+    LZBBuff *bbuff = BBUFF;
+    LZOHTable *symbols = myass->symbols;
+    LZOHTable *externals = myass->externals;
+    MyAssResolver resolver = myass->resolver;
 
-    for (size_t i = 0; i < len; i++){
-        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
-        size_t used_before = lzbbuff_used_bytes(bbuff);
+    myass->text_len = lzbbuff_used_bytes(bbuff);
 
-        assemble_instruction(myass, instruction);
+    if(!resolver){
+        return;
+    }
 
-        size_t used_after = lzbbuff_used_bytes(bbuff);
-        size_t instruction_len = used_after - used_before;
+    for (LZStackNode *node = myass->jumps_to_resolve->top; node; node = node->prev){
+        Jmp *jmp = node->value;
+        Token *label_token = jmp->label_token;
+        const char *name = lexer_lexeme(myass->lexer, label_token);
+        uintptr_t address = 0;
 
-        instruction->offset = used_before;
-        instruction->len = instruction_len;
+        if(jmp->type != CALL_INSTRUCTION_TYPE ||
+           lzohtable_lookup(label_token->len, name, symbols, NULL) ||
+           lzohtable_lookup(label_token->len, name, externals, NULL)){
+            continue;
+        }
 
-        if(instruction_len > myass->largest_instruction){
-            myass->largest_instruction = instruction_len;
+        // Unknown symbols are reported by 'resolve_jumps'
+        if(resolver(name, label_token->len, myass->resolver_context, &address)){
+            continue;
         }
+
+        ExternalSymbol external = {
+            .stub_offset = lzbbuff_used_bytes(bbuff),
+            .address = address
+        };
+
+        lzbbuff_write_byte(bbuff, 0, 0xff);
+        lzbbuff_write_byte(bbuff, 0, mod_rm(MEM_MODE_NO_DISPLACEMENT, 4, RBP));
+        lzbbuff_write_dword(bbuff, 0, 0);
+
+        ConstantLoad *constant_load = MEMORY_NEW(
+            ALLOCATOR,
+            ConstantLoad,
+            lzbbuff_used_bytes(bbuff),
+            constant_slot(myass, address)
+        );
+
+        lzstack_push(constant_load, myass->constant_loads);
+        lzohtable_put_ckv(label_token->len, name, sizeof(ExternalSymbol), &external, externals, NULL);
+
+        myass->stubs_len++;
+    }
+
+    if(myass->stubs_len > 0 && myass->largest_instruction < CALL_STUB_LEN){
+        myass->largest_instruction = CALL_STUB_LEN;
     }
 }
 
-void resolve_jumps(MyAss *myass){
-    LZOHTable *symbols = myass->symbols;
-    LZStack *jumps_to_resolve = myass->jumps_to_resolve;
+// The pool goes right after the code and its stubs, aligned to its start
+void emit_constant_pool(MyAss *myass){
     LZBBuff *bbuff = BBUFF;
+    DynArr *constant_values = myass->constant_values;
+    size_t len = DYNARR_LEN(constant_values);
 
-    while (lzstack_peek(jumps_to_resolve)){
-        Jmp *jmp = lzstack_pop(jumps_to_resolve);
-        size_t jmp_offset = jmp->offset;
-        Token *label_token = jmp->label_token;
-        Symbol *symbol = NULL;
+    myass->pool_offset = lzbbuff_used_bytes(bbuff);
+    myass->pool_len = len;
 
-        if(!lzohtable_lookup(
-        	label_token->lexeme_len,
-            label_token->lexeme,
-            symbols,
-            (void **)(&symbol))
-        ){
-	        error(
-	        	myass,
-				label_token,
-	         	"Unknown symbol '%s'",
-	            label_token->lexeme
-	        );
-        }
+    if(len == 0){
+        return;
+    }
 
-        switch (symbol->type){
-            case LABEL_SYMBOL_TYPE:{
-                LabelSymbol *label_symbol = symbol->sub_symbol;
-                size_t label_offset = label_symbol->location;
-                dword displacement = (dword)(((dword)label_offset) - ((dword)jmp_offset));
+    // Never executed, so it traps instead of falling into data
+    while(lzbbuff_used_bytes(bbuff) % CONSTANT_POOL_ALIGNMENT != 0){
+        lzbbuff_write_byte(bbuff, 0, 0xcc);
+    }
 
-                lzbbuff_overwrite_dword(bbuff, 0, jmp_offset - 4, displacement);
+    size_t pool_offset = lzbbuff_used_bytes(bbuff);
 
-                break;
-            }default:{
-           		assert(0 && "Illegal symbol type");
-            }
-        }
+    for (size_t i = 0; i < len; i++){
+        lzbbuff_write_qword(bbuff, 0, DYNARR_GET_AS(qword, i, constant_values));
     }
-}
 
-//------------------------------------------------------------------------------------//
-//                               PUBLIC IMPLEMENTATION                                //
-//------------------------------------------------------------------------------------//
-MyAss *myass_create(const Allocator *allocator){
-    LZOHTable *registers_keywords = create_registers_keywords(allocator);
-    LZOHTable *instructions_keywords = create_instructions_keywords(allocator);
-    LZBBuff *bbuff = lzbbuff_create(8192, (LZBBuffAllocator *)allocator);
-    LZArena *arena = lzarena_create((LZArenaAllocator *)allocator);
-    AllocatorContext *allocator_context = MEMORY_ALLOC(AllocatorContext, 1, allocator);
-    MyAss *myass = MEMORY_ALLOC(MyAss, 1, allocator);
+    while(lzstack_peek(myass->constant_loads)){
+        ConstantLoad *constant_load = lzstack_pop(myass->constant_loads);
+        size_t slot_offset = pool_offset + (constant_load->slot * sizeof(qword));
+        dword displacement = (dword)(slot_offset - constant_load->offset);
 
-    if(!registers_keywords || !instructions_keywords || !bbuff || !arena || !allocator_context || !myass){
-        LZOHTABLE_DESTROY(registers_keywords);
-        LZOHTABLE_DESTROY(instructions_keywords);
-        lzbbuff_destroy(bbuff);
-        lzarena_destroy(arena);
-        MEMORY_DEALLOC(allocator_context, AllocatorContext, 1, allocator);
-        MEMORY_DEALLOC(myass, MyAss, 1, allocator);
+        lzbbuff_overwrite_dword(bbuff, 0, constant_load->offset - 4, displacement);
+    }
 
-        return NULL;
+    myass->pool_offset = pool_offset;
+
+    if(myass->largest_instruction < sizeof(qword)){
+        myass->largest_instruction = sizeof(qword);
     }
+}
 
-    allocator_context->err_buf = &myass->err_buf;
-    allocator_context->behind_allocator = arena;
+void assemble_mov_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
 
-    myass->registers_keywords = registers_keywords;
-    myass->instructions_keywords = instructions_keywords;
-    myass->largest_instruction = 0;
-    myass->instructions = NULL;
-    myass->symbols = NULL;
-    myass->jumps_to_resolve = NULL;
-    myass->bbuff = bbuff;
-    myass->arena = arena;
-    myass->arena_allocator_context = allocator_context;
-    myass->allocator = allocator;
+    switch (dst_location->type){
+        case REGISTER_LOCATION_TYPE:{
+            RegisterLocation *dst = dst_location->sub_location;
 
-    MEMORY_INIT_ALLOCATOR(
-        allocator_context,
-        memory_arena_alloc,
-        memory_arena_realloc,
-        memory_arena_dealloc,
-        &myass->arena_allocator
-    );
+            switch (src_location->type){
+                case LITERAL_LOCATION_TYPE:{
+                    LiteralLocation *src = src_location->sub_location;
 
-    return myass;
-}
+                    // Holes take the one form every immediate fits
+                    if(instruction->src_token.type == IMMEDIATE_HOLE_TOKEN_TYPE){
+                        myass_mov_r64_imm32(myass, dst->reg, (dword)src->value);
+                    }else{
+                        assemble_mov_literal(myass, dst->reg, src->value);
+                    }
 
-void myass_destroy(MyAss *myass){
-    if(!myass){
-        return;
-    }
+                    break;
+                }case REGISTER_LOCATION_TYPE:{
+                    RegisterLocation *src = src_location->sub_location;
 
-    const Allocator *allocator = myass->allocator;
+                    myass_mov_r64_r64(myass, dst->reg, src->reg);
 
-    LZOHTABLE_DESTROY(myass->registers_keywords);
-    LZOHTABLE_DESTROY(myass->instructions_keywords);
-    lzbbuff_destroy(myass->bbuff);
-    MEMORY_DEALLOC(myass->arena_allocator_context, AllocatorContext, 1, allocator);
-    lzarena_destroy(myass->arena);
-    MEMORY_DEALLOC(myass, MyAss, 1, allocator);
+                    break;
+                }case MEMORY_LOCATION_TYPE:{
+                    MemoryLocation *src = src_location->sub_location;
+
+                    myass_mov_r64_m64(myass, dst->reg, src->base, src->displacement);
+
+                    break;
+                }default:{
+                    assert(0 && "Illegal location type");
+                }
+            }
+
+            break;
+        }case MEMORY_LOCATION_TYPE:{
+            MemoryLocation *dst = dst_location->sub_location;
+
+            switch (src_location->type){
+                case LITERAL_LOCATION_TYPE:{
+                    LiteralLocation *src = src_location->sub_location;
+
+                    if(instruction->src_token.type == QWORD_TYPE_TOKEN_TYPE){
+                        error(
+                            myass,
+                            &instruction->src_token,
+                            "Only 32 bits literals can be stored to memory, but got: '%.*s'",
+                            LEXEME(&instruction->src_token)
+                        );
+                    }
+
+                    myass_mov_m64_imm32(myass, dst->base, dst->displacement, (dword)src->value);
+
+                    break;
+                }case REGISTER_LOCATION_TYPE:{
+                    RegisterLocation *src = src_location->sub_location;
+
+                    myass_mov_m64_r64(myass, dst->base, dst->displacement, src->reg);
+
+                    break;
+                }case MEMORY_LOCATION_TYPE:{
+                    error(
+                        myass,
+                        &instruction->src_token,
+                        "'mov' takes one memory operand at most"
+                    );
+
+                    break;
+                }default:{
+                    assert(0 && "Illegal location type");
+                }
+            }
+
+            break;
+        }default:{
+            assert(0 && "Illegal location type");
+        }
+    }
 }
 
-void myass_print_as_hex(const MyAss *myass, int wprefix){
-    LZBBuff *bbuff = BBUFF;
+void assemble_pop_instruction(MyAss *myass, UnaryInstruction *instruction){
+	Location *dst_location = instruction->location;
 
-    lzbbuff_print_as_hex(bbuff, wprefix);
+	switch (dst_location->type) {
+		case REGISTER_LOCATION_TYPE:{
+			RegisterLocation *reg_location = dst_location->sub_location;
+
+			myass_pop_r64(myass, reg_location->reg);
+
+			break;
+		}default:{
+			assert(0 && "Illegal location type");
+		}
+	}
 }
 
-void myass_mov_r64_imm32(MyAss *myass, X64Register dst, dword src){
-    LZBBuff *bbuff = BBUFF;
+void assemble_push_instruction(MyAss *myass, UnaryInstruction *instruction){
+	Location *src_location = instruction->location;
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
-    lzbbuff_write_byte(bbuff, 0, 0xc7);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 0, dst));
-    lzbbuff_write_dword(bbuff, 0, src);
+	switch (src_location->type) {
+		case REGISTER_LOCATION_TYPE:{
+			RegisterLocation *reg_location = src_location->sub_location;
+
+			myass_push_r64(myass, reg_location->reg);
+
+			break;
+		}default:{
+			assert(0 && "Illegal location type");
+		}
+	}
 }
 
-void myass_mov_r64_r64(MyAss *myass, X64Register dst, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+void assemble_sub_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
+
+    switch (dst_location->type){
+        case REGISTER_LOCATION_TYPE:{
+            RegisterLocation *dst = dst_location->sub_location;
+
+            switch (src_location->type){
+                case LITERAL_LOCATION_TYPE:{
+                    LiteralLocation *src = src_location->sub_location;
+
+                    myass_sub_r64_imm32(myass, dst->reg, (dword)src->value);
+
+                    break;
+                }case REGISTER_LOCATION_TYPE:{
+                    RegisterLocation *src = src_location->sub_location;
+
+                    myass_sub_r64_r64(myass, dst->reg, src->reg);
+
+                    break;
+                }default:{
+                    assert(0 && "Illegal location type");
+                }
+            }
+
+            break;
+        }default:{
+            assert(0 && "Illegal location type");
+        }
+    }
+}
+
+inline void assemble_ret_instruction(MyAss *myass){
+    myass_ret(myass);
+}
+
+void assemble_tzcnt_instruction(MyAss *myass, BinaryInstruction *instruction){
+    RegisterLocation *dst = instruction->dst_location->sub_location;
+    RegisterLocation *src = instruction->src_location->sub_location;
+
+    myass_tzcnt_r64_r64(myass, dst->reg, src->reg);
+}
+
+void assemble_xor_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
+
+    switch (dst_location->type){
+        case REGISTER_LOCATION_TYPE:{
+            RegisterLocation *dst = dst_location->sub_location;
+
+            switch (src_location->type){
+                case LITERAL_LOCATION_TYPE:{
+                    LiteralLocation *src = src_location->sub_location;
+
+                    myass_xor_r64_imm32(myass, dst->reg, (dword)src->value);
+
+                    break;
+                }case REGISTER_LOCATION_TYPE:{
+                    RegisterLocation *src = src_location->sub_location;
+
+                    myass_xor_r64_r64(myass, dst->reg, src->reg);
+
+                    break;
+                }default:{
+                    assert(0 && "Illegal location type");
+                }
+            }
+
+            break;
+        }default:{
+            assert(0 && "Illegal location type");
+        }
+    }
+}
+
+void assemble_movdqu_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
+
+    if(dst_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *dst = dst_location->sub_location;
+
+        if(src_location->type == MEMORY_LOCATION_TYPE){
+            error(
+                myass,
+                &instruction->src_token,
+                "'%.*s' takes one memory operand at most",
+                LEXEME(&instruction->instruction_token)
+            );
+        }
+
+        VectorLocation *src = src_location->sub_location;
+
+        myass_movdqu_m128_xmm(myass, dst->base, dst->displacement, src->reg);
+
+        return;
+    }
+
+    VectorLocation *dst = dst_location->sub_location;
+
+    if(src_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *src = src_location->sub_location;
+
+        myass_movdqu_xmm_m128(myass, dst->reg, src->base, src->displacement);
+
+        return;
+    }
+
+    VectorLocation *src = src_location->sub_location;
+
+    myass_movdqu_xmm_xmm(myass, dst->reg, src->reg);
+}
+
+void assemble_movq_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
+
+    if(dst_location->type == REGISTER_LOCATION_TYPE){
+        RegisterLocation *dst = dst_location->sub_location;
+
+        if(src_location->type == REGISTER_LOCATION_TYPE){
+            error(
+                myass,
+                &instruction->instruction_token,
+                "'movq' needs an xmm register, between registers use 'mov'"
+            );
+        }
+
+        VectorLocation *src = src_location->sub_location;
+
+        myass_movq_r64_xmm(myass, dst->reg, src->reg);
+
+        return;
+    }
+
+    VectorLocation *dst = dst_location->sub_location;
+
+    if(src_location->type == REGISTER_LOCATION_TYPE){
+        RegisterLocation *src = src_location->sub_location;
+
+        myass_movq_xmm_r64(myass, dst->reg, src->reg);
+
+        return;
+    }
+
+    VectorLocation *src = src_location->sub_location;
+
+    myass_movq_xmm_xmm(myass, dst->reg, src->reg);
+}
+
+// Two operands SSE2 arithmetic: 'dst = dst op src'
+void assemble_sse_instruction(
+    MyAss *myass,
+    BinaryInstruction *instruction,
+    void (*xmm_xmm)(MyAss *myass, byte dst, byte src),
+    void (*xmm_m128)(MyAss *myass, byte dst, X64Register base, int32_t displacement)
+){
+    VectorLocation *dst = instruction->dst_location->sub_location;
+    Location *src_location = instruction->src_location;
+
+    if(src_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *src = src_location->sub_location;
+
+        xmm_m128(myass, dst->reg, src->base, src->displacement);
+
+        return;
+    }
+
+    VectorLocation *src = src_location->sub_location;
+
+    xmm_xmm(myass, dst->reg, src->reg);
+}
+
+void assemble_pmovmskb_instruction(MyAss *myass, BinaryInstruction *instruction){
+    RegisterLocation *dst = instruction->dst_location->sub_location;
+    VectorLocation *src = instruction->src_location->sub_location;
+
+    myass_pmovmskb_r32_xmm(myass, dst->reg, src->reg);
+}
+
+void assemble_vmovdqu_instruction(MyAss *myass, BinaryInstruction *instruction){
+    Location *dst_location = instruction->dst_location;
+    Location *src_location = instruction->src_location;
+
+    if(dst_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *dst = dst_location->sub_location;
+
+        if(src_location->type == MEMORY_LOCATION_TYPE){
+            error(
+                myass,
+                &instruction->src_token,
+                "'%.*s' takes one memory operand at most",
+                LEXEME(&instruction->instruction_token)
+            );
+        }
+
+        VectorLocation *src = src_location->sub_location;
+
+        myass_vmovdqu_m_v(myass, src->len, dst->base, dst->displacement, src->reg);
+
+        return;
+    }
+
+    VectorLocation *dst = dst_location->sub_location;
+
+    if(src_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *src = src_location->sub_location;
+
+        myass_vmovdqu_v_m(myass, dst->len, dst->reg, src->base, src->displacement);
+
+        return;
+    }
+
+    VectorLocation *src = src_location->sub_location;
+
+    if(src->len != dst->len){
+        error(
+            myass,
+            &instruction->src_token,
+            "Operands of '%.*s' must be all xmm or all ymm registers",
+            LEXEME(&instruction->instruction_token)
+        );
+    }
+
+    myass_vmovdqu_v_v(myass, dst->len, dst->reg, src->reg);
+}
+
+// Three operands VEX arithmetic: 'dst = src1 op src2'
+void assemble_vex_instruction(
+    MyAss *myass,
+    TernaryInstruction *instruction,
+    void (*v_v_v)(MyAss *myass, byte len, byte dst, byte src1, byte src2),
+    void (*v_v_m)(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement)
+){
+    VectorLocation *dst = instruction->dst_location->sub_location;
+    VectorLocation *src1 = instruction->src1_location->sub_location;
+    Location *src2_location = instruction->src2_location;
+    Token *mismatch_token = NULL;
+
+    if(src1->len != dst->len){
+        mismatch_token = &instruction->src1_token;
+    }else if(src2_location->type == VECTOR_LOCATION_TYPE &&
+             ((VectorLocation *)src2_location->sub_location)->len != dst->len){
+        mismatch_token = &instruction->src2_token;
+    }
+
+    if(mismatch_token){
+        error(
+            myass,
+            mismatch_token,
+            "Operands of '%.*s' must be all xmm or all ymm registers",
+            LEXEME(&instruction->instruction_token)
+        );
+    }
+
+    if(src2_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *src2 = src2_location->sub_location;
+
+        v_v_m(myass, dst->len, dst->reg, src1->reg, src2->base, src2->displacement);
+
+        return;
+    }
+
+    VectorLocation *src2 = src2_location->sub_location;
+
+    v_v_v(myass, dst->len, dst->reg, src1->reg, src2->reg);
+}
+
+void assemble_vpbroadcast_instruction(
+    MyAss *myass,
+    BinaryInstruction *instruction,
+    void (*v_xmm)(MyAss *myass, byte len, byte dst, byte src),
+    void (*v_m)(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement)
+){
+    VectorLocation *dst = instruction->dst_location->sub_location;
+    Location *src_location = instruction->src_location;
+
+    if(src_location->type == MEMORY_LOCATION_TYPE){
+        MemoryLocation *src = src_location->sub_location;
+
+        v_m(myass, dst->len, dst->reg, src->base, src->displacement);
+
+        return;
+    }
+
+    VectorLocation *src = src_location->sub_location;
+
+    v_xmm(myass, dst->len, dst->reg, src->reg);
+}
+
+void assemble_vpmovmskb_instruction(MyAss *myass, BinaryInstruction *instruction){
+    RegisterLocation *dst = instruction->dst_location->sub_location;
+    VectorLocation *src = instruction->src_location->sub_location;
+
+    myass_vpmovmskb_r32_v(myass, src->len, dst->reg, src->reg);
+}
+
+void assemble_instruction(MyAss *myass, Instruction *instruction){
+    switch (instruction->type){
+        case LABEL_INSTRUCTION_TYPE:{
+       		LZOHTable *symbols = myass->symbols;
+
+         	EmptyInstruction *label_instruction = instruction->sub_instruction;
+            Token *label_token = &label_instruction->token;
+
+            LabelSymbol *label_symbol = MEMORY_NEW(
+                ALLOCATOR,
+                LabelSymbol,
+                lzbbuff_used_bytes(myass->bbuff)
+            );
+            Symbol symbol = {
+                .type = LABEL_SYMBOL_TYPE,
+                .sub_symbol = label_symbol
+            };
+
+            size_t key_size = label_token->len;
+            const char *key = lexer_lexeme(myass->lexer, label_token);
+
+            if(lzohtable_lookup(key_size, key, symbols, NULL)){
+           		error(
+             		myass,
+               		label_token,
+               		"Already exists symbol '%.*s'",
+                 	(int)key_size,
+                 	key
+             	);
+            }
+
+            lzohtable_put_ckv(
+                key_size,
+                key,
+                sizeof(Symbol),
+                &symbol,
+                myass->symbols,
+                NULL
+            );
+
+            break;
+        }case ALIGN_INSTRUCTION_TYPE:{
+            assemble_align_instruction(myass, instruction->sub_instruction);
+            break;
+        }case COUNT_INSTRUCTION_TYPE:{
+            CountInstruction *count_instruction = instruction->sub_instruction;
+
+            myass_inc_m64_abs32(
+                myass,
+                (int32_t)(intptr_t)(myass->counters + count_instruction->index),
+                myass->atomic_counters
+            );
+
+            break;
+        }case ADD_INSTRUCTION_TYPE:{
+            assemble_add_instruction(myass, instruction->sub_instruction);
+            break;
+        }case CALL_INSTRUCTION_TYPE:{
+            assemble_call_instruction(myass, instruction->sub_instruction);
+            break;
+        }case CMP_INSTRUCTION_TYPE:{
+            assemble_cmp_instruction(myass, instruction->sub_instruction);
+            break;
+        }case IDIV_INSTRUCTION_TYPE:{
+            assemble_idiv_instruction(myass, instruction->sub_instruction);
+            break;
+        }case JE_INSTRUCTION_TYPE:
+         case JNE_INSTRUCTION_TYPE:
+         case JG_INSTRUCTION_TYPE:
+         case JL_INSTRUCTION_TYPE:
+         case JGE_INSTRUCTION_TYPE:
+         case JLE_INSTRUCTION_TYPE:{
+            assemble_jcc_instructions(
+            	myass,
+             	instruction->type,
+              	instruction->sub_instruction
+            );
+            break;
+        }case JMP_INSTRUCTION_TYPE:{
+            assemble_jmp_instruction(myass, instruction->sub_instruction);
+            break;
+        }case MOV_INSTRUCTION_TYPE:{
+            assemble_mov_instruction(myass, instruction->sub_instruction);
+            break;
+        }case POP_INSTRUCTION_TYPE:{
+            assemble_pop_instruction(myass, instruction->sub_instruction);
+            break;
+        }case PUSH_INSTRUCTION_TYPE:{
+            assemble_push_instruction(myass, instruction->sub_instruction);
+            break;
+        }case IMUL_INSTRUCTION_TYPE:{
+            assemble_imul_instruction(myass, instruction->sub_instruction);
+            break;
+        }case SUB_INSTRUCTION_TYPE:{
+            assemble_sub_instruction(myass, instruction->sub_instruction);
+            break;
+        }case RET_INSTRUCTION_TYPE:{
+            assemble_ret_instruction(myass);
+            break;
+        }case TZCNT_INSTRUCTION_TYPE:{
+            assemble_tzcnt_instruction(myass, instruction->sub_instruction);
+            break;
+        }case XOR_INSTRUCTION_TYPE:{
+            assemble_xor_instruction(myass, instruction->sub_instruction);
+            break;
+        }case MOVDQU_INSTRUCTION_TYPE:{
+            assemble_movdqu_instruction(myass, instruction->sub_instruction);
+            break;
+        }case MOVQ_INSTRUCTION_TYPE:{
+            assemble_movq_instruction(myass, instruction->sub_instruction);
+            break;
+        }case PADDD_INSTRUCTION_TYPE:{
+            assemble_sse_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_paddd_xmm_xmm,
+                myass_paddd_xmm_m128
+            );
+            break;
+        }case PADDQ_INSTRUCTION_TYPE:{
+            assemble_sse_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_paddq_xmm_xmm,
+                myass_paddq_xmm_m128
+            );
+            break;
+        }case PCMPEQB_INSTRUCTION_TYPE:{
+            assemble_sse_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_pcmpeqb_xmm_xmm,
+                myass_pcmpeqb_xmm_m128
+            );
+            break;
+        }case PMOVMSKB_INSTRUCTION_TYPE:{
+            assemble_pmovmskb_instruction(myass, instruction->sub_instruction);
+            break;
+        }case PXOR_INSTRUCTION_TYPE:{
+            assemble_sse_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_pxor_xmm_xmm,
+                myass_pxor_xmm_m128
+            );
+            break;
+        }case VMOVDQU_INSTRUCTION_TYPE:{
+            assemble_vmovdqu_instruction(myass, instruction->sub_instruction);
+            break;
+        }case VPADDD_INSTRUCTION_TYPE:{
+            assemble_vex_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpaddd_v_v_v,
+                myass_vpaddd_v_v_m
+            );
+            break;
+        }case VPADDQ_INSTRUCTION_TYPE:{
+            assemble_vex_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpaddq_v_v_v,
+                myass_vpaddq_v_v_m
+            );
+            break;
+        }case VPBROADCASTB_INSTRUCTION_TYPE:{
+            assemble_vpbroadcast_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpbroadcastb_v_xmm,
+                myass_vpbroadcastb_v_m
+            );
+            break;
+        }case VPBROADCASTD_INSTRUCTION_TYPE:{
+            assemble_vpbroadcast_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpbroadcastd_v_xmm,
+                myass_vpbroadcastd_v_m
+            );
+            break;
+        }case VPBROADCASTQ_INSTRUCTION_TYPE:{
+            assemble_vpbroadcast_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpbroadcastq_v_xmm,
+                myass_vpbroadcastq_v_m
+            );
+            break;
+        }case VPCMPEQB_INSTRUCTION_TYPE:{
+            assemble_vex_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpcmpeqb_v_v_v,
+                myass_vpcmpeqb_v_v_m
+            );
+            break;
+        }case VPMOVMSKB_INSTRUCTION_TYPE:{
+            assemble_vpmovmskb_instruction(myass, instruction->sub_instruction);
+            break;
+        }case VPXOR_INSTRUCTION_TYPE:{
+            assemble_vex_instruction(
+                myass,
+                instruction->sub_instruction,
+                myass_vpxor_v_v_v,
+                myass_vpxor_v_v_m
+            );
+            break;
+        }case VZEROUPPER_INSTRUCTION_TYPE:{
+            myass_vzeroupper(myass);
+            break;
+        }
+    }
+}
+
+void assemble_instructions(MyAss *myass, DynArr *instructions){
+	LZBBuff *bbuff = BBUFF;
+	size_t len = DYNARR_LEN(instructions);
+    LineTable *line_table = myass->flags & MYASS_FLAG_LINE_TABLE ? myass->line_table : NULL;
+
+    if(line_table){
+        line_table_reset(line_table);
+    }
+
+    myass->stencil_patches_len = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+        size_t used_before = lzbbuff_used_bytes(bbuff);
+
+        assemble_instruction(myass, instruction);
+
+        size_t used_after = lzbbuff_used_bytes(bbuff);
+        size_t instruction_len = used_after - used_before;
+
+        instruction->offset = used_before;
+        instruction->len = instruction_len;
+
+        if(myass->stencil){
+            record_holes(myass, instruction);
+        }
+
+        if(instruction->type != ALIGN_INSTRUCTION_TYPE && instruction_len > myass->largest_instruction){
+            myass->largest_instruction = instruction_len;
+        }
+
+        // Padding inserted by loop alignment has no source and
+        // is covered by the instruction before it
+        if(line_table && instruction_len > 0 && instruction->source_len > 0){
+            // Layout may have moved the instruction away from its
+            // neighbours in the source, so its line is searched for
+            Token token = {.offset = instruction->source_offset};
+            TokenLocation location = lexer_token_location(myass->lexer, &token);
+
+            if(line_table_append(
+                line_table,
+                (uint32_t)used_before,
+                (uint32_t)location.start_line,
+                (uint32_t)location.start_col
+            )){
+                out_of_memory(myass);
+            }
+        }
+    }
+
+    if(line_table){
+        line_table_end(line_table, (uint32_t)lzbbuff_used_bytes(bbuff));
+    }
+}
+
+// Lays out 'instructions' again from scratch, once a pass changed them
+void reassemble_instructions(MyAss *myass, DynArr *instructions){
+    lzbbuff_restart(BBUFF);
+
+    myass->largest_instruction = 0;
+    myass->symbols = MEMORY_LZOHTABLE(ALLOCATOR);
+    myass->jumps_to_resolve = MEMORY_LZSTACK(ALLOCATOR);
+    myass->constants = MEMORY_LZOHTABLE(ALLOCATOR);
+    myass->constant_values = MEMORY_DYNARR_TYPE(ALLOCATOR, qword);
+    myass->constant_loads = MEMORY_LZSTACK(ALLOCATOR);
+
+    assemble_instructions(myass, instructions);
+}
+
+// Every label targeted by a backward jcc/jmp is taken as a loop head. A new
+// instructions list is returned with budget limited alignments in front of
+// them, or NULL when there is no loop head. Layout must be re-run after it
+DynArr *align_loop_heads(MyAss *myass, DynArr *instructions){
+    LZOHTable *symbols = myass->symbols;
+    LZOHTable *loop_heads = MEMORY_LZOHTABLE(ALLOCATOR);
+
+    for (LZStackNode *node = myass->jumps_to_resolve->top; node; node = node->prev){
+        Jmp *jmp = node->value;
+        Token *label_token = jmp->label_token;
+        Symbol *symbol = NULL;
+
+        if(jmp->type == CALL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        if(!lzohtable_lookup(
+            label_token->len,
+            lexer_lexeme(myass->lexer, label_token),
+            symbols,
+            (void **)(&symbol)
+        )){
+            // Unknown symbols are reported by 'resolve_jumps'
+            continue;
+        }
+
+        LabelSymbol *label_symbol = symbol->sub_symbol;
+        size_t label_offset = label_symbol->location;
+
+        if(label_offset < jmp->offset){
+            lzohtable_put_ck(sizeof(size_t), &label_offset, NULL, loop_heads, NULL);
+        }
+    }
+
+    if(loop_heads->n == 0){
+        return NULL;
+    }
+
+    size_t len = DYNARR_LEN(instructions);
+    DynArr *aligned_instructions = dynarr_create_by(
+        sizeof(uintptr_t),
+        len + loop_heads->n,
+        (DynArrAllocator *)ALLOCATOR
+    );
+    Instruction *previous = NULL;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        // Only the first label of a group sharing the same offset gets the padding
+        int is_group_start = !previous ||
+            previous->type != LABEL_INSTRUCTION_TYPE ||
+            previous->offset != instruction->offset;
+
+        if(instruction->type == LABEL_INSTRUCTION_TYPE &&
+           is_group_start &&
+           lzohtable_lookup(sizeof(size_t), &instruction->offset, loop_heads, NULL)
+        ){
+            EmptyInstruction *label_instruction = instruction->sub_instruction;
+            AlignInstruction *align_instruction = MEMORY_NEW(
+                ALLOCATOR,
+                AlignInstruction,
+                myass->loop_alignment,
+                myass->loop_max_padding,
+                label_instruction->token
+            );
+
+            dynarr_insert_ptr(
+                MEMORY_NEW(ALLOCATOR, Instruction, 0, 0, ALIGN_INSTRUCTION_TYPE, align_instruction, 0, 0),
+                aligned_instructions
+            );
+        }
+
+        dynarr_insert_ptr(instruction, aligned_instructions);
+
+        previous = instruction;
+    }
+
+    return aligned_instructions;
+}
+
+// Labels and the alignment padding between them make one group, whose
+// counter goes after the last of them, so jumps to any of them run it.
+// Returns a new instructions list
+DynArr *insert_block_counters(MyAss *myass, DynArr *instructions){
+    size_t len = DYNARR_LEN(instructions);
+    DynArr *counted_instructions = dynarr_create_by(sizeof(uintptr_t), len * 2, (DynArrAllocator *)ALLOCATOR);
+    size_t counters_len = 0;
+    Token *group_token = NULL; // first label of the group waiting for its counter
+
+    for (size_t i = 0; i <= len; i++){
+        Instruction *instruction = i < len ? DYNARR_GET_PTR_AS(Instruction, i, instructions) : NULL;
+
+        if(instruction &&
+           (instruction->type == LABEL_INSTRUCTION_TYPE || instruction->type == ALIGN_INSTRUCTION_TYPE)){
+            if(!group_token && instruction->type == LABEL_INSTRUCTION_TYPE){
+                group_token = &((EmptyInstruction *)instruction->sub_instruction)->token;
+            }
+
+            dynarr_insert_ptr(instruction, counted_instructions);
+
+            continue;
+        }
+
+        if(group_token){
+            if(counters_len == myass->counters_capacity){
+                error(
+                    myass,
+                    group_token,
+                    "Out of block counters, only %zu are available",
+                    myass->counters_capacity
+                );
+            }
+
+            CountInstruction *count_instruction = MEMORY_NEW(ALLOCATOR, CountInstruction, counters_len++);
+
+            dynarr_insert_ptr(
+                MEMORY_NEW(ALLOCATOR, Instruction, 0, 0, COUNT_INSTRUCTION_TYPE, count_instruction, 0, 0),
+                counted_instructions
+            );
+
+            group_token = NULL;
+        }
+
+        if(instruction){
+            dynarr_insert_ptr(instruction, counted_instructions);
+        }
+    }
+
+    myass->counters_len = counters_len;
+
+    return counted_instructions;
+}
+
+// Records the call so 'myass_link' can make it direct. The record
+// lives in the outer allocator so it survives the arena
+void link_external_call(MyAss *myass, size_t offset, ExternalSymbol *external){
+    const Allocator *allocator = myass->allocator;
+    dword displacement = (dword)(((dword)external->stub_offset) - ((dword)offset));
+
+    lzbbuff_overwrite_dword(BBUFF, 0, offset - 4, displacement);
+
+    if(myass->external_calls_len == myass->external_calls_capacity){
+        size_t new_capacity = myass->external_calls_capacity == 0 ? 16 : myass->external_calls_capacity * 2;
+        ExternalCall *external_calls = MEMORY_REALLOC(
+            ExternalCall,
+            myass->external_calls_capacity,
+            new_capacity,
+            myass->external_calls,
+            allocator
+        );
+
+        if(!external_calls){
+            out_of_memory(myass);
+        }
+
+        myass->external_calls = external_calls;
+        myass->external_calls_capacity = new_capacity;
+    }
+
+    myass->external_calls[myass->external_calls_len++] = (ExternalCall){
+        .offset = (uint32_t)offset,
+        .stub_offset = (uint32_t)external->stub_offset,
+        .address = external->address
+    };
+}
+
+void resolve_jumps(MyAss *myass){
+    LZOHTable *symbols = myass->symbols;
+    LZStack *jumps_to_resolve = myass->jumps_to_resolve;
+    LZBBuff *bbuff = BBUFF;
+
+    while (lzstack_peek(jumps_to_resolve)){
+        Jmp *jmp = lzstack_pop(jumps_to_resolve);
+        size_t jmp_offset = jmp->offset;
+        Token *label_token = jmp->label_token;
+        const char *name = lexer_lexeme(myass->lexer, label_token);
+        Symbol *symbol = NULL;
+        ExternalSymbol *external = NULL;
+
+        if(!lzohtable_lookup(label_token->len, name, symbols, (void **)(&symbol))){
+            if(jmp->type == CALL_INSTRUCTION_TYPE &&
+               lzohtable_lookup(label_token->len, name, myass->externals, (void **)(&external))){
+                link_external_call(myass, jmp_offset, external);
+                continue;
+            }
+
+	        error(
+	        	myass,
+				label_token,
+	         	"Unknown symbol '%.*s'",
+	            LEXEME(label_token)
+	        );
+        }
+
+        switch (symbol->type){
+            case LABEL_SYMBOL_TYPE:{
+                LabelSymbol *label_symbol = symbol->sub_symbol;
+                size_t label_offset = label_symbol->location;
+                dword displacement = (dword)(((dword)label_offset) - ((dword)jmp_offset));
+
+                lzbbuff_overwrite_dword(bbuff, 0, jmp_offset - 4, displacement);
+
+                break;
+            }default:{
+           		assert(0 && "Illegal symbol type");
+            }
+        }
+    }
+}
+
+// The map lives in the outer allocator so it survives the arena
+void build_listing(MyAss *myass, DynArr *instructions){
+    const Allocator *allocator = myass->allocator;
+    size_t len = DYNARR_LEN(instructions);
+    size_t entries_len = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->len > 0 || instruction->type == LABEL_INSTRUCTION_TYPE){
+            entries_len++;
+        }
+    }
+
+    if(entries_len > myass->listing_capacity){
+        MyAssListingEntry *listing = MEMORY_REALLOC(
+            MyAssListingEntry,
+            myass->listing_capacity,
+            entries_len,
+            myass->listing,
+            allocator
+        );
+
+        if(!listing){
+            out_of_memory(myass);
+        }
+
+        myass->listing = listing;
+        myass->listing_capacity = entries_len;
+    }
+
+    MyAssListingEntry *listing = myass->listing;
+    size_t entry_index = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->len == 0 && instruction->type != LABEL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        listing[entry_index++] = (MyAssListingEntry){
+            .offset = (uint32_t)instruction->offset,
+            .len = (uint32_t)instruction->len,
+            .source_offset = instruction->source_offset,
+            .source_len = instruction->source_len
+        };
+    }
+
+    myass->listing_len = entries_len;
+}
+
+int compare_symbol_names(const void *a, const void *b){
+    const SymbolName *a_symbol = a;
+    const SymbolName *b_symbol = b;
+    uint32_t len = a_symbol->name_len < b_symbol->name_len ? a_symbol->name_len : b_symbol->name_len;
+    int result = memcmp(a_symbol->name, b_symbol->name, len);
+
+    if(result != 0){
+        return result;
+    }
+
+    return a_symbol->name_len < b_symbol->name_len ? -1 : a_symbol->name_len > b_symbol->name_len;
+}
+
+// Like the listing map, the frozen symbols live in the outer allocator
+void freeze_symbols(MyAss *myass, DynArr *instructions){
+    const Allocator *allocator = myass->allocator;
+    size_t len = DYNARR_LEN(instructions);
+    size_t symbols_len = 0;
+    size_t names_len = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->type != LABEL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        EmptyInstruction *label_instruction = instruction->sub_instruction;
+
+        symbols_len++;
+        names_len += label_instruction->token.len;
+    }
+
+    if(symbols_len > myass->frozen_symbols_capacity){
+        FrozenSymbol *frozen_symbols = MEMORY_REALLOC(
+            FrozenSymbol,
+            myass->frozen_symbols_capacity,
+            symbols_len,
+            myass->frozen_symbols,
+            allocator
+        );
+
+        if(!frozen_symbols){
+            out_of_memory(myass);
+        }
+
+        myass->frozen_symbols = frozen_symbols;
+        myass->frozen_symbols_capacity = symbols_len;
+    }
+
+    if(symbols_len > myass->symbols_by_name_capacity){
+        SymbolName *symbols_by_name = MEMORY_REALLOC(
+            SymbolName,
+            myass->symbols_by_name_capacity,
+            symbols_len,
+            myass->symbols_by_name,
+            allocator
+        );
+
+        if(!symbols_by_name){
+            out_of_memory(myass);
+        }
+
+        myass->symbols_by_name = symbols_by_name;
+        myass->symbols_by_name_capacity = symbols_len;
+    }
+
+    if(names_len > myass->symbol_names_capacity){
+        char *symbol_names = MEMORY_REALLOC(
+            char,
+            myass->symbol_names_capacity,
+            names_len,
+            myass->symbol_names,
+            allocator
+        );
+
+        if(!symbol_names){
+            out_of_memory(myass);
+        }
+
+        myass->symbol_names = symbol_names;
+        myass->symbol_names_capacity = names_len;
+    }
+
+    size_t symbol_index = 0;
+    size_t names_offset = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->type != LABEL_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        EmptyInstruction *label_instruction = instruction->sub_instruction;
+        Token *label_token = &label_instruction->token;
+        char *name = myass->symbol_names + names_offset;
+
+        memcpy(name, lexer_lexeme(myass->lexer, label_token), label_token->len);
+
+        myass->frozen_symbols[symbol_index] = (FrozenSymbol){
+            .offset = (uint32_t)instruction->offset,
+            .name_offset = (uint32_t)names_offset,
+            .name_len = label_token->len
+        };
+        myass->symbols_by_name[symbol_index] = (SymbolName){
+            .name = name,
+            .name_len = label_token->len,
+            .offset = (uint32_t)instruction->offset
+        };
+
+        symbol_index++;
+        names_offset += label_token->len;
+    }
+
+    if(symbols_len > 0){
+        qsort(myass->symbols_by_name, symbols_len, sizeof(SymbolName), compare_symbol_names);
+    }
+
+    myass->frozen_symbols_len = symbols_len;
+}
+
+// Maps every counter to the first label of the group in front of it
+void freeze_counters(MyAss *myass, DynArr *instructions){
+    const Allocator *allocator = myass->allocator;
+    size_t len = DYNARR_LEN(instructions);
+    uint32_t symbol_index = 0;
+    uint32_t group_symbol = NO_SYMBOL;
+
+    myass->counter_symbols_len = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->type == LABEL_INSTRUCTION_TYPE){
+            if(group_symbol == NO_SYMBOL){
+                group_symbol = symbol_index;
+            }
+
+            symbol_index++;
+
+            continue;
+        }
+
+        if(instruction->type == ALIGN_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        if(instruction->type == COUNT_INSTRUCTION_TYPE){
+            if(myass->counter_symbols_len == myass->counter_symbols_capacity){
+                size_t capacity = myass->counter_symbols_capacity == 0 ? 16 : myass->counter_symbols_capacity * 2;
+                CounterSymbol *counter_symbols = MEMORY_REALLOC(
+                    CounterSymbol,
+                    myass->counter_symbols_capacity,
+                    capacity,
+                    myass->counter_symbols,
+                    allocator
+                );
+
+                if(!counter_symbols){
+                    out_of_memory(myass);
+                }
+
+                myass->counter_symbols = counter_symbols;
+                myass->counter_symbols_capacity = capacity;
+            }
+
+            CountInstruction *count_instruction = instruction->sub_instruction;
+
+            myass->counter_symbols[myass->counter_symbols_len++] = (CounterSymbol){
+                .offset = (uint32_t)instruction->offset,
+                .index = (uint32_t)count_instruction->index,
+                .symbol = group_symbol
+            };
+        }
+
+        group_symbol = NO_SYMBOL;
+    }
+}
+
+// Functions start at every label not starting with '.'
+size_t next_function(const MyAss *myass, size_t from){
+    for (; from < myass->frozen_symbols_len; from++){
+        FrozenSymbol *symbol = &myass->frozen_symbols[from];
+
+        if(myass->symbol_names[symbol->name_offset] != '.'){
+            break;
+        }
+    }
+
+    return from;
+}
+
+// A function runs up to the next one, or to the constant pool
+PerfSymbol function_symbol(const MyAss *myass, size_t index, uintptr_t address){
+    FrozenSymbol *symbol = &myass->frozen_symbols[index];
+    size_t next_index = next_function(myass, index + 1);
+    size_t end = next_index < myass->frozen_symbols_len ?
+        myass->frozen_symbols[next_index].offset :
+        myass->text_len;
+
+    return (PerfSymbol){
+        .name = myass->symbol_names + symbol->name_offset,
+        .name_len = symbol->name_len,
+        .address = address + symbol->offset,
+        .size = end - symbol->offset
+    };
+}
+
+// Sites are the last 5 bytes of their instruction, after any padding
+void build_patch_sites(MyAss *myass, DynArr *instructions){
+    const Allocator *allocator = myass->allocator;
+    size_t len = DYNARR_LEN(instructions);
+    size_t sites_len = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->type == CALL_INSTRUCTION_TYPE || instruction->type == JMP_INSTRUCTION_TYPE){
+            sites_len++;
+        }
+    }
+
+    if(sites_len > myass->patch_sites_capacity){
+        MyAssPatchSite *patch_sites = MEMORY_REALLOC(
+            MyAssPatchSite,
+            myass->patch_sites_capacity,
+            sites_len,
+            myass->patch_sites,
+            allocator
+        );
+
+        if(!patch_sites){
+            out_of_memory(myass);
+        }
+
+        myass->patch_sites = patch_sites;
+        myass->patch_sites_capacity = sites_len;
+    }
+
+    size_t site_index = 0;
+
+    for (size_t i = 0; i < len; i++){
+        Instruction *instruction = DYNARR_GET_PTR_AS(Instruction, i, instructions);
+
+        if(instruction->type != CALL_INSTRUCTION_TYPE && instruction->type != JMP_INSTRUCTION_TYPE){
+            continue;
+        }
+
+        myass->patch_sites[site_index++] = (MyAssPatchSite){
+            .offset = (uint32_t)(instruction->offset + instruction->len - 5),
+            .type = instruction->type == CALL_INSTRUCTION_TYPE ? MYASS_CALL_PATCH_SITE : MYASS_JMP_PATCH_SITE
+        };
+    }
+
+    myass->patch_sites_len = sites_len;
+}
+
+// Writes a short jump when 'label' is bound and within rel8 range.
+// Returns 1 when the caller has to write a rel32 instead
+int jump_to_bound_label(MyAss *myass, byte short_opcode, Label *label){
+    LZBBuff *bbuff = BBUFF;
+
+    if(label->offset == UNBOUND_LABEL){
+        return 1;
+    }
+
+    int64_t displacement = (int64_t)label->offset - (int64_t)(lzbbuff_used_bytes(bbuff) + 2);
+
+    if(displacement < INT8_MIN){
+        return 1;
+    }
+
+    lzbbuff_write_byte(bbuff, 0, short_opcode);
+    lzbbuff_write_byte(bbuff, 0, (byte)displacement);
+
+    return 0;
+}
+
+// Sets the rel32 just written to reach 'label', or chains it to be
+// patched by 'myass_label_bind'. Fixups live in the outer allocator,
+// returns 1 when it is out of memory
+int add_label_fixup(MyAss *myass, Label *label){
+    LZBBuff *bbuff = BBUFF;
+    size_t offset = lzbbuff_used_bytes(bbuff);
+
+    if(label->offset != UNBOUND_LABEL){
+        lzbbuff_overwrite_dword(bbuff, 0, offset - 4, (dword)(label->offset - (uint32_t)offset));
+        return 0;
+    }
+
+    if(myass->label_fixups_len == myass->label_fixups_capacity){
+        const Allocator *allocator = myass->allocator;
+        size_t new_capacity = myass->label_fixups_capacity == 0 ? 64 : myass->label_fixups_capacity * 2;
+        LabelFixup *label_fixups = MEMORY_REALLOC(
+            LabelFixup,
+            myass->label_fixups_capacity,
+            new_capacity,
+            myass->label_fixups,
+            allocator
+        );
+
+        if(!label_fixups){
+            return 1;
+        }
+
+        myass->label_fixups = label_fixups;
+        myass->label_fixups_capacity = new_capacity;
+    }
+
+    myass->label_fixups[myass->label_fixups_len] = (LabelFixup){
+        .offset = (uint32_t)offset,
+        .next = label->fixups
+    };
+    label->fixups = (uint32_t)myass->label_fixups_len++;
+
+    return 0;
+}
+
+int add_label_count(MyAss *myass, const char *name, size_t name_len, uint64_t count){
+    uint64_t *label_count = NULL;
+
+    if(!myass->label_counts){
+        myass->label_counts = MEMORY_LZOHTABLE(myass->allocator);
+
+        if(!myass->label_counts){
+            return 1;
+        }
+    }
+
+    if(lzohtable_lookup(name_len, name, myass->label_counts, (void **)(&label_count))){
+        *label_count += count;
+        return 0;
+    }
+
+    return lzohtable_put_ckv(name_len, name, sizeof(uint64_t), &count, myass->label_counts, NULL);
+}
+
+//------------------------------------------------------------------------------------//
+//                               PUBLIC IMPLEMENTATION                                //
+//------------------------------------------------------------------------------------//
+MyAss *myass_create(const Allocator *allocator){
+    LZOHTable *registers_keywords = create_registers_keywords(allocator);
+    LZOHTable *instructions_keywords = create_instructions_keywords(allocator);
+    LZBBuff *bbuff = lzbbuff_create(8192, (LZBBuffAllocator *)allocator);
+    LZArena *arena = lzarena_create((LZArenaAllocator *)allocator);
+    AllocatorContext *allocator_context = MEMORY_ALLOC(AllocatorContext, 1, allocator);
+    MyAss *myass = MEMORY_ALLOC(MyAss, 1, allocator);
+
+    if(!registers_keywords || !instructions_keywords || !bbuff || !arena || !allocator_context || !myass){
+        LZOHTABLE_DESTROY(registers_keywords);
+        LZOHTABLE_DESTROY(instructions_keywords);
+        lzbbuff_destroy(bbuff);
+        lzarena_destroy(arena);
+        MEMORY_DEALLOC(allocator_context, AllocatorContext, 1, allocator);
+        MEMORY_DEALLOC(myass, MyAss, 1, allocator);
+
+        return NULL;
+    }
+
+    allocator_context->err_buf = &myass->err_buf;
+    allocator_context->behind_allocator = arena;
+
+    myass->registers_keywords = registers_keywords;
+    myass->instructions_keywords = instructions_keywords;
+    myass->largest_instruction = 0;
+    myass->simplified_bytes = 0;
+    myass->loop_alignment = 0;
+    myass->loop_max_padding = 0;
+    myass->flags = 0;
+    myass->source = NULL;
+    myass->listing = NULL;
+    myass->listing_len = 0;
+    myass->listing_capacity = 0;
+    myass->line_table = NULL;
+    myass->frozen_symbols = NULL;
+    myass->symbols_by_name = NULL;
+    myass->symbols_by_name_capacity = 0;
+    myass->frozen_symbols_len = 0;
+    myass->frozen_symbols_capacity = 0;
+    myass->symbol_names = NULL;
+    myass->symbol_names_capacity = 0;
+    myass->patch_sites = NULL;
+    myass->patch_sites_len = 0;
+    myass->patch_sites_capacity = 0;
+    myass->resolver = NULL;
+    myass->resolver_context = NULL;
+    myass->label_counts = NULL;
+    myass->counters = NULL;
+    myass->counters_capacity = 0;
+    myass->counters_len = 0;
+    myass->atomic_counters = 0;
+    myass->counter_symbols = NULL;
+    myass->counter_symbols_len = 0;
+    myass->counter_symbols_capacity = 0;
+    myass->external_calls = NULL;
+    myass->external_calls_len = 0;
+    myass->external_calls_capacity = 0;
+    myass->labels = NULL;
+    myass->labels_len = 0;
+    myass->labels_capacity = 0;
+    myass->label_fixups = NULL;
+    myass->label_fixups_len = 0;
+    myass->label_fixups_capacity = 0;
+    myass->stencil = 0;
+    myass->stencil_patches = NULL;
+    myass->stencil_patches_len = 0;
+    myass->stencil_patches_capacity = 0;
+    myass->text_len = 0;
+    myass->stubs_len = 0;
+    myass->pool_offset = 0;
+    myass->pool_len = 0;
+    myass->instructions = NULL;
+    myass->symbols = NULL;
+    myass->jumps_to_resolve = NULL;
+    myass->externals = NULL;
+    myass->bbuff = bbuff;
+    myass->lexer = NULL;
+    myass->arena = arena;
+    myass->arena_allocator_context = allocator_context;
+    myass->allocator = allocator;
+
+    MEMORY_INIT_ALLOCATOR(
+        allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &myass->arena_allocator
+    );
+
+    return myass;
+}
+
+void myass_destroy(MyAss *myass){
+    if(!myass){
+        return;
+    }
+
+    const Allocator *allocator = myass->allocator;
+
+    LZOHTABLE_DESTROY(myass->registers_keywords);
+    LZOHTABLE_DESTROY(myass->instructions_keywords);
+    LZOHTABLE_DESTROY(myass->label_counts);
+    lzbbuff_destroy(myass->bbuff);
+    MEMORY_DEALLOC(myass->listing, MyAssListingEntry, myass->listing_capacity, allocator);
+    line_table_destroy(myass->line_table);
+    MEMORY_DEALLOC(myass->frozen_symbols, FrozenSymbol, myass->frozen_symbols_capacity, allocator);
+    MEMORY_DEALLOC(myass->symbols_by_name, SymbolName, myass->symbols_by_name_capacity, allocator);
+    MEMORY_DEALLOC(myass->symbol_names, char, myass->symbol_names_capacity, allocator);
+    MEMORY_DEALLOC(myass->patch_sites, MyAssPatchSite, myass->patch_sites_capacity, allocator);
+    MEMORY_DEALLOC(myass->external_calls, ExternalCall, myass->external_calls_capacity, allocator);
+    MEMORY_DEALLOC(myass->labels, Label, myass->labels_capacity, allocator);
+    MEMORY_DEALLOC(myass->label_fixups, LabelFixup, myass->label_fixups_capacity, allocator);
+    MEMORY_DEALLOC(myass->stencil_patches, StencilPatch, myass->stencil_patches_capacity, allocator);
+    MEMORY_DEALLOC(myass->counter_symbols, CounterSymbol, myass->counter_symbols_capacity, allocator);
+    MEMORY_DEALLOC(myass->arena_allocator_context, AllocatorContext, 1, allocator);
+    lzarena_destroy(myass->arena);
+    MEMORY_DEALLOC(myass, MyAss, 1, allocator);
+}
+
+const byte *myass_code(const MyAss *myass, size_t *out_len){
+    LZBBuff *bbuff = BBUFF;
+
+    *out_len = lzbbuff_used_bytes(bbuff);
+
+    return bbuff->raw_buff;
+}
+
+int myass_symbol_offset(const MyAss *myass, const char *name, size_t *out_offset){
+    if(myass->frozen_symbols_len == 0){
+        return 1;
+    }
+
+    SymbolName key = {.name = name, .name_len = (uint32_t)strlen(name), .offset = 0};
+    SymbolName *symbol = bsearch(
+        &key,
+        myass->symbols_by_name,
+        myass->frozen_symbols_len,
+        sizeof(SymbolName),
+        compare_symbol_names
+    );
+
+    if(!symbol){
+        return 1;
+    }
+
+    *out_offset = symbol->offset;
+
+    return 0;
+}
+
+int myass_symbol_next(const MyAss *myass, size_t *iterator, MyAssSymbol *out_symbol){
+    if(*iterator >= myass->frozen_symbols_len){
+        return 1;
+    }
+
+    FrozenSymbol *symbol = &myass->frozen_symbols[(*iterator)++];
+
+    *out_symbol = (MyAssSymbol){
+        .name = myass->symbol_names + symbol->name_offset,
+        .name_len = symbol->name_len,
+        .offset = symbol->offset
+    };
+
+    return 0;
+}
+
+int myass_perf_map(const MyAss *myass, uintptr_t address){
+    const Allocator *allocator = myass->allocator;
+    size_t functions_len = 0;
+
+    for (size_t i = next_function(myass, 0); i < myass->frozen_symbols_len; i = next_function(myass, i + 1)){
+        functions_len++;
+    }
+
+    if(functions_len == 0){
+        return 0;
+    }
+
+    PerfSymbol *symbols = MEMORY_ALLOC(PerfSymbol, functions_len, allocator);
+    size_t function_index = 0;
+
+    if(!symbols){
+        return 1;
+    }
+
+    for (size_t i = next_function(myass, 0); i < myass->frozen_symbols_len; i = next_function(myass, i + 1)){
+        symbols[function_index++] = function_symbol(myass, i, address);
+    }
+
+    int result = perf_map_append(functions_len, symbols);
+
+    MEMORY_DEALLOC(symbols, PerfSymbol, functions_len, allocator);
+
+    return result;
+}
+
+int myass_jitdump(const MyAss *myass, PerfJitDump *dump, uintptr_t address, const char *filename){
+    const Allocator *allocator = myass->allocator;
+    LZBBuff *bbuff = BBUFF;
+    const LineTable *line_table = filename ? myass->line_table : NULL;
+    LineTableRow row = {0};
+    int has_row = line_table ? line_table_next(line_table, &row) == 0 : 0;
+    PerfLine *lines = NULL;
+    size_t lines_capacity = 0;
+    int result = 0;
+
+    for (size_t i = next_function(myass, 0); i < myass->frozen_symbols_len && result == 0; i = next_function(myass, i + 1)){
+        PerfSymbol symbol = function_symbol(myass, i, address);
+        size_t function_offset = symbol.address - address;
+        size_t function_end = function_offset + symbol.size;
+        size_t lines_len = 0;
+
+        // Functions and rows are both sorted by offset
+        while(has_row && row.code_offset < function_offset){
+            has_row = line_table_next(line_table, &row) == 0;
+        }
+
+        while(has_row && row.code_offset < function_end){
+            if(lines_len == lines_capacity){
+                size_t new_capacity = lines_capacity == 0 ? 64 : lines_capacity * 2;
+                PerfLine *new_lines = MEMORY_REALLOC(PerfLine, lines_capacity, new_capacity, lines, allocator);
+
+                if(!new_lines){
+                    MEMORY_DEALLOC(lines, PerfLine, lines_capacity, allocator);
+                    return 1;
+                }
+
+                lines = new_lines;
+                lines_capacity = new_capacity;
+            }
+
+            lines[lines_len++] = (PerfLine){
+                .address = address + row.code_offset,
+                .line = row.line,
+                .column = row.column
+            };
+
+            has_row = line_table_next(line_table, &row) == 0;
+        }
+
+        result = perf_jitdump_code_load(
+            dump,
+            &symbol,
+            bbuff->raw_buff + function_offset,
+            filename,
+            lines_len,
+            lines
+        );
+    }
+
+    MEMORY_DEALLOC(lines, PerfLine, lines_capacity, allocator);
+
+    return result;
+}
+
+const MyAssPatchSite *myass_patch_sites(const MyAss *myass, size_t *out_len){
+    *out_len = myass->patch_sites_len;
+
+    return myass->patch_sites;
+}
+
+int myass_retarget(byte *site, uintptr_t target){
+    uintptr_t displacement_address = (uintptr_t)(site + 1);
+    uintptr_t qword_address = displacement_address & ~((uintptr_t)(PATCH_SITE_ALIGNMENT - 1));
+    size_t shift = (displacement_address - qword_address) * 8;
+    int64_t displacement = (int64_t)(target - (uintptr_t)(site + 5));
+
+    if(shift > 32 || displacement < INT32_MIN || displacement > INT32_MAX){
+        return 1;
+    }
+
+    qword *word = (qword *)qword_address;
+    qword mask = ((qword)UINT32_MAX) << shift;
+    qword expected = __atomic_load_n(word, __ATOMIC_RELAXED);
+    qword desired;
+
+    // Other bytes of the qword may belong to a site patched concurrently
+    do{
+        desired = (expected & ~mask) | (((qword)(dword)displacement) << shift);
+    }while(!__atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+size_t myass_link(MyAss *myass, uintptr_t base){
+    LZBBuff *bbuff = BBUFF;
+    size_t direct_len = 0;
+
+    for (size_t i = 0; i < myass->external_calls_len; i++){
+        ExternalCall *call = &myass->external_calls[i];
+        int64_t displacement = (int64_t)(call->address - (base + call->offset));
+
+        if(displacement >= INT32_MIN && displacement <= INT32_MAX){
+            lzbbuff_overwrite_dword(bbuff, 0, call->offset - 4, (dword)displacement);
+            direct_len++;
+        }else{
+            lzbbuff_overwrite_dword(bbuff, 0, call->offset - 4, call->stub_offset - call->offset);
+        }
+    }
+
+    return direct_len;
+}
+
+void myass_print_as_hex(const MyAss *myass, int wprefix){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_print_as_hex(bbuff, wprefix);
+}
+
+void myass_mov_r64_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0xc7);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 0, dst));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_mov_r32_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    // Stencils keep the prefix so register holes do not change the length
+    if(dst > 7 || myass->stencil){
+        lzbbuff_write_byte(bbuff, 0, rex(0, 0, 0, dst > 7));
+    }
+
+    lzbbuff_write_byte(bbuff, 0, 0xb8 + (dst & 0x7));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_mov_r64_imm64(MyAss *myass, X64Register dst, qword src){
+    if(src <= UINT32_MAX){
+        myass_mov_r32_imm32(myass, dst, (dword)src);
+    }else if((int64_t)src >= INT32_MIN && (int64_t)src <= INT32_MAX){
+        myass_mov_r64_imm32(myass, dst, (dword)src);
+    }else{
+        myass_movabs_r64_imm64(myass, dst, src);
+    }
+}
+
+void myass_mov_r64_rip32(MyAss *myass, X64Register dst, dword displacement){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, 0));
+    lzbbuff_write_byte(bbuff, 0, 0x8b);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(MEM_MODE_NO_DISPLACEMENT, dst, RBP));
+    lzbbuff_write_dword(bbuff, 0, displacement);
+}
+
+void myass_movabs_r64_imm64(MyAss *myass, X64Register dst, qword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0xb8 + (dst & 0x7));
+    lzbbuff_write_qword(bbuff, 0, src);
+}
+
+void myass_mov_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x8b);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+}
+
+void myass_mov_r64_m64(MyAss *myass, X64Register dst, X64Register base, int32_t displacement){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, base > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x8b);
+    write_memory_operand(myass, dst, base, displacement);
+}
+
+void myass_mov_m64_r64(MyAss *myass, X64Register base, int32_t displacement, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, src > 7, 0, base > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x89);
+    write_memory_operand(myass, src, base, displacement);
+}
+
+void myass_mov_m64_imm32(MyAss *myass, X64Register base, int32_t displacement, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, base > 7));
+    lzbbuff_write_byte(bbuff, 0, 0xc7);
+    write_memory_operand(myass, 0, base, displacement);
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+size_t print_code_bytes(const MyAss *myass, size_t offset, size_t len){
+	LZBBuff *bbuff = BBUFF;
+
+	printf("%06x", (unsigned int)offset);
+	printf(" - %06zu", len);
+	printf(": ");
+
+	for (size_t o = 0; o < len; o++) {
+		byte b = bbuff->raw_buff[offset + o];
+
+		printf("%02x", b);
+
+		if(o + 1 < len){
+			printf(", ");
+		}
+	}
+
+	// offset, size and separators take 17 characters
+	return 17 + (len * 2) + ((len - 1) * 2);
+}
+
+void print_call_stubs(const MyAss *myass, size_t largest_line_len){
+	LZBBuff *bbuff = BBUFF;
+
+	for (size_t i = 0; i < myass->stubs_len; i++){
+		size_t offset = myass->text_len + (i * CALL_STUB_LEN);
+		size_t line_len = print_code_bytes(myass, offset, CALL_STUB_LEN);
+		size_t padding_len = line_len < largest_line_len ? largest_line_len - line_len : 0;
+		dword displacement;
+
+		memcpy(&displacement, bbuff->raw_buff + offset + 2, sizeof(dword));
+		printf("%*sjmp [rip + %"PRIu32"]\n", (int)(padding_len + 8), "", displacement);
+	}
+}
+
+void print_constant_pool(const MyAss *myass, size_t largest_line_len){
+	LZBBuff *bbuff = BBUFF;
+	size_t stubs_end = myass->text_len + (myass->stubs_len * CALL_STUB_LEN);
+	size_t padding = myass->pool_offset - stubs_end;
+
+	if(myass->pool_len == 0){
+		return;
+	}
+
+	if(padding > 0){
+		size_t line_len = print_code_bytes(myass, stubs_end, padding);
+		size_t padding_len = line_len < largest_line_len ? largest_line_len - line_len : 0;
+
+		printf("%*s.align %d\n", (int)(padding_len + 8), "", CONSTANT_POOL_ALIGNMENT);
+	}
+
+	for (size_t i = 0; i < myass->pool_len; i++){
+		size_t offset = myass->pool_offset + (i * sizeof(qword));
+		size_t line_len = print_code_bytes(myass, offset, sizeof(qword));
+		size_t padding_len = line_len < largest_line_len ? largest_line_len - line_len : 0;
+		qword value;
+
+		memcpy(&value, bbuff->raw_buff + offset, sizeof(qword));
+		printf("%*s.quad 0x%016"PRIx64"\n", (int)(padding_len + 8), "", value);
+	}
+}
+
+void myass_formatted_print_hex(const MyAss *myass){
+	size_t largest_bytes_len = myass->largest_instruction * 2;
+	size_t spacing_len = (myass->largest_instruction - 1) * 2;
+	size_t largest_line_len = 17 + largest_bytes_len + spacing_len;
+
+	DynArr *instructions = myass->instructions;
+
+	if(!instructions){
+		// Only the listing map survives MYASS_FLAG_RELEASE_IR
+		size_t len = myass->listing_len;
+
+		if(len == 0){
+			myass_print_as_hex(myass, 0);
+			return;
+		}
+
+		for (size_t i = 0; i < len; i++) {
+			MyAssListingEntry *entry = &myass->listing[i];
+			const char *source = myass->source + entry->source_offset;
+
+			if(entry->len == 0){
+				printf("%.*s", (int)entry->source_len, source);
+			}else{
+				size_t line_len = print_code_bytes(myass, entry->offset, entry->len);
+				size_t padding_len = line_len < largest_line_len ? largest_line_len - line_len : 0;
+
+				if(entry->source_len == 0){
+					// Padding inserted by loop alignment has no source
+					printf(
+						"%*s.align %zu (max %zu)",
+						(int)(padding_len + 8),
+						"",
+						myass->loop_alignment,
+						myass->loop_max_padding
+					);
+				}else{
+					printf("%*s%.*s", (int)(padding_len + 8), "", (int)entry->source_len, source);
+				}
+			}
+
+			if(i + 1 < len){
+				printf("\n");
+			}
+		}
+
+		printf("\n");
+		print_call_stubs(myass, largest_line_len);
+		print_constant_pool(myass, largest_line_len);
+
+		return;
+	}
+
+	LZBStr *lzbstr = MEMORY_LZBSTR(ALLOCATOR);
+	size_t len = DYNARR_LEN(instructions);
+
+	for (size_t i = 0; i < len; i++) {
+		Instruction *instruction = dynarr_get_ptr(i, instructions);
+		size_t instruction_offset = instruction->offset;
+		size_t instruction_len = instruction->len;
+
+		if(instruction->type == LABEL_INSTRUCTION_TYPE){
+			EmptyInstruction *label_instruction = instruction->sub_instruction;
+
+			printf("%.*s:", LEXEME(&label_instruction->token));
+
+			if(i + 1 < len){
+				printf("\n");
+			}
+		}
+
+		if(instruction_len == 0){
+			continue;
+		}
+
+		size_t line_len = print_code_bytes(myass, instruction_offset, instruction_len);
+		size_t padding_len = line_len < largest_line_len ? largest_line_len - line_len : 0;
+
+		instruction_to_str(myass, lzbstr, instruction);
+		printf(
+			"%*s%s",
+			(int)(padding_len + 8),
+			"",
+			lzbstr->buff
+		);
+		lzbstr_reset(lzbstr);
+
+		if(i + 1 < len){
+			printf("\n");
+		}
+	}
+
+	printf("\n");
+	print_call_stubs(myass, largest_line_len);
+	print_constant_pool(myass, largest_line_len);
+}
+
+void myass_add_r64_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x81);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 0, dst));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_add_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x03);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+}
+
+void myass_call_imm32(MyAss *myass, dword offset){
+	LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0xe8);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_cmp_r64_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x81);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 7, dst));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_cmp_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
 
     lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x8b);
+    lzbbuff_write_byte(bbuff, 0, 0x3b);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+}
+
+void myass_cqo(MyAss *myass){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, 0));
+    lzbbuff_write_byte(bbuff, 0, 0x99);
+}
+
+void myass_idiv_r64(MyAss *myass, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0xf7);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 7, src));
+}
+
+void myass_imul_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0xaf);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+}
+
+void myass_je_imm32(MyAss *myass, dword offset){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x84);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jne_imm32(MyAss *myass, dword offset){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x85);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jg_imm32(MyAss *myass, dword offset){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x8f);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jl_imm32(MyAss *myass, dword offset){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x8c);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jge_imm32(MyAss *myass, dword offset){
+	LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x8d);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jle_imm32(MyAss *myass, dword offset){
+	LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0x0f);
+    lzbbuff_write_byte(bbuff, 0, 0x8e);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_jmp_imm32(MyAss *myass, dword offset){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0xe9);
+    lzbbuff_write_dword(bbuff, 0, offset);
+}
+
+void myass_inc_m64_abs32(MyAss *myass, int32_t address, int lock){
+    LZBBuff *bbuff = BBUFF;
+
+    if(lock) lzbbuff_write_byte(bbuff, 0, 0xf0);
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, 0));
+    lzbbuff_write_byte(bbuff, 0, 0xff);
+    // No base and no index: SIB 0x25 makes it an absolute disp32
+    lzbbuff_write_byte(bbuff, 0, mod_rm(MEM_MODE_NO_DISPLACEMENT, 0, RSP));
+    lzbbuff_write_byte(bbuff, 0, 0x25);
+    lzbbuff_write_dword(bbuff, 0, (dword)address);
+}
+
+void myass_pop_r64(MyAss *myass, X64Register dst){
+	LZBBuff *bbuff = BBUFF;
+
+	if(dst > 7 || myass->stencil) lzbbuff_write_byte(bbuff, 0, rex(0, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x58 | (((byte)dst) & 0b00000111));
+}
+
+void myass_push_r64(MyAss *myass, X64Register src){
+	LZBBuff *bbuff = BBUFF;
+
+	if(src > 7 || myass->stencil) lzbbuff_write_byte(bbuff, 0, rex(0, 0, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x50 | (((byte)src) & 0b00000111));
+}
+
+void myass_sub_r64_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x81);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 5, dst));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_sub_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x2b);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+}
+
+void myass_ret(MyAss *myass){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, 0xc3);
+}
+
+void myass_tzcnt_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    write_0f_register(myass, 0xf3, 1, 0xbc, dst, src);
+}
+
+void myass_xor_r64_imm32(MyAss *myass, X64Register dst, dword src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x81);
+    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 6, dst));
+    lzbbuff_write_dword(bbuff, 0, src);
+}
+
+void myass_xor_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+    LZBBuff *bbuff = BBUFF;
+
+    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
+    lzbbuff_write_byte(bbuff, 0, 0x33);
     lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
 }
 
-void myass_formatted_print_hex(const MyAss *myass){
-	size_t offset_len = 6;
-	size_t size_len = 6;
-	size_t others_len = 5;
-	size_t largest_bytes_len = myass->largest_instruction * 2;
-	size_t spacing_len = (myass->largest_instruction - 1) * 2;
-	size_t largest_line_len = offset_len + size_len + others_len + largest_bytes_len + spacing_len;
+void myass_movdqu_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0xf3, 0, 0x6f, dst, src);
+}
+
+void myass_movdqu_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement){
+    write_0f_memory(myass, 0xf3, 0, 0x6f, dst, base, displacement);
+}
+
+void myass_movdqu_m128_xmm(MyAss *myass, X64Register base, int32_t displacement, byte src){
+    write_0f_memory(myass, 0xf3, 0, 0x7f, src, base, displacement);
+}
+
+void myass_movq_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0xf3, 0, 0x7e, dst, src);
+}
+
+void myass_movq_xmm_r64(MyAss *myass, byte dst, X64Register src){
+    write_0f_register(myass, 0x66, 1, 0x6e, dst, src);
+}
+
+void myass_movq_r64_xmm(MyAss *myass, X64Register dst, byte src){
+    write_0f_register(myass, 0x66, 1, 0x7e, src, dst);
+}
+
+void myass_paddd_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0x66, 0, 0xfe, dst, src);
+}
+
+void myass_paddd_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement){
+    write_0f_memory(myass, 0x66, 0, 0xfe, dst, base, displacement);
+}
+
+void myass_paddq_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0x66, 0, 0xd4, dst, src);
+}
+
+void myass_paddq_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement){
+    write_0f_memory(myass, 0x66, 0, 0xd4, dst, base, displacement);
+}
+
+void myass_pcmpeqb_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0x66, 0, 0x74, dst, src);
+}
+
+void myass_pcmpeqb_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement){
+    write_0f_memory(myass, 0x66, 0, 0x74, dst, base, displacement);
+}
+
+void myass_pmovmskb_r32_xmm(MyAss *myass, X64Register dst, byte src){
+    write_0f_register(myass, 0x66, 0, 0xd7, dst, src);
+}
+
+void myass_pxor_xmm_xmm(MyAss *myass, byte dst, byte src){
+    write_0f_register(myass, 0x66, 0, 0xef, dst, src);
+}
+
+void myass_pxor_xmm_m128(MyAss *myass, byte dst, X64Register base, int32_t displacement){
+    write_0f_memory(myass, 0x66, 0, 0xef, dst, base, displacement);
+}
+
+void myass_vmovdqu_v_v(MyAss *myass, byte len, byte dst, byte src){
+    // The store form puts 'src' in ModRM.reg, which the 2 bytes VEX extends
+    if(src > 7 && dst <= 7){
+        write_vex_register(myass, VEX_PP_F3, VEX_MAP_0F, len, 0x7f, src, 0, dst);
+        return;
+    }
+
+    write_vex_register(myass, VEX_PP_F3, VEX_MAP_0F, len, 0x6f, dst, 0, src);
+}
+
+void myass_vmovdqu_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_F3, VEX_MAP_0F, len, 0x6f, dst, 0, base, displacement);
+}
+
+void myass_vmovdqu_m_v(MyAss *myass, byte len, X64Register base, int32_t displacement, byte src){
+    write_vex_memory(myass, VEX_PP_F3, VEX_MAP_0F, len, 0x7f, src, 0, base, displacement);
+}
+
+void myass_vpaddd_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F, len, 0xfe, dst, src1, src2);
+}
+
+void myass_vpaddd_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F, len, 0xfe, dst, src1, base, displacement);
+}
+
+void myass_vpaddq_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F, len, 0xd4, dst, src1, src2);
+}
+
+void myass_vpaddq_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F, len, 0xd4, dst, src1, base, displacement);
+}
+
+void myass_vpbroadcastb_v_xmm(MyAss *myass, byte len, byte dst, byte src){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x78, dst, 0, src);
+}
+
+void myass_vpbroadcastb_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x78, dst, 0, base, displacement);
+}
+
+void myass_vpbroadcastd_v_xmm(MyAss *myass, byte len, byte dst, byte src){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x58, dst, 0, src);
+}
+
+void myass_vpbroadcastd_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x58, dst, 0, base, displacement);
+}
+
+void myass_vpbroadcastq_v_xmm(MyAss *myass, byte len, byte dst, byte src){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x59, dst, 0, src);
+}
+
+void myass_vpbroadcastq_v_m(MyAss *myass, byte len, byte dst, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F38, len, 0x59, dst, 0, base, displacement);
+}
+
+void myass_vpcmpeqb_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F, len, 0x74, dst, src1, src2);
+}
+
+void myass_vpcmpeqb_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F, len, 0x74, dst, src1, base, displacement);
+}
+
+void myass_vpmovmskb_r32_v(MyAss *myass, byte len, X64Register dst, byte src){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F, len, 0xd7, dst, 0, src);
+}
+
+void myass_vpxor_v_v_v(MyAss *myass, byte len, byte dst, byte src1, byte src2){
+    write_vex_register(myass, VEX_PP_66, VEX_MAP_0F, len, 0xef, dst, src1, src2);
+}
+
+void myass_vpxor_v_v_m(MyAss *myass, byte len, byte dst, byte src1, X64Register base, int32_t displacement){
+    write_vex_memory(myass, VEX_PP_66, VEX_MAP_0F, len, 0xef, dst, src1, base, displacement);
+}
+
+void myass_vzeroupper(MyAss *myass){
+    write_vex_prefix(myass, VEX_PP_NONE, VEX_MAP_0F, 16, 0, 0, 0);
+    lzbbuff_write_byte(BBUFF, 0, 0x77);
+}
+
+void myass_loop_alignment(MyAss *myass, size_t boundary, size_t max_padding){
+    assert((boundary & (boundary - 1)) == 0 && "Boundary must be zero or a power of two");
+
+    myass->loop_alignment = boundary;
+    myass->loop_max_padding = max_padding;
+}
+
+inline void myass_flags(MyAss *myass, int flags){
+    myass->flags = flags;
+}
+
+void myass_resolver(MyAss *myass, MyAssResolver resolver, void *context){
+    myass->resolver = resolver;
+    myass->resolver_context = context;
+}
+
+const MyAssListingEntry *myass_listing(const MyAss *myass, size_t *out_len){
+    *out_len = myass->listing_len;
+
+    return myass->listing;
+}
+
+int myass_label_count(MyAss *myass, const char *name, uint64_t count){
+    return add_label_count(myass, name, strlen(name), count);
+}
+
+int myass_load_profile(MyAss *myass, const char *pathname){
+    FILE *file = fopen(pathname, "r");
+
+    if(!file){
+        return 1;
+    }
+
+    char line[PROFILE_MAX_LINE_LEN + 2];
+    int failed = 0;
+
+    while(!failed && fgets(line, sizeof(line), file)){
+        size_t line_len = strlen(line);
+
+        if(line_len > PROFILE_MAX_LINE_LEN && line[line_len - 1] != '\n'){
+            failed = 1;
+            break;
+        }
+
+        char *name = line + strspn(line, " \t");
+        size_t name_len = strcspn(name, " \t\r\n");
+
+        if(name_len == 0 || name[0] == '#'){
+            continue;
+        }
+
+        char *count_start = name + name_len;
+        char *count_end = NULL;
+
+        *count_start++ = '\0';
+        count_start += strspn(count_start, " \t");
+
+        if(*count_start < '0' || *count_start > '9'){
+            failed = 1;
+            break;
+        }
+
+        uint64_t count = (uint64_t)strtoull(count_start, &count_end, 10);
+
+        if(count_end[strspn(count_end, " \t\r\n")] != '\0'){
+            failed = 1;
+            break;
+        }
+
+        failed = myass_label_count(myass, name, count);
+    }
+
+    failed |= ferror(file);
+    fclose(file);
+
+    return failed;
+}
+
+void myass_clear_profile(MyAss *myass){
+    if(myass->label_counts){
+        lzohtable_clear_help(NULL, NULL, myass->label_counts);
+    }
+}
+
+int myass_block_counters(MyAss *myass, uint64_t *counters, size_t capacity, int atomic){
+    intptr_t start = (intptr_t)counters;
+    intptr_t end = (intptr_t)(counters + capacity);
 
-	LZBStr *lzbstr = MEMORY_LZBSTR(ALLOCATOR);
-	DynArr *instructions = myass->instructions;
-	LZBBuff *bbuff = BBUFF;
-	size_t len = DYNARR_LEN(instructions);
+    if(start < INT32_MIN || end - 1 > INT32_MAX){
+        return 1;
+    }
 
-	for (size_t i = 0; i < len; i++) {
-		Instruction *instruction = dynarr_get_ptr(i, instructions);
-		size_t instruction_offset = instruction->offset;
-		size_t instruction_len = instruction->len;
+    myass->counters = counters;
+    myass->counters_capacity = capacity;
+    myass->atomic_counters = atomic;
 
-		if(instruction->type == LABEL_INSTRUCTION_TYPE){
-			EmptyInstruction *label_instruction = instruction->sub_instruction;
+    return 0;
+}
 
-			printf("%s:", label_instruction->token->lexeme);
+size_t myass_counters_len(const MyAss *myass){
+    return myass->counters_len;
+}
 
-			if(i + 1 < len){
-				printf("\n");
-			}
-		}
+int myass_counter_symbol(const MyAss *myass, size_t index, MyAssSymbol *out_symbol){
+    // Counters keep their order when blocks are dropped
+    size_t low = 0;
+    size_t high = myass->counter_symbols_len;
 
-		if(instruction_len == 0){
-			continue;
-		}
+    while(low < high){
+        size_t middle = low + (high - low) / 2;
 
-		printf("%06x", (unsigned int)instruction_offset);
-		printf(" - %06zu", instruction_len);
-		printf(": ");
+        if(myass->counter_symbols[middle].index < index){
+            low = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
 
-		for (size_t o = 0; o < instruction_len; o++) {
-			byte b = bbuff->raw_buff[instruction_offset + o];
+    if(low == myass->counter_symbols_len || myass->counter_symbols[low].index != index){
+        return 1;
+    }
 
-			printf("%02x", b);
+    CounterSymbol *counter_symbol = &myass->counter_symbols[low];
 
-			if(o + 1 < instruction_len){
-				printf(", ");
-			}
-		}
+    if(counter_symbol->symbol == NO_SYMBOL){
+        *out_symbol = (MyAssSymbol){.name = "", .name_len = 0, .offset = counter_symbol->offset};
 
-		size_t line_len = offset_len + size_len + others_len + (instruction_len * 2) + ((instruction_len - 1) * 2);
+        return 0;
+    }
 
-		instruction_to_str(lzbstr, instruction);
-		printf(
-			"%*s%s",
-			(int)(largest_line_len - line_len + 8),
-			"",
-			lzbstr->buff
-		);
-		lzbstr_reset(lzbstr);
+    FrozenSymbol *symbol = &myass->frozen_symbols[counter_symbol->symbol];
 
-		if(i + 1 < len){
-			printf("\n");
-		}
-	}
+    *out_symbol = (MyAssSymbol){
+        .name = myass->symbol_names + symbol->name_offset,
+        .name_len = symbol->name_len,
+        .offset = counter_symbol->offset
+    };
 
-	printf("\n");
+    return 0;
 }
 
-void myass_add_r64_imm32(MyAss *myass, X64Register dst, dword src){
-    LZBBuff *bbuff = BBUFF;
+int myass_profile_counters(MyAss *myass){
+    for (size_t i = 0; i < myass->counter_symbols_len; i++){
+        CounterSymbol *counter_symbol = &myass->counter_symbols[i];
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x81);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 0, dst));
-    lzbbuff_write_dword(bbuff, 0, src);
-}
+        if(counter_symbol->symbol == NO_SYMBOL){
+            continue;
+        }
 
-void myass_add_r64_r64(MyAss *myass, X64Register dst, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+        FrozenSymbol *symbol = &myass->frozen_symbols[counter_symbol->symbol];
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x03);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
-}
+        if(add_label_count(
+            myass,
+            myass->symbol_names + symbol->name_offset,
+            symbol->name_len,
+            myass->counters[counter_symbol->index]
+        )){
+            return 1;
+        }
+    }
 
-void myass_call_imm32(MyAss *myass, dword offset){
-	LZBBuff *bbuff = BBUFF;
+    return 0;
+}
 
-    lzbbuff_write_byte(bbuff, 0, 0xe8);
-    lzbbuff_write_dword(bbuff, 0, offset);
+int64_t myass_simplified_bytes(const MyAss *myass){
+    return myass->simplified_bytes;
 }
 
-void myass_cmp_r64_imm32(MyAss *myass, X64Register dst, dword src){
-    LZBBuff *bbuff = BBUFF;
+int myass_lookup_line(const MyAss *myass, size_t offset, uint32_t *out_line, uint32_t *out_column){
+    if(!myass->line_table || offset > UINT32_MAX){
+        return 1;
+    }
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x81);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 7, dst));
-    lzbbuff_write_dword(bbuff, 0, src);
+    return line_table_lookup(myass->line_table, (uint32_t)offset, out_line, out_column);
 }
 
-void myass_cmp_r64_r64(MyAss *myass, X64Register dst, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+MyAssLabel myass_label_new(MyAss *myass){
+    if(myass->labels_len == myass->labels_capacity){
+        const Allocator *allocator = myass->allocator;
+        size_t new_capacity = myass->labels_capacity == 0 ? 64 : myass->labels_capacity * 2;
+        Label *labels = MEMORY_REALLOC(
+            Label,
+            myass->labels_capacity,
+            new_capacity,
+            myass->labels,
+            allocator
+        );
+
+        if(!labels){
+            return MYASS_NO_LABEL;
+        }
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x3b);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
-}
+        myass->labels = labels;
+        myass->labels_capacity = new_capacity;
+    }
 
-void myass_idiv_r64(MyAss *myass, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+    myass->labels[myass->labels_len] = (Label){
+        .offset = UNBOUND_LABEL,
+        .fixups = NO_FIXUP
+    };
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0xf7);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 7, src));
+    return (MyAssLabel)myass->labels_len++;
 }
 
-void myass_imul_r64_r64(MyAss *myass, X64Register dst, X64Register src){
+void myass_label_bind(MyAss *myass, MyAssLabel label){
+    assert(label < myass->labels_len && "Unknown label");
+    assert(myass->labels[label].offset == UNBOUND_LABEL && "Label already bound");
+
     LZBBuff *bbuff = BBUFF;
+    Label *bound_label = &myass->labels[label];
+    uint32_t offset = (uint32_t)lzbbuff_used_bytes(bbuff);
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0xaf);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
-}
+    for (uint32_t i = bound_label->fixups; i != NO_FIXUP; i = myass->label_fixups[i].next){
+        LabelFixup *fixup = &myass->label_fixups[i];
 
-void myass_je_imm32(MyAss *myass, dword offset){
-    LZBBuff *bbuff = BBUFF;
+        lzbbuff_overwrite_dword(bbuff, 0, fixup->offset - 4, offset - fixup->offset);
+    }
 
-    lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0x84);
-    lzbbuff_write_dword(bbuff, 0, offset);
+    bound_label->offset = offset;
+    bound_label->fixups = NO_FIXUP;
 }
 
-void myass_jg_imm32(MyAss *myass, dword offset){
-    LZBBuff *bbuff = BBUFF;
+int myass_label_offset(const MyAss *myass, MyAssLabel label, size_t *out_offset){
+    assert(label < myass->labels_len && "Unknown label");
 
-    lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0x8f);
-    lzbbuff_write_dword(bbuff, 0, offset);
-}
+    uint32_t offset = myass->labels[label].offset;
 
-void myass_jl_imm32(MyAss *myass, dword offset){
-    LZBBuff *bbuff = BBUFF;
+    if(offset == UNBOUND_LABEL){
+        return 1;
+    }
 
-    lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0x8c);
-    lzbbuff_write_dword(bbuff, 0, offset);
+    *out_offset = offset;
+
+    return 0;
 }
 
-void myass_jge_imm32(MyAss *myass, dword offset){
-	LZBBuff *bbuff = BBUFF;
+int myass_jcc_label(MyAss *myass, MyAssCondition condition, MyAssLabel label){
+    assert(label < myass->labels_len && "Unknown label");
 
-    lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0x8d);
-    lzbbuff_write_dword(bbuff, 0, offset);
-}
+    LZBBuff *bbuff = BBUFF;
+    Label *target = &myass->labels[label];
 
-void myass_jle_imm32(MyAss *myass, dword offset){
-	LZBBuff *bbuff = BBUFF;
+    if(jump_to_bound_label(myass, 0x70 | condition, target) == 0){
+        return 0;
+    }
 
     lzbbuff_write_byte(bbuff, 0, 0x0f);
-    lzbbuff_write_byte(bbuff, 0, 0x8e);
-    lzbbuff_write_dword(bbuff, 0, offset);
-}
-
-void myass_jmp_imm32(MyAss *myass, dword offset){
-    LZBBuff *bbuff = BBUFF;
+    lzbbuff_write_byte(bbuff, 0, 0x80 | condition);
+    lzbbuff_write_dword(bbuff, 0, 0);
 
-    lzbbuff_write_byte(bbuff, 0, 0xe9);
-    lzbbuff_write_dword(bbuff, 0, offset);
+    return add_label_fixup(myass, target);
 }
 
-void myass_pop_r64(MyAss *myass, X64Register dst){
-	LZBBuff *bbuff = BBUFF;
+int myass_jmp_label(MyAss *myass, MyAssLabel label){
+    assert(label < myass->labels_len && "Unknown label");
 
-	if(dst > 7) lzbbuff_write_byte(bbuff, 0, rex(0, 0, 0, 1));
-    lzbbuff_write_byte(bbuff, 0, 0x58 | (((byte)dst) & 0b00000111));
-}
+    Label *target = &myass->labels[label];
 
-void myass_push_r64(MyAss *myass, X64Register src){
-	LZBBuff *bbuff = BBUFF;
+    if(jump_to_bound_label(myass, 0xeb, target) == 0){
+        return 0;
+    }
 
-	if(src > 7) lzbbuff_write_byte(bbuff, 0, rex(0, 0, 0, 1));
-    lzbbuff_write_byte(bbuff, 0, 0x50 | (((byte)src) & 0b00000111));
+    myass_jmp_imm32(myass, 0);
+
+    return add_label_fixup(myass, target);
 }
 
-void myass_sub_r64_imm32(MyAss *myass, X64Register dst, dword src){
-    LZBBuff *bbuff = BBUFF;
+int myass_call_label(MyAss *myass, MyAssLabel label){
+    assert(label < myass->labels_len && "Unknown label");
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x81);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 5, dst));
-    lzbbuff_write_dword(bbuff, 0, src);
+    myass_call_imm32(myass, 0);
+
+    return add_label_fixup(myass, &myass->labels[label]);
 }
 
-void myass_sub_r64_r64(MyAss *myass, X64Register dst, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+void myass_restart(MyAss *myass){
+    lzbbuff_restart(BBUFF);
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x2b);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+    myass->labels_len = 0;
+    myass->label_fixups_len = 0;
 }
 
-void myass_ret(MyAss *myass){
+void myass_nop(MyAss *myass, size_t len){
     LZBBuff *bbuff = BBUFF;
 
-    lzbbuff_write_byte(bbuff, 0, 0xc3);
-}
+    while(len > 0){
+        size_t nop_len = len > 9 ? 9 : len;
 
-void myass_xor_r64_imm32(MyAss *myass, X64Register dst, dword src){
-    LZBBuff *bbuff = BBUFF;
+        lzbbuff_write_bytes(bbuff, 0, nop_len, nops[nop_len - 1]);
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, 0, 0, dst > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x81);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, 6, dst));
-    lzbbuff_write_dword(bbuff, 0, src);
+        len -= nop_len;
+    }
 }
 
-void myass_xor_r64_r64(MyAss *myass, X64Register dst, X64Register src){
-    LZBBuff *bbuff = BBUFF;
+void myass_align(MyAss *myass, size_t alignment){
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
 
-    lzbbuff_write_byte(bbuff, 0, rex(1, dst > 7, 0, src > 7));
-    lzbbuff_write_byte(bbuff, 0, 0x33);
-    lzbbuff_write_byte(bbuff, 0, mod_rm(REG_MODE, dst, src));
+    size_t offset = lzbbuff_used_bytes(BBUFF);
+    size_t padding = (alignment - (offset & (alignment - 1))) & (alignment - 1);
+
+    myass_nop(myass, padding);
 }
 
 int myass_assemble(MyAss *myass, size_t input_len, const char *input){
     if(setjmp(myass->err_buf) == 0){
-        lzbbuff_restart(BBUFF);
+        myass_restart(myass);
         lzarena_free_all(ARENA);
 
+        myass->source = input;
+        myass->listing_len = 0;
+        myass->simplified_bytes = 0;
+        myass->frozen_symbols_len = 0;
+        myass->counters_len = 0;
+        myass->counter_symbols_len = 0;
+        myass->patch_sites_len = 0;
+        myass->external_calls_len = 0;
+        myass->text_len = 0;
+        myass->stubs_len = 0;
+        myass->pool_offset = 0;
+        myass->pool_len = 0;
+        myass->instructions = NULL;
+
+        if(myass->line_table){
+            line_table_reset(myass->line_table);
+        }else if(myass->flags & MYASS_FLAG_LINE_TABLE){
+            // Outlives the arena, like the listing map
+            myass->line_table = line_table_create(myass->allocator);
+
+            if(!myass->line_table){
+                out_of_memory(myass);
+            }
+        }
+
         LZOHTable *registers_keywords = myass->registers_keywords;
         LZOHTable *instructions_keywords = myass->instructions_keywords;
         LZOHTable *symbols = MEMORY_LZOHTABLE(ALLOCATOR);
         LZStack *jumps_to_resolve = MEMORY_LZSTACK(ALLOCATOR);
-        DynArr *tokens = MEMORY_DYNARR_PTR(ALLOCATOR);
         DynArr *instructions = MEMORY_DYNARR_PTR(ALLOCATOR);
-        BStr code = {.len = input_len, .buff = input};
+        // Tokens point into 'input', which must outlive any printing
+        BStr *code = MEMORY_NEW(ALLOCATOR, BStr, .len = input_len, .buff = input);
         Lexer *lexer = lexer_create(ALLOCATOR);
         Parser *parser = parser_create(ALLOCATOR);
 
         myass->largest_instruction = 0;
+        myass->lexer = lexer;
         myass->symbols = symbols;
         myass->jumps_to_resolve = jumps_to_resolve;
-
-        if(lexer_lex(lexer, registers_keywords, instructions_keywords, &code, tokens)){
+        myass->constant_uses = MEMORY_LZOHTABLE(ALLOCATOR);
+        myass->constants = MEMORY_LZOHTABLE(ALLOCATOR);
+        myass->constant_values = MEMORY_DYNARR_TYPE(ALLOCATOR, qword);
+        myass->constant_loads = MEMORY_LZSTACK(ALLOCATOR);
+        myass->externals = MEMORY_LZOHTABLE(ALLOCATOR);
+
+        // The parser pulls tokens from the lexer as it goes
+        if(lexer_init(lexer, registers_keywords, instructions_keywords, code)){
             return 1;
         }
 
-        if(parser_parse(parser, tokens, instructions)){
+        lexer->holes = myass->stencil;
+
+        if(parser_parse(parser, lexer, instructions)){
             return 1;
         }
 
+        if((myass->flags & MYASS_FLAG_PROFILE_LAYOUT) && myass->label_counts){
+            DynArr *laid_out_instructions = cfg_layout(
+                lexer,
+                instructions,
+                myass->label_counts,
+                ALLOCATOR
+            );
+
+            if(laid_out_instructions){
+                instructions = laid_out_instructions;
+            }
+        }
+
+        if(myass->flags & MYASS_FLAG_COUNT_BLOCKS){
+            instructions = insert_block_counters(myass, instructions);
+        }
+
+        count_constant_uses(myass, instructions);
         assemble_instructions(myass, instructions);
+
+        if(myass->flags & MYASS_FLAG_SIMPLIFY_CFG){
+            size_t original_len = lzbbuff_used_bytes(BBUFF);
+            DynArr *simplified_instructions = cfg_simplify(myass->lexer, instructions, ALLOCATOR);
+
+            if(simplified_instructions){
+                instructions = simplified_instructions;
+
+                // Dropped code may have taken uses of pool constants
+                myass->constant_uses = MEMORY_LZOHTABLE(ALLOCATOR);
+                count_constant_uses(myass, instructions);
+                reassemble_instructions(myass, instructions);
+            }
+
+            myass->simplified_bytes = (int64_t)original_len - (int64_t)lzbbuff_used_bytes(BBUFF);
+        }
+
+        if(myass->loop_alignment > 1){
+            DynArr *aligned_instructions = align_loop_heads(myass, instructions);
+
+            if(aligned_instructions){
+                instructions = aligned_instructions;
+
+                reassemble_instructions(myass, instructions);
+            }
+        }
+
+        emit_call_stubs(myass);
+        emit_constant_pool(myass);
         resolve_jumps(myass);
 
-        myass->instructions = instructions;
         myass->symbols = NULL;
         myass->jumps_to_resolve = NULL;
+        myass->constant_uses = NULL;
+        myass->constants = NULL;
+        myass->constant_values = NULL;
+        myass->constant_loads = NULL;
+        myass->externals = NULL;
+
+        if(myass->flags & MYASS_FLAG_LISTING_MAP){
+            build_listing(myass, instructions);
+        }
+
+        freeze_symbols(myass, instructions);
+
+        if(myass->flags & MYASS_FLAG_COUNT_BLOCKS){
+            freeze_counters(myass, instructions);
+        }
+
+        if(myass->flags & MYASS_FLAG_PATCHABLE){
+            build_patch_sites(myass, instructions);
+        }
+
+        if(myass->flags & MYASS_FLAG_RELEASE_IR){
+            myass->lexer = NULL;
+            lzarena_release(ARENA);
+        }else{
+            myass->instructions = instructions;
+        }
 
         return 0;
     }else{
         return 1;
     }
 }
+
+MyAssStencil *myass_stencil_create(MyAss *myass, size_t input_len, const char *input){
+    const Allocator *allocator = myass->allocator;
+    int flags = myass->flags;
+
+    // Pool loads would be queued again each time a register hole
+    // gets its instruction written again
+    myass->flags |= MYASS_FLAG_PREFER_MOVABS;
+    myass->stencil = 1;
+
+    int failed = myass_assemble(myass, input_len, input);
+
+    myass->flags = flags;
+    myass->stencil = 0;
+
+    if(failed){
+        return NULL;
+    }
+
+    size_t code_len;
+    const byte *code = myass_code(myass, &code_len);
+    size_t patches_len = myass->stencil_patches_len;
+    MyAssStencil *stencil = MEMORY_ALLOC(MyAssStencil, 1, allocator);
+    byte *stencil_code = MEMORY_ALLOC(byte, code_len, allocator);
+    StencilPatch *patches = MEMORY_ALLOC(StencilPatch, patches_len, allocator);
+
+    if(!stencil || !stencil_code || !patches){
+        MEMORY_DEALLOC(stencil, MyAssStencil, 1, allocator);
+        MEMORY_DEALLOC(stencil_code, byte, code_len, allocator);
+        MEMORY_DEALLOC(patches, StencilPatch, patches_len, allocator);
+
+        return NULL;
+    }
+
+    memcpy(stencil_code, code, code_len);
+    memcpy(patches, myass->stencil_patches, sizeof(StencilPatch) * patches_len);
+
+    stencil->code = stencil_code;
+    stencil->code_len = code_len;
+    stencil->patches = patches;
+    stencil->patches_len = patches_len;
+    stencil->allocator = allocator;
+
+    memset(stencil->holes, 0, sizeof(stencil->holes));
+
+    for (size_t i = 0; i < patches_len; i++){
+        size_t *holes = &stencil->holes[patches[i].type];
+
+        if((size_t)patches[i].hole + 1 > *holes){
+            *holes = (size_t)patches[i].hole + 1;
+        }
+    }
+
+    return stencil;
+}
+
+void myass_stencil_destroy(MyAssStencil *stencil){
+    if(!stencil){
+        return;
+    }
+
+    const Allocator *allocator = stencil->allocator;
+
+    MEMORY_DEALLOC(stencil->code, byte, stencil->code_len, allocator);
+    MEMORY_DEALLOC(stencil->patches, StencilPatch, stencil->patches_len, allocator);
+    MEMORY_DEALLOC(stencil, MyAssStencil, 1, allocator);
+}
+
+const byte *myass_stencil_code(const MyAssStencil *stencil, size_t *out_len){
+    *out_len = stencil->code_len;
+
+    return stencil->code;
+}
+
+void myass_stencil_holes(const MyAssStencil *stencil, size_t *out_registers, size_t *out_immediates, size_t *out_targets){
+    *out_registers = stencil->holes[REGISTER_PATCH_TYPE];
+    *out_immediates = stencil->holes[IMMEDIATE_PATCH_TYPE];
+    *out_targets = stencil->holes[TARGET_PATCH_TYPE];
+}
+
+int myass_stencil_instantiate(
+    const MyAssStencil *stencil,
+    byte *dst,
+    uintptr_t address,
+    const X64Register *registers,
+    const dword *immediates,
+    const uintptr_t *targets
+){
+    const StencilPatch *patches = stencil->patches;
+    size_t patches_len = stencil->patches_len;
+
+    memcpy(dst, stencil->code, stencil->code_len);
+
+    for (size_t i = 0; i < patches_len; i++){
+        const StencilPatch *patch = &patches[i];
+        byte *field = dst + patch->offset;
+
+        switch (patch->type){
+            case REGISTER_PATCH_TYPE:{
+                if(((registers[patch->hole] >> patch->bit) & 1) != patch->inverted){
+                    *field |= patch->mask;
+                }else{
+                    *field &= ~patch->mask;
+                }
+
+                break;
+            }case IMMEDIATE_PATCH_TYPE:{
+                memcpy(field, &immediates[patch->hole], sizeof(dword));
+                break;
+            }case TARGET_PATCH_TYPE:{
+                uintptr_t end = address + patch->offset + sizeof(dword);
+                int64_t displacement = (int64_t)(targets[patch->hole] - end);
+
+                if(displacement < INT32_MIN || displacement > INT32_MAX){
+                    return 1;
+                }
+
+                dword rel32 = (dword)displacement;
+
+                memcpy(field, &rel32, sizeof(dword));
+
+                break;
+            }default:{
+                assert(0 && "Illegal patch type");
+            }
+        }
+    }
+
+    return 0;
+}
@@ -10,7 +10,36 @@
 #include <inttypes.h>
 
 #define ALLOCATOR (parser->allocator)
-#define CURRENT_LEXEME (peek(parser)->lexeme)
+#define LEXEME(_token) LEXER_LEXEME_ARGS(parser->lexer, (_token))
+#define CURRENT_LEXEME LEXEME(peek(parser))
+
+// Operands are described by the set of token types they accept
+#define OPERAND(_type) (((uint64_t)1) << (_type))
+#define REGISTER_OPERAND (OPERAND(REGISTER_TOKEN_TYPE) | OPERAND(REGISTER_HOLE_TOKEN_TYPE))
+#define LITERAL_OPERAND OPERAND(DWORD_TYPE_TOKEN_TYPE)
+// Literals of instructions, which stencils can leave as holes
+#define IMMEDIATE_OPERAND (LITERAL_OPERAND | OPERAND(IMMEDIATE_HOLE_TOKEN_TYPE))
+#define QWORD_LITERAL_OPERAND OPERAND(QWORD_TYPE_TOKEN_TYPE)
+#define LABEL_OPERAND (OPERAND(IDENTIFIER_TOKEN_TYPE) | OPERAND(TARGET_HOLE_TOKEN_TYPE))
+#define XMM_OPERAND OPERAND(XMM_REGISTER_TOKEN_TYPE)
+#define VECTOR_OPERAND (XMM_OPERAND | OPERAND(YMM_REGISTER_TOKEN_TYPE))
+// '[base + displacement]', parsed by 'parse_memory_operand'
+#define MEMORY_OPERAND OPERAND(LEFT_BRACKET_TOKEN_TYPE)
+
+_Static_assert(EOF_TOKEN_TYPE < 64, "token types must fit in an operand mask");
+
+typedef struct parse_rule ParseRule;
+
+// One rule per token type that can start an instruction. Mnemonics
+// sharing an operand shape share the parse routine, and every routine
+// builds an instruction of type 'type'. Ternary instructions take their
+// first source like their destination
+struct parse_rule{
+    Instruction *(*parse)(Parser *parser, const ParseRule *rule);
+    InstructionType type;
+    uint64_t dst_operands;
+    uint64_t src_operands;
+};
 
 //------------------------------------------------------------
 //                      PRIVATE INTERFACE                   //
@@ -21,31 +50,67 @@ static inline Token *peek(const Parser *parser);
 static inline Token *previous(const Parser *parser);
 static inline Token *advance(Parser *parser);
 static inline int is_at_end(const Parser *parser);
-static int match(Parser *parser, size_t types_count, ...);
-static inline int check(Parser *parser, TokenType type);
 static Token *consume(Parser *parser, TokenType type, char *fmt, ...);
+static Token *consume_operand(Parser *parser, uint64_t operands, const Token *instruction_token);
+static Location *parse_memory_operand(Parser *parser, Token *out_token);
+static Location *parse_operand(Parser *parser, uint64_t operands, const Token *instruction_token, Token *out_token);
 
-static X64Register token_to_register(Token *token);
 static Location *create_register_location(Parser *parser, X64Register reg);
-static Location *create_literal_location(Parser *parser, dword value);
+static Location *create_literal_location(Parser *parser, qword value);
 static Location *create_label_location(Parser *parser, Token *label_token);
+static Location *create_vector_location(Parser *parser, byte reg, byte len);
+static Location *create_memory_location(Parser *parser, X64Register base, int32_t displacement);
 static Location *token_to_location(Parser *parser, Token *location_token);
 
-static Instruction *parse_label_instruction(Parser *parser);
-static Instruction *parse_add_instruction(Parser *parser);
-static Instruction *parse_call_instruction(Parser *parser);
-static Instruction *parse_cmp_instruction(Parser *parser);
-static Instruction *parse_idiv_instruction(Parser *parser);
-static Instruction *parse_imul_instruction(Parser *parser);
-static Instruction *parse_jcc_instruction(Parser *parser);
-static Instruction *parse_jmp_instruction(Parser *parser);
-static Instruction *parse_mov_instruction(Parser *parser);
-static Instruction *parse_pop_instruction(Parser *parser);
-static Instruction *parse_push_instruction(Parser *parser);
-static Instruction *parse_sub_instruction(Parser *parser);
-static Instruction *parse_ret_instruction(Parser *parser);
-static Instruction *parse_xor_instruction(Parser *parser);
+static Instruction *parse_label_instruction(Parser *parser, const ParseRule *rule);
+static Instruction *parse_align_instruction(Parser *parser, const ParseRule *rule);
+static Instruction *parse_empty_instruction(Parser *parser, const ParseRule *rule);
+static Instruction *parse_unary_instruction(Parser *parser, const ParseRule *rule);
+static Instruction *parse_binary_instruction(Parser *parser, const ParseRule *rule);
+static Instruction *parse_ternary_instruction(Parser *parser, const ParseRule *rule);
 static Instruction *parse_instruction(Parser *parser);
+
+static const ParseRule rules[EOF_TOKEN_TYPE + 1] = {
+    [IDENTIFIER_TOKEN_TYPE] = {parse_label_instruction, LABEL_INSTRUCTION_TYPE, 0, 0},
+    [ALIGN_TOKEN_TYPE] = {parse_align_instruction, ALIGN_INSTRUCTION_TYPE, LITERAL_OPERAND, 0},
+    [P2ALIGN_TOKEN_TYPE] = {parse_align_instruction, ALIGN_INSTRUCTION_TYPE, LITERAL_OPERAND, 0},
+    [ADD_TOKEN_TYPE] = {parse_binary_instruction, ADD_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND | IMMEDIATE_OPERAND},
+    [CALL_TOKEN_TYPE] = {parse_unary_instruction, CALL_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [CMP_TOKEN_TYPE] = {parse_binary_instruction, CMP_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND | IMMEDIATE_OPERAND},
+    [IDIV_TOKEN_TYPE] = {parse_unary_instruction, IDIV_INSTRUCTION_TYPE, REGISTER_OPERAND, 0},
+    [IMUL_TOKEN_TYPE] = {parse_binary_instruction, IMUL_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND},
+    [JE_TOKEN_TYPE] = {parse_unary_instruction, JE_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JNE_TOKEN_TYPE] = {parse_unary_instruction, JNE_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JG_TOKEN_TYPE] = {parse_unary_instruction, JG_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JL_TOKEN_TYPE] = {parse_unary_instruction, JL_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JGE_TOKEN_TYPE] = {parse_unary_instruction, JGE_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JLE_TOKEN_TYPE] = {parse_unary_instruction, JLE_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [JMP_TOKEN_TYPE] = {parse_unary_instruction, JMP_INSTRUCTION_TYPE, LABEL_OPERAND, 0},
+    [MOV_TOKEN_TYPE] = {parse_binary_instruction, MOV_INSTRUCTION_TYPE, REGISTER_OPERAND | MEMORY_OPERAND, REGISTER_OPERAND | IMMEDIATE_OPERAND | QWORD_LITERAL_OPERAND | MEMORY_OPERAND},
+    [POP_TOKEN_TYPE] = {parse_unary_instruction, POP_INSTRUCTION_TYPE, REGISTER_OPERAND, 0},
+    [PUSH_TOKEN_TYPE] = {parse_unary_instruction, PUSH_INSTRUCTION_TYPE, REGISTER_OPERAND, 0},
+    [SUB_TOKEN_TYPE] = {parse_binary_instruction, SUB_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND | IMMEDIATE_OPERAND},
+    [RET_TOKEN_TYPE] = {parse_empty_instruction, RET_INSTRUCTION_TYPE, 0, 0},
+    [TZCNT_TOKEN_TYPE] = {parse_binary_instruction, TZCNT_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND},
+    [XOR_TOKEN_TYPE] = {parse_binary_instruction, XOR_INSTRUCTION_TYPE, REGISTER_OPERAND, REGISTER_OPERAND | IMMEDIATE_OPERAND},
+    [MOVDQU_TOKEN_TYPE] = {parse_binary_instruction, MOVDQU_INSTRUCTION_TYPE, XMM_OPERAND | MEMORY_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [MOVQ_TOKEN_TYPE] = {parse_binary_instruction, MOVQ_INSTRUCTION_TYPE, REGISTER_OPERAND | XMM_OPERAND, REGISTER_OPERAND | XMM_OPERAND},
+    [PADDD_TOKEN_TYPE] = {parse_binary_instruction, PADDD_INSTRUCTION_TYPE, XMM_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [PADDQ_TOKEN_TYPE] = {parse_binary_instruction, PADDQ_INSTRUCTION_TYPE, XMM_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [PCMPEQB_TOKEN_TYPE] = {parse_binary_instruction, PCMPEQB_INSTRUCTION_TYPE, XMM_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [PMOVMSKB_TOKEN_TYPE] = {parse_binary_instruction, PMOVMSKB_INSTRUCTION_TYPE, REGISTER_OPERAND, XMM_OPERAND},
+    [PXOR_TOKEN_TYPE] = {parse_binary_instruction, PXOR_INSTRUCTION_TYPE, XMM_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [VMOVDQU_TOKEN_TYPE] = {parse_binary_instruction, VMOVDQU_INSTRUCTION_TYPE, VECTOR_OPERAND | MEMORY_OPERAND, VECTOR_OPERAND | MEMORY_OPERAND},
+    [VPADDD_TOKEN_TYPE] = {parse_ternary_instruction, VPADDD_INSTRUCTION_TYPE, VECTOR_OPERAND, VECTOR_OPERAND | MEMORY_OPERAND},
+    [VPADDQ_TOKEN_TYPE] = {parse_ternary_instruction, VPADDQ_INSTRUCTION_TYPE, VECTOR_OPERAND, VECTOR_OPERAND | MEMORY_OPERAND},
+    [VPBROADCASTB_TOKEN_TYPE] = {parse_binary_instruction, VPBROADCASTB_INSTRUCTION_TYPE, VECTOR_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [VPBROADCASTD_TOKEN_TYPE] = {parse_binary_instruction, VPBROADCASTD_INSTRUCTION_TYPE, VECTOR_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [VPBROADCASTQ_TOKEN_TYPE] = {parse_binary_instruction, VPBROADCASTQ_INSTRUCTION_TYPE, VECTOR_OPERAND, XMM_OPERAND | MEMORY_OPERAND},
+    [VPCMPEQB_TOKEN_TYPE] = {parse_ternary_instruction, VPCMPEQB_INSTRUCTION_TYPE, VECTOR_OPERAND, VECTOR_OPERAND | MEMORY_OPERAND},
+    [VPMOVMSKB_TOKEN_TYPE] = {parse_binary_instruction, VPMOVMSKB_INSTRUCTION_TYPE, REGISTER_OPERAND, VECTOR_OPERAND},
+    [VPXOR_TOKEN_TYPE] = {parse_ternary_instruction, VPXOR_INSTRUCTION_TYPE, VECTOR_OPERAND, VECTOR_OPERAND | MEMORY_OPERAND},
+    [VZEROUPPER_TOKEN_TYPE] = {parse_empty_instruction, VZEROUPPER_INSTRUCTION_TYPE, 0, 0},
+};
 //------------------------------------------------------------
 //                 PRIVATE IMPLEMENTATOIN                   //
 //------------------------------------------------------------
@@ -53,13 +118,15 @@ static void error(Parser *parser, Token *token, char *fmt, ...){
     va_list args;
     va_start(args, fmt);
 
+    TokenLocation location = lexer_token_location(parser->lexer, token);
+
     fprintf(
 		stderr,
 		"PARSER ERROR - from line(col: %"PRId32"): %"PRId32", to line(col: %"PRId32"): %"PRId32":\n\t",
-		token->start_col,
-		token->start_line,
-		token->end_col,
-		token->end_line
+		location.start_col,
+		location.start_line,
+		location.end_col,
+		location.end_line
 	);
     vfprintf(stderr, fmt, args);
     fprintf(stderr, "\n");
@@ -69,16 +136,26 @@ static void error(Parser *parser, Token *token, char *fmt, ...){
     longjmp(parser->err_buf, 1);
 }
 
+// Tokens handed out by peek, previous and advance live in the ring,
+// they must be copied before they are kept
+#define RING_SLOT(_index) (&parser->ring[(_index) & (PARSER_RING_SIZE - 1)])
+
+_Static_assert((PARSER_RING_SIZE & (PARSER_RING_SIZE - 1)) == 0, "ring size must be a power of two");
+
 static inline Token *peek(const Parser *parser){
-    return (Token *)dynarr_get_ptr(parser->current, parser->tokens);
+    return (Token *)RING_SLOT(parser->current);
 }
 
 static inline Token *previous(const Parser *parser){
-    return (Token *)dynarr_get_ptr(parser->current - 1, parser->tokens);
+    return (Token *)RING_SLOT(parser->current - 1);
 }
 
 static inline Token *advance(Parser *parser){
-    return (Token *)dynarr_get_ptr(parser->current++, parser->tokens);
+    Token *token = RING_SLOT(parser->current++);
+
+    lexer_next(parser->lexer, RING_SLOT(parser->current));
+
+    return token;
 }
 
 static inline int is_at_end(const Parser *parser){
@@ -86,30 +163,6 @@ static inline int is_at_end(const Parser *parser){
     return token->type == EOF_TOKEN_TYPE;
 }
 
-static int match(Parser *parser, size_t types_count, ...){
-    va_list args;
-    va_start(args, types_count);
-
-    const Token *token = peek(parser);
-
-    for (size_t i = 0; i < types_count; i++){
-        TokenType type = va_arg(args, TokenType);
-
-        if(type == token->type){
-            advance(parser);
-            return 1;
-        }
-    }
-
-    va_end(args);
-
-    return 0;
-}
-
-static inline int check(Parser *parser, TokenType type){
-    return peek(parser)->type == type;
-}
-
 static Token *consume(Parser *parser, TokenType type, char *fmt, ...){
     Token *token = peek(parser);
 
@@ -121,13 +174,15 @@ static Token *consume(Parser *parser, TokenType type, char *fmt, ...){
     va_list args;
     va_start(args, fmt);
 
+    TokenLocation location = lexer_token_location(parser->lexer, token);
+
     fprintf(
 		stderr,
 		"PARSER ERROR - from line(col: %"PRId32"): %"PRId32", to line(col: %"PRId32"): %"PRId32":\n\t",
-		token->start_col,
-		token->start_line,
-		token->end_col,
-		token->end_line
+		location.start_col,
+		location.start_line,
+		location.end_col,
+		location.end_line
 	);
     vfprintf(stderr, fmt, args);
     fprintf(stderr, "\n");
@@ -139,27 +194,147 @@ static Token *consume(Parser *parser, TokenType type, char *fmt, ...){
     return NULL;
 }
 
-X64Register token_to_register(Token *token){
-    if(strncmp("rax", token->lexeme, 3) == 0)      return RAX;
-    else if(strncmp("rcx", token->lexeme, 3) == 0) return RCX;
-    else if(strncmp("rdx", token->lexeme, 3) == 0) return RDX;
-    else if(strncmp("rbx", token->lexeme, 3) == 0) return RBX;
-    else if(strncmp("rsp", token->lexeme, 3) == 0) return RSP;
-    else if(strncmp("rbp", token->lexeme, 3) == 0) return RBP;
-    else if(strncmp("rsi", token->lexeme, 3) == 0) return RSI;
-    else if(strncmp("rdi", token->lexeme, 3) == 0) return RDI;
-    else if(strncmp("r8", token->lexeme, 3) == 0)  return R8;
-    else if(strncmp("r9", token->lexeme, 3) == 0)  return R9;
-    else if(strncmp("r10", token->lexeme, 3) == 0) return R10;
-    else if(strncmp("r11", token->lexeme, 3) == 0) return R11;
-    else if(strncmp("r12", token->lexeme, 3) == 0) return R12;
-    else if(strncmp("r13", token->lexeme, 3) == 0) return R13;
-    else if(strncmp("r14", token->lexeme, 3) == 0) return R14;
-    else if(strncmp("r15", token->lexeme, 3) == 0) return R15;
-
-    assert(0 && "Illegal token type");
-
-    return -1;
+static Token *consume_operand(Parser *parser, uint64_t operands, const Token *instruction_token){
+    Token *token = peek(parser);
+
+    if(operands & OPERAND(token->type)){
+        advance(parser);
+        return token;
+    }
+
+    if(token->type == QWORD_TYPE_TOKEN_TYPE && (operands & LITERAL_OPERAND)){
+        error(
+            parser,
+            token,
+            "Literal '%.*s' does not fit in 32 bits, only 'mov' takes 64 bits literals",
+            CURRENT_LEXEME
+        );
+    }
+
+    switch (operands){
+        case REGISTER_OPERAND:{
+            error(parser, token, "Expect register, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case REGISTER_OPERAND | IMMEDIATE_OPERAND:
+         case REGISTER_OPERAND | IMMEDIATE_OPERAND | QWORD_LITERAL_OPERAND:{
+            error(parser, token, "Expect literal or register, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case REGISTER_OPERAND | MEMORY_OPERAND:{
+            error(parser, token, "Expect register or memory operand, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case REGISTER_OPERAND | IMMEDIATE_OPERAND | QWORD_LITERAL_OPERAND | MEMORY_OPERAND:{
+            error(parser, token, "Expect literal, register or memory operand, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case REGISTER_OPERAND | XMM_OPERAND:{
+            error(parser, token, "Expect register or xmm register, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case XMM_OPERAND:{
+            error(parser, token, "Expect xmm register, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case XMM_OPERAND | MEMORY_OPERAND:{
+            error(parser, token, "Expect xmm register or memory operand, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case VECTOR_OPERAND:{
+            error(parser, token, "Expect xmm or ymm register, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case VECTOR_OPERAND | MEMORY_OPERAND:{
+            error(parser, token, "Expect xmm register, ymm register or memory operand, but got: '%.*s'", CURRENT_LEXEME);
+            break;
+        }case LITERAL_OPERAND:{
+            error(
+                parser,
+                token,
+                "Expect literal after '%.*s' directive, but got: '%.*s'",
+                LEXEME(instruction_token),
+                CURRENT_LEXEME
+            );
+            break;
+        }case LABEL_OPERAND:{
+            error(
+                parser,
+                token,
+                "Expect label name after '%.*s' instruction, but got: '%.*s'",
+                LEXEME(instruction_token),
+                CURRENT_LEXEME
+            );
+            break;
+        }default:{
+            assert(0 && "Illegal operands");
+        }
+    }
+
+    return NULL;
+}
+
+// '[base]', '[base + displacement]' or '[base - displacement]'. The
+// operand token spans from '[' to ']'
+Location *parse_memory_operand(Parser *parser, Token *out_token){
+    Token left_token = *advance(parser);
+    Token base_token = *consume(
+        parser,
+        REGISTER_TOKEN_TYPE,
+        "Expect base register after '[', but got: '%.*s'",
+        CURRENT_LEXEME
+    );
+    Token *token = peek(parser);
+    int64_t displacement = 0;
+
+    if(token->type == PLUS_TOKEN_TYPE || token->type == MINUS_TOKEN_TYPE){
+        int negative = token->type == MINUS_TOKEN_TYPE;
+
+        advance(parser);
+
+        Token *displacement_token = peek(parser);
+        int64_t literal = displacement_token->literal;
+
+        if(displacement_token->type != DWORD_TYPE_TOKEN_TYPE &&
+           displacement_token->type != QWORD_TYPE_TOKEN_TYPE){
+            error(parser, displacement_token, "Expect displacement, but got: '%.*s'", CURRENT_LEXEME);
+        }
+
+        // Literals far out of the int32 range are not negated, they could
+        // overflow. '- 2147483648' fits even though its literal does not
+        int fits = literal >= INT32_MIN && literal <= (int64_t)INT32_MAX + 1;
+
+        if(fits){
+            displacement = negative ? -literal : literal;
+        }
+
+        if(!fits || displacement < INT32_MIN || displacement > INT32_MAX){
+            error(parser, displacement_token, "Displacement does not fit in 32 bits");
+        }
+
+        advance(parser);
+    }else if(token->type == DWORD_TYPE_TOKEN_TYPE && token->literal < 0){
+        // The lexer takes the '-' of '[rbp -8]' as the sign of the literal
+        displacement = token->literal;
+        advance(parser);
+    }
+
+    Token right_token = *consume(
+        parser,
+        RIGHT_BRACKET_TOKEN_TYPE,
+        "Expect ']' after memory operand, but got: '%.*s'",
+        CURRENT_LEXEME
+    );
+
+    *out_token = (Token){
+        .offset = left_token.offset,
+        .len = (uint16_t)(right_token.offset + right_token.len - left_token.offset),
+        .type = LEFT_BRACKET_TOKEN_TYPE
+    };
+
+    return create_memory_location(parser, base_token.reg, (int32_t)displacement);
+}
+
+Location *parse_operand(Parser *parser, uint64_t operands, const Token *instruction_token, Token *out_token){
+    if((operands & MEMORY_OPERAND) && peek(parser)->type == LEFT_BRACKET_TOKEN_TYPE){
+        return parse_memory_operand(parser, out_token);
+    }
+
+    *out_token = *consume_operand(parser, operands, instruction_token);
+
+    return token_to_location(parser, out_token);
 }
 
 Location *create_register_location(Parser *parser, X64Register reg){
@@ -181,7 +356,7 @@ Location *create_label_location(Parser *parser, Token *label_token){
     LabelLocation *label_location = MEMORY_NEW(
         ALLOCATOR,
         LabelLocation,
-        label_token
+        *label_token
     );
 
     return MEMORY_NEW(
@@ -192,7 +367,39 @@ Location *create_label_location(Parser *parser, Token *label_token){
     );
 }
 
-Location *create_literal_location(Parser *parser, dword value){
+Location *create_vector_location(Parser *parser, byte reg, byte len){
+    VectorLocation *vector_location = MEMORY_NEW(
+        ALLOCATOR,
+        VectorLocation,
+        reg,
+        len
+    );
+
+    return MEMORY_NEW(
+        ALLOCATOR,
+        Location,
+        VECTOR_LOCATION_TYPE,
+        vector_location
+    );
+}
+
+Location *create_memory_location(Parser *parser, X64Register base, int32_t displacement){
+    MemoryLocation *memory_location = MEMORY_NEW(
+        ALLOCATOR,
+        MemoryLocation,
+        base,
+        displacement
+    );
+
+    return MEMORY_NEW(
+        ALLOCATOR,
+        Location,
+        MEMORY_LOCATION_TYPE,
+        memory_location
+    );
+}
+
+Location *create_literal_location(Parser *parser, qword value){
     LiteralLocation *literal_location = MEMORY_NEW(
         ALLOCATOR,
         LiteralLocation,
@@ -209,15 +416,25 @@ Location *create_literal_location(Parser *parser, dword value){
 
 Location *token_to_location(Parser *parser, Token *location_token){
     switch (location_token->type){
-        case DWORD_TYPE_TOKEN_TYPE:{
-            dword value = *(dword *)location_token->literal;
+        case DWORD_TYPE_TOKEN_TYPE:
+        case QWORD_TYPE_TOKEN_TYPE:{
+            qword value = (qword)location_token->literal;
 
             return create_literal_location(parser, value);
         }case REGISTER_TOKEN_TYPE:{
-            X64Register reg = token_to_register(location_token);
+            X64Register reg = location_token->reg;
 
             return create_register_location(parser, reg);
-        }case IDENTIFIER_TOKEN_TYPE:{
+        }case XMM_REGISTER_TOKEN_TYPE:{
+            return create_vector_location(parser, (byte)location_token->reg, 16);
+        }case YMM_REGISTER_TOKEN_TYPE:{
+            return create_vector_location(parser, (byte)location_token->reg, 32);
+        }case REGISTER_HOLE_TOKEN_TYPE:{
+            return create_register_location(parser, HOLE_REGISTER);
+        }case IMMEDIATE_HOLE_TOKEN_TYPE:{
+            return create_literal_location(parser, 0);
+        }case IDENTIFIER_TOKEN_TYPE:
+         case TARGET_HOLE_TOKEN_TYPE:{
             return create_label_location(parser, location_token);
         }default:{
             assert("Illegal token type");
@@ -227,13 +444,13 @@ Location *token_to_location(Parser *parser, Token *location_token){
     return NULL;
 }
 
-Instruction *parse_label_instruction(Parser *parser){
-	Token *label_token = previous(parser);
+Instruction *parse_label_instruction(Parser *parser, const ParseRule *rule){
+	Token label_token = *previous(parser);
 
     consume(
         parser,
         COLON_TOKEN_TYPE,
-        "Expect ':' token after label, but got: '%s'",
+        "Expect ':' token after label, but got: '%.*s'",
         CURRENT_LEXEME
     );
 
@@ -248,50 +465,49 @@ Instruction *parse_label_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        LABEL_INSTRUCTION_TYPE,
-        instruction
+        rule->type,
+        instruction,
+        0,
+        0
     );
 }
 
-Instruction *parse_add_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    consume(
-        parser,
-        COMMA_TOKEN_TYPE,
-        "Expect ',', but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    Token *src_token = NULL;
+Instruction *parse_align_instruction(Parser *parser, const ParseRule *rule){
+	Token instruction_token = *previous(parser);
+    Token value_token = *consume_operand(parser, rule->dst_operands, &instruction_token);
+    int32_t value = (int32_t)value_token.literal;
+    dword alignment = 0;
+
+    if(instruction_token.type == P2ALIGN_TOKEN_TYPE){
+        if(value < 0 || value > 12){
+            error(
+                parser,
+                &value_token,
+                "Expect power of two exponent between 0 and 12, but got: %"PRId32,
+                value
+            );
+        }
 
-    if(match(parser, 2, DWORD_TYPE_TOKEN_TYPE, REGISTER_TOKEN_TYPE)){
-        src_token = previous(parser);
-    }
+        alignment = ((dword)1) << value;
+    }else{
+        if(value < 1 || value > 4096 || (value & (value - 1)) != 0){
+            error(
+                parser,
+                &value_token,
+                "Expect power of two alignment between 1 and 4096, but got: %"PRId32,
+                value
+            );
+        }
 
-    if(!src_token){
-        error(
-            parser,
-            peek(parser),
-            "Expect literal or register, but got: '%s'",
-            CURRENT_LEXEME
-        );
+        alignment = (dword)value;
     }
 
-    BinaryInstruction *instruction = MEMORY_NEW(
+    AlignInstruction *instruction = MEMORY_NEW(
         ALLOCATOR,
-        BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
-        instruction_token,
-        dst_token,
-        src_token
+        AlignInstruction,
+        alignment,
+        alignment - 1,
+        instruction_token
     );
 
     return MEMORY_NEW(
@@ -299,77 +515,18 @@ Instruction *parse_add_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        ADD_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_call_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *label_token = consume(
-        parser,
-        IDENTIFIER_TOKEN_TYPE,
-        "Expect label after instruction, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    UnaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        UnaryInstruction,
-        token_to_location(parser, label_token),
-        instruction_token,
-        label_token,
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
+        rule->type,
+        instruction,
         0,
-        0,
-        CALL_INSTRUCTION_TYPE,
-        instruction
+        0
     );
 }
 
-Instruction *parse_cmp_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    consume(
-        parser,
-        COMMA_TOKEN_TYPE,
-        "Expect ',' token after dest operand, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    Token *src_token = NULL;
-
-    if(match(parser, 2, DWORD_TYPE_TOKEN_TYPE, REGISTER_TOKEN_TYPE)){
-        src_token = previous(parser);
-    }
-
-    if(!src_token){
-        error(
-            parser,
-            instruction_token,
-            "Expect immediate value or register after ',' token as source operand, but got: '%s'",
-            CURRENT_LEXEME
-        );
-    }
-
-    BinaryInstruction *instruction = MEMORY_NEW(
+Instruction *parse_empty_instruction(Parser *parser, const ParseRule *rule){
+	EmptyInstruction *instruction = MEMORY_NEW(
         ALLOCATOR,
-        BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
-        instruction_token,
-        dst_token,
-        src_token
+        EmptyInstruction,
+        *previous(parser)
     );
 
     return MEMORY_NEW(
@@ -377,26 +534,24 @@ Instruction *parse_cmp_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        CMP_INSTRUCTION_TYPE,
-        instruction
+        rule->type,
+        instruction,
+        0,
+        0
     );
 }
 
-Instruction *parse_idiv_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *src_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
+Instruction *parse_unary_instruction(Parser *parser, const ParseRule *rule){
+	Token instruction_token = *previous(parser);
+    Token operand_token;
+    Location *location = parse_operand(parser, rule->dst_operands, &instruction_token, &operand_token);
 
     UnaryInstruction *instruction = MEMORY_NEW(
         ALLOCATOR,
         UnaryInstruction,
-        token_to_location(parser, src_token),
+        location,
         instruction_token,
-        src_token,
+        operand_token,
     );
 
     return MEMORY_NEW(
@@ -404,48 +559,33 @@ Instruction *parse_idiv_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        IDIV_INSTRUCTION_TYPE,
-        instruction
+        rule->type,
+        instruction,
+        0,
+        0
     );
 }
 
-Instruction *parse_imul_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
+Instruction *parse_binary_instruction(Parser *parser, const ParseRule *rule){
+	Token instruction_token = *previous(parser);
+    Token dst_token;
+    Location *dst_location = parse_operand(parser, rule->dst_operands, &instruction_token, &dst_token);
 
     consume(
         parser,
         COMMA_TOKEN_TYPE,
-        "Expect ',', but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    Token *src_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
+        "Expect ',', but got: '%.*s'",
         CURRENT_LEXEME
     );
 
-    if(!src_token){
-        error(
-            parser,
-            peek(parser),
-            "Expect literal or register, but got: '%s'",
-            CURRENT_LEXEME
-        );
-    }
+    Token src_token;
+    Location *src_location = parse_operand(parser, rule->src_operands, &instruction_token, &src_token);
 
     BinaryInstruction *instruction = MEMORY_NEW(
         ALLOCATOR,
         BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
+        dst_location,
+        src_location,
         instruction_token,
         dst_token,
         src_token
@@ -456,233 +596,48 @@ Instruction *parse_imul_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        IMUL_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_jcc_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *label_token = consume(
-        parser,
-        IDENTIFIER_TOKEN_TYPE,
-        "Expect label name after '%s' instruction, but got: '%s'",
-        instruction_token->lexeme,
-        CURRENT_LEXEME
-    );
-
-    UnaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        UnaryInstruction,
-        token_to_location(parser, label_token),
-        instruction_token,
-        label_token,
-    );
-
-    InstructionType type;
-
-    switch (instruction_token->type){
-        case JE_TOKEN_TYPE:{
-            type = JE_INSTRUCTION_TYPE;
-            break;
-        }case JG_TOKEN_TYPE:{
-            type = JG_INSTRUCTION_TYPE;
-            break;
-        }case JL_TOKEN_TYPE:{
-            type = JL_INSTRUCTION_TYPE;
-            break;
-        }case JGE_TOKEN_TYPE:{
-            type = JGE_INSTRUCTION_TYPE;
-            break;
-        }case JLE_TOKEN_TYPE:{
-            type = JLE_INSTRUCTION_TYPE;
-            break;
-        }default:{
-            assert(0 && "Illegal token type");
-        }
-    }
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
-        0,
-        type,
-        instruction
-    );
-}
-
-Instruction *parse_jmp_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *label_token = consume(
-        parser,
-        IDENTIFIER_TOKEN_TYPE,
-        "Expect label name after jmp instruction, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    UnaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        UnaryInstruction,
-        token_to_location(parser, label_token),
-        instruction_token,
-        label_token,
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
+        rule->type,
+        instruction,
         0,
-        JMP_INSTRUCTION_TYPE,
-        instruction
+        0
     );
 }
 
-Instruction *parse_mov_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register as destination operand, but got: '%s'",
-        CURRENT_LEXEME
-    );
+Instruction *parse_ternary_instruction(Parser *parser, const ParseRule *rule){
+	Token instruction_token = *previous(parser);
+    Token dst_token;
+    Location *dst_location = parse_operand(parser, rule->dst_operands, &instruction_token, &dst_token);
 
     consume(
         parser,
         COMMA_TOKEN_TYPE,
-        "Expect ',' after destination operand, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    Token *src_token = NULL;
-
-    if(match(parser, 2, DWORD_TYPE_TOKEN_TYPE, REGISTER_TOKEN_TYPE)){
-        src_token = previous(parser);
-    }
-
-    if(!src_token){
-        error(
-            parser,
-            peek(parser),
-            "Expect literal or register as source operand, but got: '%s'",
-            CURRENT_LEXEME
-        );
-    }
-
-    BinaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
-        instruction_token,
-        dst_token,
-        src_token
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
-        0,
-        MOV_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_pop_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register as destination operand, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    UnaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        UnaryInstruction,
-        token_to_location(parser, dst_token),
-        instruction_token,
-        dst_token,
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
-        0,
-        POP_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_push_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *src_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register as source operand, but got: '%s'",
+        "Expect ',', but got: '%.*s'",
         CURRENT_LEXEME
     );
 
-    UnaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        UnaryInstruction,
-        token_to_location(parser, src_token),
-        instruction_token,
-        src_token,
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
-        0,
-        PUSH_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_sub_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
+    Token src1_token;
+    Location *src1_location = parse_operand(parser, rule->dst_operands, &instruction_token, &src1_token);
 
     consume(
         parser,
         COMMA_TOKEN_TYPE,
-        "Expect ',', but got: '%s'",
+        "Expect ',', but got: '%.*s'",
         CURRENT_LEXEME
     );
 
-    Token *src_token = NULL;
-
-    if(match(parser, 2, DWORD_TYPE_TOKEN_TYPE, REGISTER_TOKEN_TYPE)){
-        src_token = previous(parser);
-    }
+    Token src2_token;
+    Location *src2_location = parse_operand(parser, rule->src_operands, &instruction_token, &src2_token);
 
-    if(!src_token){
-        error(
-            parser,
-            peek(parser),
-            "Expect literal or register, but got: '%s'",
-            CURRENT_LEXEME
-        );
-    }
-
-    BinaryInstruction *instruction = MEMORY_NEW(
+    TernaryInstruction *instruction = MEMORY_NEW(
         ALLOCATOR,
-        BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
+        TernaryInstruction,
+        dst_location,
+        src1_location,
+        src2_location,
         instruction_token,
         dst_token,
-        src_token
+        src1_token,
+        src2_token
     );
 
     return MEMORY_NEW(
@@ -690,152 +645,37 @@ Instruction *parse_sub_instruction(Parser *parser){
         Instruction,
         0,
         0,
-        SUB_INSTRUCTION_TYPE,
-        instruction
-    );
-}
-
-Instruction *parse_ret_instruction(Parser *parser){
-	EmptyInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        EmptyInstruction,
-        previous(parser)
-    );
-
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
+        rule->type,
+        instruction,
         0,
-        RET_INSTRUCTION_TYPE,
-        instruction
+        0
     );
 }
 
-Instruction *parse_xor_instruction(Parser *parser){
-	Token *instruction_token = previous(parser);
-    Token *dst_token = consume(
-        parser,
-        REGISTER_TOKEN_TYPE,
-        "Expect register, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    consume(
-        parser,
-        COMMA_TOKEN_TYPE,
-        "Expect ',', but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    Token *src_token = NULL;
-
-    if(match(parser, 2, DWORD_TYPE_TOKEN_TYPE, REGISTER_TOKEN_TYPE)){
-        src_token = previous(parser);
-    }
+Instruction *parse_instruction(Parser *parser){
+    Token *token = peek(parser);
+    const ParseRule *rule = &rules[token->type];
 
-    if(!src_token){
+    if(!rule->parse){
         error(
             parser,
-            peek(parser),
-            "Expect literal or register, but got: '%s'",
+            token,
+            "Expect instruction, but got: '%.*s'",
             CURRENT_LEXEME
         );
     }
 
-    BinaryInstruction *instruction = MEMORY_NEW(
-        ALLOCATOR,
-        BinaryInstruction,
-        token_to_location(parser, dst_token),
-        token_to_location(parser, src_token),
-        instruction_token,
-        dst_token,
-        src_token
-    );
+    uint32_t source_offset = token->offset;
 
-    return MEMORY_NEW(
-        ALLOCATOR,
-        Instruction,
-        0,
-        0,
-        XOR_INSTRUCTION_TYPE,
-        instruction
-    );
-}
+    advance(parser);
 
-Instruction *parse_instruction(Parser *parser){
-    if(match(parser, 1, IDENTIFIER_TOKEN_TYPE)){
-    	return parse_label_instruction(parser);
-    }
-
-    if(match(parser, 1, ADD_TOKEN_TYPE)){
-    	return parse_add_instruction(parser);
-    }
-
-    if(match(parser, 1, CALL_TOKEN_TYPE)){
-    	return parse_call_instruction(parser);
-    }
+    Instruction *instruction = rule->parse(parser, rule);
+    Token *last_token = previous(parser);
 
-    if(match(parser, 1, CMP_TOKEN_TYPE)){
-        return parse_cmp_instruction(parser);
-    }
-
-    if(match(parser, 1, IDIV_TOKEN_TYPE)){
-    	return parse_idiv_instruction(parser);
-    }
+    instruction->source_offset = source_offset;
+    instruction->source_len = last_token->offset + last_token->len - source_offset;
 
-    if(match(parser, 1, IMUL_TOKEN_TYPE)){
-    	return parse_imul_instruction(parser);
-    }
-
-    if(match(
-    	parser,
-     	5,
-      	JE_TOKEN_TYPE,
-       	JG_TOKEN_TYPE,
-        JL_TOKEN_TYPE,
-        JGE_TOKEN_TYPE,
-        JLE_TOKEN_TYPE
-    )){
-        return parse_jcc_instruction(parser);
-    }
-
-    if(match(parser, 1, JMP_TOKEN_TYPE)){
-    	return parse_jmp_instruction(parser);
-    }
-
-    if(match(parser, 1, MOV_TOKEN_TYPE)){
-    	return parse_mov_instruction(parser);
-    }
-
-    if(match(parser, 1, POP_TOKEN_TYPE)){
-    	return parse_pop_instruction(parser);
-    }
-
-    if(match(parser, 1, PUSH_TOKEN_TYPE)){
-    	return parse_push_instruction(parser);
-    }
-
-    if(match(parser, 1, SUB_TOKEN_TYPE)){
-    	return parse_sub_instruction(parser);
-    }
-
-    if(match(parser, 1, RET_TOKEN_TYPE)){
-        return parse_ret_instruction(parser);
-    }
-
-    if(match(parser, 1, XOR_TOKEN_TYPE)){
-    	return parse_xor_instruction(parser);
-    }
-
-    error(
-        parser,
-        peek(parser),
-        "Expect instruction, but got: '%s'",
-        CURRENT_LEXEME
-    );
-
-    return NULL;
+    return instruction;
 }
 //------------------------------------------------------------
 //                  PUBLIC IMPLEMENTATOIN                   //
@@ -860,10 +700,17 @@ void parser_destroy(Parser *parser){
     MEMORY_DEALLOC(parser, Parser, 1, parser->allocator);
 }
 
-int parser_parse(Parser *parser, DynArr *tokens, DynArr *instructions){
+int parser_parse(Parser *parser, Lexer *lexer, DynArr *instructions){
     if(setjmp(parser->err_buf) == 0){
+        // Lexer errors unwind straight out of the parser as well
+        if(setjmp(lexer->err_buf) != 0){
+            return 1;
+        }
+
         parser->current = 0;
-        parser->tokens = tokens;
+        parser->lexer = lexer;
+
+        lexer_next(lexer, peek(parser));
 
         while(!is_at_end(parser)){
             Instruction *instruction = parse_instruction(parser);
@@ -0,0 +1,270 @@
+#include "perfmap.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+// Layout from tools/perf/Documentation/jitdump-specification.txt
+#define JITDUMP_MAGIC      0x4A695444
+#define JITDUMP_VERSION    1
+#define JITDUMP_EM_X86_64  62
+
+#define JIT_CODE_LOAD       0
+#define JIT_CODE_DEBUG_INFO 2
+
+typedef struct jitdump_header{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+}JitDumpHeader;
+
+typedef struct jitdump_record_header{
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+}JitDumpRecordHeader;
+
+// Followed by the NUL terminated name and the code
+typedef struct jitdump_code_load{
+    JitDumpRecordHeader header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+}JitDumpCodeLoad;
+
+// Followed by 'nr_entry' entries
+typedef struct jitdump_debug_info{
+    JitDumpRecordHeader header;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+}JitDumpDebugInfo;
+
+// Followed by the NUL terminated file name
+typedef struct jitdump_debug_entry{
+    uint64_t code_addr;
+    uint32_t line;
+    uint32_t discrim;
+}JitDumpDebugEntry;
+
+#ifdef __linux__
+//------------------------------------------------------------
+//                      PRIVATE INTERFACE                   //
+//------------------------------------------------------------
+static uint64_t timestamp(void);
+static int write_all(int fd, const void *buff, size_t len);
+
+//------------------------------------------------------------
+//                    PRIVATE IMPLEMENTATION                //
+//------------------------------------------------------------
+// 'perf record -k mono' stamps its samples with the same clock
+uint64_t timestamp(void){
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+        return 0;
+    }
+
+    return ((uint64_t)ts.tv_sec * 1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+int write_all(int fd, const void *buff, size_t len){
+    const char *bytes = buff;
+
+    while(len > 0){
+        ssize_t written = write(fd, bytes, len);
+
+        if(written <= 0){
+            return 1;
+        }
+
+        bytes += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------
+//                    PUBLIC IMPLEMENTATION                 //
+//------------------------------------------------------------
+int perf_map_append(size_t symbols_len, const PerfSymbol *symbols){
+    char pathname[64];
+
+    snprintf(pathname, sizeof(pathname), "/tmp/perf-%d.map", (int)getpid());
+
+    FILE *map_file = fopen(pathname, "a");
+
+    if(!map_file){
+        return 1;
+    }
+
+    for (size_t i = 0; i < symbols_len; i++){
+        const PerfSymbol *symbol = &symbols[i];
+
+        fprintf(
+            map_file,
+            "%" PRIxPTR " %zx %.*s\n",
+            symbol->address,
+            symbol->size,
+            (int)symbol->name_len,
+            symbol->name
+        );
+    }
+
+    return fclose(map_file) == 0 ? 0 : 1;
+}
+
+int perf_jitdump_open(const char *dir, PerfJitDump *dump){
+    char pathname[4096];
+    int pid = (int)getpid();
+
+    if(snprintf(pathname, sizeof(pathname), "%s/jit-%d.dump", dir, pid) >= (int)sizeof(pathname)){
+        return 1;
+    }
+
+    int fd = open(pathname, O_CREAT | O_TRUNC | O_RDWR, 0666);
+
+    if(fd == -1){
+        return 1;
+    }
+
+    size_t marker_len = (size_t)sysconf(_SC_PAGESIZE);
+    void *marker = mmap(NULL, marker_len, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+
+    if(marker == MAP_FAILED){
+        close(fd);
+        return 1;
+    }
+
+    JitDumpHeader header = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(JitDumpHeader),
+        .elf_mach = JITDUMP_EM_X86_64,
+        .pad1 = 0,
+        .pid = (uint32_t)pid,
+        .timestamp = timestamp(),
+        .flags = 0
+    };
+
+    if(write_all(fd, &header, sizeof(header))){
+        munmap(marker, marker_len);
+        close(fd);
+        return 1;
+    }
+
+    dump->fd = fd;
+    dump->marker = marker;
+    dump->marker_len = marker_len;
+    dump->code_index = 0;
+
+    return 0;
+}
+
+void perf_jitdump_close(PerfJitDump *dump){
+    munmap(dump->marker, dump->marker_len);
+    close(dump->fd);
+}
+
+int perf_jitdump_code_load(
+    PerfJitDump *dump,
+    const PerfSymbol *symbol,
+    const byte *code,
+    const char *filename,
+    size_t lines_len,
+    const PerfLine *lines
+){
+    int fd = dump->fd;
+    char nul = '\0';
+
+    // Line records must come before the code they describe
+    if(lines_len > 0){
+        size_t filename_size = strlen(filename) + 1;
+        JitDumpDebugInfo debug_info = {
+            .header = {
+                .id = JIT_CODE_DEBUG_INFO,
+                .total_size = (uint32_t)(sizeof(JitDumpDebugInfo) + (sizeof(JitDumpDebugEntry) + filename_size) * lines_len),
+                .timestamp = timestamp()
+            },
+            .code_addr = symbol->address,
+            .nr_entry = lines_len
+        };
+
+        if(write_all(fd, &debug_info, sizeof(debug_info))){
+            return 1;
+        }
+
+        for (size_t i = 0; i < lines_len; i++){
+            JitDumpDebugEntry entry = {
+                .code_addr = lines[i].address,
+                .line = lines[i].line,
+                .discrim = 0
+            };
+
+            if(write_all(fd, &entry, sizeof(entry)) || write_all(fd, filename, filename_size)){
+                return 1;
+            }
+        }
+    }
+
+    JitDumpCodeLoad code_load = {
+        .header = {
+            .id = JIT_CODE_LOAD,
+            .total_size = (uint32_t)(sizeof(JitDumpCodeLoad) + symbol->name_len + 1 + symbol->size),
+            .timestamp = timestamp()
+        },
+        .pid = (uint32_t)getpid(),
+        .tid = (uint32_t)syscall(SYS_gettid),
+        .vma = symbol->address,
+        .code_addr = symbol->address,
+        .code_size = symbol->size,
+        .code_index = dump->code_index++
+    };
+
+    if(write_all(fd, &code_load, sizeof(code_load)) ||
+       write_all(fd, symbol->name, symbol->name_len) ||
+       write_all(fd, &nul, 1) ||
+       write_all(fd, code, symbol->size)){
+        return 1;
+    }
+
+    return 0;
+}
+#else
+int perf_map_append(size_t symbols_len, const PerfSymbol *symbols){
+    return 1;
+}
+
+int perf_jitdump_open(const char *dir, PerfJitDump *dump){
+    return 1;
+}
+
+void perf_jitdump_close(PerfJitDump *dump){}
+
+int perf_jitdump_code_load(
+    PerfJitDump *dump,
+    const PerfSymbol *symbol,
+    const byte *code,
+    const char *filename,
+    size_t lines_len,
+    const PerfLine *lines
+){
+    return 1;
+}
+#endif
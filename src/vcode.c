@@ -0,0 +1,1145 @@
+#include "vcode.h"
+#include "essentials/memory.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define NO_REGISTER -1
+#define NO_POSITION UINT32_MAX
+
+typedef enum vop_type{
+    MOV_IMM_VOP_TYPE,
+    MOV_VOP_TYPE,
+    ADD_VOP_TYPE,
+    ADD_IMM_VOP_TYPE,
+    SUB_VOP_TYPE,
+    SUB_IMM_VOP_TYPE,
+    IMUL_VOP_TYPE,
+    XOR_VOP_TYPE,
+    DIV_VOP_TYPE,
+    REM_VOP_TYPE,
+    CMP_VOP_TYPE,
+    CMP_IMM_VOP_TYPE,
+    BIND_VOP_TYPE,
+    JCC_VOP_TYPE,
+    JMP_VOP_TYPE,
+    CALL_VOP_TYPE,
+    RET_VOP_TYPE,
+}VOpType;
+
+typedef struct vop{
+    VOpType  type;
+    VReg     dst;
+    VReg     src;
+    uint32_t label;
+    uint32_t condition;
+    uint32_t args_offset; // into 'call_args'
+    uint32_t args_len;
+    qword    imm;
+}VOp;
+
+// Ops sit at their index plus one, 0 being the function entry where
+// the arguments are defined. An interval spans from the first to the
+// last op touching its register, stretched over the loops it is live
+// across. 'reg' is NO_REGISTER once spilled to 'slot'
+typedef struct interval{
+    uint32_t start;
+    uint32_t end;
+    int      reg;
+    int      hint;
+    uint32_t slot;
+    byte     used;
+    byte     starts_with_use;
+    byte     crosses_call;
+}Interval;
+
+typedef struct interval_order{
+    uint32_t start;
+    int      hinted;
+    VReg     vreg;
+}IntervalOrder;
+
+typedef struct vcode{
+    MyAss           *myass;
+    VOp             *ops;
+    size_t          ops_len;
+    size_t          ops_capacity;
+    VReg            *call_args;
+    size_t          call_args_len;
+    size_t          call_args_capacity;
+    size_t          vregs_len;
+    VReg            args[VCODE_MAX_ARGS];
+    Interval        *intervals;
+    size_t          intervals_capacity;
+    size_t          spills;
+    uint32_t        used_callee_saved; // mask of registers
+    int             has_calls;
+    int             frame_padding;
+    int             out_of_memory; // set by the builder functions, reported by 'vcode_emit'
+    const Allocator *allocator;
+}VCode;
+
+static const X64Register arg_registers[VCODE_MAX_ARGS] = {RDI, RSI, RDX, RCX, R8, R9};
+static const X64Register caller_saved[] = {R10, R9, R8, RCX, RSI, RDI};
+static const X64Register callee_saved[] = {RBX, R12, R13, R14, R15};
+
+#define CALLER_SAVED_LEN (sizeof(caller_saved) / sizeof(caller_saved[0]))
+#define CALLEE_SAVED_LEN (sizeof(callee_saved) / sizeof(callee_saved[0]))
+
+//------------------------------------------------------------------------------------//
+//                                 PRIVATE INTERFACE                                  //
+//------------------------------------------------------------------------------------//
+static VOp *add_op(VCode *vcode, VOpType type);
+static void add_binary_op(VCode *vcode, VOpType type, VReg dst, VReg src);
+
+static void touch(Interval *interval, uint32_t position, int is_use);
+static int build_intervals(VCode *vcode);
+static int extend_over_loops(VCode *vcode);
+static int mark_call_crossings(VCode *vcode);
+static int compare_interval_orders(const void *a, const void *b);
+static int pick_register(const Interval *interval, uint32_t free_registers);
+static int allocate_registers(VCode *vcode);
+
+static int32_t slot_displacement(uint32_t slot);
+static X64Register load(VCode *vcode, VReg vreg, X64Register scratch);
+static X64Register target(VCode *vcode, VReg vreg);
+static void store(VCode *vcode, VReg vreg, X64Register reg);
+static void parallel_move(VCode *vcode, size_t len, const X64Register *dsts, X64Register *srcs);
+static void emit_prologue(VCode *vcode);
+static void emit_epilogue(VCode *vcode);
+static int emit_call(VCode *vcode, uint32_t position, VOp *op);
+static int emit_op(VCode *vcode, uint32_t position, VOp *op);
+
+//------------------------------------------------------------------------------------//
+//                               PRIVATE IMPLEMENTATION                               //
+//------------------------------------------------------------------------------------//
+// NULL when out of memory, which 'vcode_emit' reports
+VOp *add_op(VCode *vcode, VOpType type){
+    if(vcode->out_of_memory){
+        return NULL;
+    }
+
+    if(vcode->ops_len == vcode->ops_capacity){
+        size_t new_capacity = vcode->ops_capacity == 0 ? 64 : vcode->ops_capacity * 2;
+        VOp *ops = MEMORY_REALLOC(VOp, vcode->ops_capacity, new_capacity, vcode->ops, vcode->allocator);
+
+        if(!ops){
+            vcode->out_of_memory = 1;
+            return NULL;
+        }
+
+        vcode->ops = ops;
+        vcode->ops_capacity = new_capacity;
+    }
+
+    VOp *op = &vcode->ops[vcode->ops_len++];
+
+    *op = (VOp){
+        .type = type,
+        .dst = VCODE_NO_VREG,
+        .src = VCODE_NO_VREG,
+        .label = 0,
+        .condition = 0,
+        .args_offset = 0,
+        .args_len = 0,
+        .imm = 0
+    };
+
+    return op;
+}
+
+void add_binary_op(VCode *vcode, VOpType type, VReg dst, VReg src){
+    assert(dst < vcode->vregs_len && src < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, type);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = dst;
+    op->src = src;
+}
+
+// Positions only grow, so the last touch is the end
+void touch(Interval *interval, uint32_t position, int is_use){
+    if(!interval->used){
+        interval->used = 1;
+        interval->start = position;
+        interval->starts_with_use = (byte)is_use;
+    }
+
+    interval->end = position;
+}
+
+int build_intervals(VCode *vcode){
+    Interval *intervals = vcode->intervals;
+
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        intervals[i] = (Interval){
+            .start = 0,
+            .end = 0,
+            .reg = NO_REGISTER,
+            .hint = NO_REGISTER,
+            .slot = 0,
+            .used = 0,
+            .starts_with_use = 0,
+            .crosses_call = 0
+        };
+    }
+
+    for (size_t i = 0; i < VCODE_MAX_ARGS; i++){
+        VReg arg = vcode->args[i];
+
+        if(arg == VCODE_NO_VREG){
+            continue;
+        }
+
+        touch(&intervals[arg], 0, 0);
+
+        // rdx is a scratch register, so its argument is moved out of it
+        if(arg_registers[i] != RDX){
+            intervals[arg].hint = arg_registers[i];
+        }
+    }
+
+    for (size_t i = 0; i < vcode->ops_len; i++){
+        VOp *op = &vcode->ops[i];
+        uint32_t position = (uint32_t)i + 1;
+
+        switch (op->type){
+            case MOV_IMM_VOP_TYPE:{
+                touch(&intervals[op->dst], position, 0);
+                break;
+            }case MOV_VOP_TYPE:{
+                touch(&intervals[op->src], position, 1);
+                touch(&intervals[op->dst], position, 0);
+                break;
+            }case XOR_VOP_TYPE:{
+                // 'xor r, r' only zeroes its register
+                if(op->dst == op->src){
+                    touch(&intervals[op->dst], position, 0);
+                    break;
+                }
+            }
+            // fallthrough
+            case ADD_VOP_TYPE:
+            case SUB_VOP_TYPE:
+            case IMUL_VOP_TYPE:
+            case DIV_VOP_TYPE:
+            case REM_VOP_TYPE:{
+                touch(&intervals[op->dst], position, 1);
+                touch(&intervals[op->src], position, 1);
+                break;
+            }case ADD_IMM_VOP_TYPE:
+             case SUB_IMM_VOP_TYPE:
+             case CMP_IMM_VOP_TYPE:{
+                touch(&intervals[op->dst], position, 1);
+                break;
+            }case CMP_VOP_TYPE:{
+                touch(&intervals[op->dst], position, 1);
+                touch(&intervals[op->src], position, 1);
+                break;
+            }case CALL_VOP_TYPE:{
+                for (size_t j = 0; j < op->args_len; j++){
+                    touch(&intervals[vcode->call_args[op->args_offset + j]], position, 1);
+                }
+
+                if(op->dst != VCODE_NO_VREG){
+                    touch(&intervals[op->dst], position, 0);
+                }
+
+                break;
+            }case RET_VOP_TYPE:{
+                touch(&intervals[op->src], position, 1);
+                break;
+            }default:{
+                break;
+            }
+        }
+    }
+
+    // A register read before any write is live from the entry
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        if(intervals[i].starts_with_use){
+            intervals[i].start = 0;
+        }
+    }
+
+    return extend_over_loops(vcode) || mark_call_crossings(vcode);
+}
+
+// A backward jump from 'to' to the label at 'from' makes a loop. A
+// register live on entry to the loop or after it leaves is live all
+// over it, since the next iteration may still read it
+int extend_over_loops(VCode *vcode){
+    const Allocator *allocator = vcode->allocator;
+    Interval *intervals = vcode->intervals;
+    uint32_t labels_len = 0;
+
+    for (size_t i = 0; i < vcode->ops_len; i++){
+        VOp *op = &vcode->ops[i];
+
+        if(op->type == BIND_VOP_TYPE && op->label >= labels_len){
+            labels_len = op->label + 1;
+        }
+    }
+
+    if(labels_len == 0){
+        return 0;
+    }
+
+    uint32_t *label_positions = MEMORY_ALLOC(uint32_t, labels_len, allocator);
+    int changed;
+
+    if(!label_positions){
+        return 1;
+    }
+
+    do{
+        changed = 0;
+
+        // Only labels bound before a jump make it a backward one
+        for (uint32_t i = 0; i < labels_len; i++){
+            label_positions[i] = NO_POSITION;
+        }
+
+        for (size_t i = 0; i < vcode->ops_len; i++){
+            VOp *op = &vcode->ops[i];
+            uint32_t position = (uint32_t)i + 1;
+
+            if(op->type == BIND_VOP_TYPE){
+                label_positions[op->label] = position;
+                continue;
+            }
+
+            if((op->type != JCC_VOP_TYPE && op->type != JMP_VOP_TYPE) ||
+               op->label >= labels_len ||
+               label_positions[op->label] == NO_POSITION){
+                continue;
+            }
+
+            uint32_t from = label_positions[op->label];
+
+            for (size_t j = 0; j < vcode->vregs_len; j++){
+                Interval *interval = &intervals[j];
+
+                if(!interval->used || interval->start > position || interval->end < from){
+                    continue;
+                }
+
+                if(interval->start >= from && interval->end <= position){
+                    continue;
+                }
+
+                if(interval->start > from){
+                    interval->start = from;
+                    changed = 1;
+                }
+
+                if(interval->end < position){
+                    interval->end = position;
+                    changed = 1;
+                }
+            }
+        }
+    }while(changed);
+
+    MEMORY_DEALLOC(label_positions, uint32_t, labels_len, allocator);
+
+    return 0;
+}
+
+int mark_call_crossings(VCode *vcode){
+    const Allocator *allocator = vcode->allocator;
+    size_t positions_len = vcode->ops_len + 2;
+    // Calls before each position
+    uint32_t *calls_before = MEMORY_ALLOC(uint32_t, positions_len, allocator);
+    uint32_t calls = 0;
+
+    if(!calls_before){
+        return 1;
+    }
+
+    calls_before[0] = 0;
+
+    for (size_t i = 0; i < vcode->ops_len; i++){
+        calls_before[i + 1] = calls;
+
+        if(vcode->ops[i].type == CALL_VOP_TYPE){
+            calls++;
+        }
+    }
+
+    calls_before[vcode->ops_len + 1] = calls;
+    vcode->has_calls = calls > 0;
+
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        Interval *interval = &vcode->intervals[i];
+
+        // A call at the first or last position only defines or reads it
+        if(interval->used && interval->end > interval->start + 1){
+            interval->crosses_call = calls_before[interval->end] > calls_before[interval->start + 1];
+        }
+    }
+
+    MEMORY_DEALLOC(calls_before, uint32_t, positions_len, allocator);
+
+    return 0;
+}
+
+// Hinted intervals go first, so arguments starting together keep their registers
+int compare_interval_orders(const void *a, const void *b){
+    const IntervalOrder *a_order = a;
+    const IntervalOrder *b_order = b;
+
+    if(a_order->start != b_order->start){
+        return a_order->start < b_order->start ? -1 : 1;
+    }
+
+    if(a_order->hinted != b_order->hinted){
+        return a_order->hinted ? -1 : 1;
+    }
+
+    return a_order->vreg < b_order->vreg ? -1 : a_order->vreg > b_order->vreg;
+}
+
+int pick_register(const Interval *interval, uint32_t free_registers){
+    const X64Register *first = caller_saved;
+    size_t first_len = CALLER_SAVED_LEN;
+    const X64Register *second = callee_saved;
+    size_t second_len = CALLEE_SAVED_LEN;
+
+    if(interval->crosses_call){
+        first = callee_saved;
+        first_len = CALLEE_SAVED_LEN;
+        second = caller_saved;
+        second_len = CALLER_SAVED_LEN;
+    }else if(interval->hint != NO_REGISTER && (free_registers & (1u << interval->hint))){
+        return interval->hint;
+    }
+
+    for (size_t i = 0; i < first_len; i++){
+        if(free_registers & (1u << first[i])){
+            return first[i];
+        }
+    }
+
+    for (size_t i = 0; i < second_len; i++){
+        if(free_registers & (1u << second[i])){
+            return second[i];
+        }
+    }
+
+    return NO_REGISTER;
+}
+
+// Poletto and Sarkar's linear scan: when no register is free, the
+// live interval ending last is spilled whole
+int allocate_registers(VCode *vcode){
+    const Allocator *allocator = vcode->allocator;
+    Interval *intervals = vcode->intervals;
+    size_t orders_len = 0;
+    IntervalOrder *orders = MEMORY_ALLOC(IntervalOrder, vcode->vregs_len, allocator);
+    VReg active[CALLER_SAVED_LEN + CALLEE_SAVED_LEN];
+    size_t active_len = 0;
+    uint32_t free_registers = 0;
+
+    if(!orders){
+        return 1;
+    }
+
+    for (size_t i = 0; i < CALLER_SAVED_LEN; i++){
+        free_registers |= 1u << caller_saved[i];
+    }
+
+    for (size_t i = 0; i < CALLEE_SAVED_LEN; i++){
+        free_registers |= 1u << callee_saved[i];
+    }
+
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        if(!intervals[i].used){
+            continue;
+        }
+
+        orders[orders_len++] = (IntervalOrder){
+            .start = intervals[i].start,
+            .hinted = intervals[i].hint != NO_REGISTER,
+            .vreg = (VReg)i
+        };
+    }
+
+    qsort(orders, orders_len, sizeof(IntervalOrder), compare_interval_orders);
+
+    vcode->spills = 0;
+    vcode->used_callee_saved = 0;
+
+    for (size_t i = 0; i < orders_len; i++){
+        VReg vreg = orders[i].vreg;
+        Interval *interval = &intervals[vreg];
+
+        for (size_t j = 0; j < active_len;){
+            Interval *active_interval = &intervals[active[j]];
+
+            if(active_interval->end <= interval->start){
+                free_registers |= 1u << active_interval->reg;
+                active[j] = active[--active_len];
+            }else{
+                j++;
+            }
+        }
+
+        int reg = pick_register(interval, free_registers);
+
+        if(reg != NO_REGISTER){
+            interval->reg = reg;
+            free_registers &= ~(1u << reg);
+            active[active_len++] = vreg;
+
+            continue;
+        }
+
+        size_t furthest = 0;
+
+        for (size_t j = 1; j < active_len; j++){
+            if(intervals[active[j]].end > intervals[active[furthest]].end){
+                furthest = j;
+            }
+        }
+
+        Interval *furthest_interval = &intervals[active[furthest]];
+
+        if(furthest_interval->end > interval->end){
+            interval->reg = furthest_interval->reg;
+            furthest_interval->reg = NO_REGISTER;
+            furthest_interval->slot = (uint32_t)vcode->spills++;
+            active[furthest] = vreg;
+        }else{
+            interval->slot = (uint32_t)vcode->spills++;
+        }
+    }
+
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        int reg = intervals[i].reg;
+
+        for (size_t j = 0; reg != NO_REGISTER && j < CALLEE_SAVED_LEN; j++){
+            if(callee_saved[j] == (X64Register)reg){
+                vcode->used_callee_saved |= 1u << reg;
+            }
+        }
+    }
+
+    MEMORY_DEALLOC(orders, IntervalOrder, vcode->vregs_len, allocator);
+
+    return 0;
+}
+
+// Slots sit right below the saved rbp
+inline int32_t slot_displacement(uint32_t slot){
+    return -(int32_t)((slot + 1) * sizeof(qword));
+}
+
+// Returns the register holding 'vreg', loading it into 'scratch' when it is spilled
+X64Register load(VCode *vcode, VReg vreg, X64Register scratch){
+    Interval *interval = &vcode->intervals[vreg];
+
+    if(interval->reg != NO_REGISTER){
+        return (X64Register)interval->reg;
+    }
+
+    myass_mov_r64_m64(vcode->myass, scratch, RBP, slot_displacement(interval->slot));
+
+    return scratch;
+}
+
+// Where to compute a value for 'vreg', rax when it is spilled
+X64Register target(VCode *vcode, VReg vreg){
+    Interval *interval = &vcode->intervals[vreg];
+
+    return interval->reg == NO_REGISTER ? RAX : (X64Register)interval->reg;
+}
+
+void store(VCode *vcode, VReg vreg, X64Register reg){
+    Interval *interval = &vcode->intervals[vreg];
+
+    if(interval->reg == NO_REGISTER){
+        myass_mov_m64_r64(vcode->myass, RBP, slot_displacement(interval->slot), reg);
+    }else if((X64Register)interval->reg != reg){
+        myass_mov_r64_r64(vcode->myass, (X64Register)interval->reg, reg);
+    }
+}
+
+// Moves every 'srcs[i]' into 'dsts[i]' as if all at once. 'dsts' are
+// all different. A cycle is broken by parking one source in r11
+void parallel_move(VCode *vcode, size_t len, const X64Register *dsts, X64Register *srcs){
+    MyAss *myass = vcode->myass;
+    byte done[VCODE_MAX_ARGS] = {0};
+    size_t pending = len;
+
+    assert(len <= VCODE_MAX_ARGS);
+
+    for (size_t i = 0; i < len; i++){
+        if(dsts[i] == srcs[i]){
+            done[i] = 1;
+            pending--;
+        }
+    }
+
+    while(pending > 0){
+        int progress = 0;
+
+        for (size_t i = 0; i < len; i++){
+            int blocked = 0;
+
+            if(done[i]){
+                continue;
+            }
+
+            for (size_t j = 0; j < len && !blocked; j++){
+                blocked = j != i && !done[j] && srcs[j] == dsts[i];
+            }
+
+            if(!blocked){
+                myass_mov_r64_r64(myass, dsts[i], srcs[i]);
+                done[i] = 1;
+                pending--;
+                progress = 1;
+            }
+        }
+
+        if(progress){
+            continue;
+        }
+
+        for (size_t i = 0; i < len; i++){
+            if(done[i]){
+                continue;
+            }
+
+            X64Register parked = srcs[i];
+
+            myass_mov_r64_r64(myass, R11, parked);
+
+            for (size_t j = 0; j < len; j++){
+                if(!done[j] && srcs[j] == parked){
+                    srcs[j] = R11;
+                }
+            }
+
+            break;
+        }
+    }
+}
+
+// Pushes the callee saved registers in use, then sets up rbp when
+// there are spill slots. With calls, rsp ends up 16 bytes aligned
+void emit_prologue(VCode *vcode){
+    MyAss *myass = vcode->myass;
+    size_t pushes = 0;
+
+    for (size_t i = 0; i < CALLEE_SAVED_LEN; i++){
+        if(vcode->used_callee_saved & (1u << callee_saved[i])){
+            myass_push_r64(myass, callee_saved[i]);
+            pushes++;
+        }
+    }
+
+    if(vcode->spills > 0){
+        myass_push_r64(myass, RBP);
+        myass_mov_r64_r64(myass, RBP, RSP);
+        pushes += 1 + vcode->spills;
+    }
+
+    // The return address makes one more
+    vcode->frame_padding = vcode->has_calls && (pushes % 2 == 0);
+
+    size_t frame_len = (vcode->spills + (size_t)vcode->frame_padding) * sizeof(qword);
+
+    if(frame_len > 0){
+        myass_sub_r64_imm32(myass, RSP, (dword)frame_len);
+    }
+
+    // Arguments are stored before any move can overwrite their registers
+    X64Register dsts[VCODE_MAX_ARGS];
+    X64Register srcs[VCODE_MAX_ARGS];
+    size_t moves_len = 0;
+
+    for (size_t i = 0; i < VCODE_MAX_ARGS; i++){
+        VReg arg = vcode->args[i];
+
+        if(arg == VCODE_NO_VREG){
+            continue;
+        }
+
+        Interval *interval = &vcode->intervals[arg];
+
+        if(interval->reg == NO_REGISTER){
+            myass_mov_m64_r64(myass, RBP, slot_displacement(interval->slot), arg_registers[i]);
+        }else{
+            dsts[moves_len] = (X64Register)interval->reg;
+            srcs[moves_len] = arg_registers[i];
+            moves_len++;
+        }
+    }
+
+    parallel_move(vcode, moves_len, dsts, srcs);
+}
+
+void emit_epilogue(VCode *vcode){
+    MyAss *myass = vcode->myass;
+
+    if(vcode->spills > 0){
+        myass_mov_r64_r64(myass, RSP, RBP);
+        myass_pop_r64(myass, RBP);
+    }else if(vcode->frame_padding){
+        myass_add_r64_imm32(myass, RSP, sizeof(qword));
+    }
+
+    for (size_t i = CALLEE_SAVED_LEN; i > 0; i--){
+        if(vcode->used_callee_saved & (1u << callee_saved[i - 1])){
+            myass_pop_r64(myass, callee_saved[i - 1]);
+        }
+    }
+
+    myass_ret(myass);
+}
+
+// Caller saved registers live across the call are pushed around it
+int emit_call(VCode *vcode, uint32_t position, VOp *op){
+    MyAss *myass = vcode->myass;
+    Interval *intervals = vcode->intervals;
+    X64Register saved[CALLER_SAVED_LEN];
+    size_t saved_len = 0;
+
+    for (size_t i = 0; i < vcode->vregs_len; i++){
+        Interval *interval = &intervals[i];
+
+        if(!interval->used ||
+           interval->reg == NO_REGISTER ||
+           interval->start >= position ||
+           interval->end <= position ||
+           (vcode->used_callee_saved & (1u << interval->reg))){
+            continue;
+        }
+
+        saved[saved_len++] = (X64Register)interval->reg;
+        myass_push_r64(myass, (X64Register)interval->reg);
+    }
+
+    if(saved_len % 2 == 1){
+        myass_sub_r64_imm32(myass, RSP, sizeof(qword));
+    }
+
+    X64Register dsts[VCODE_MAX_ARGS];
+    X64Register srcs[VCODE_MAX_ARGS];
+    size_t moves_len = 0;
+
+    for (size_t i = 0; i < op->args_len; i++){
+        Interval *interval = &intervals[vcode->call_args[op->args_offset + i]];
+
+        if(interval->reg != NO_REGISTER){
+            dsts[moves_len] = arg_registers[i];
+            srcs[moves_len] = (X64Register)interval->reg;
+            moves_len++;
+        }
+    }
+
+    parallel_move(vcode, moves_len, dsts, srcs);
+
+    // Slots are untouched by the moves, so spilled arguments go last
+    for (size_t i = 0; i < op->args_len; i++){
+        Interval *interval = &intervals[vcode->call_args[op->args_offset + i]];
+
+        if(interval->reg == NO_REGISTER){
+            myass_mov_r64_m64(myass, arg_registers[i], RBP, slot_displacement(interval->slot));
+        }
+    }
+
+    if(myass_call_label(myass, op->label)){
+        return 1;
+    }
+
+    if(saved_len % 2 == 1){
+        myass_add_r64_imm32(myass, RSP, sizeof(qword));
+    }
+
+    for (size_t i = saved_len; i > 0; i--){
+        myass_pop_r64(myass, saved[i - 1]);
+    }
+
+    if(op->dst != VCODE_NO_VREG){
+        store(vcode, op->dst, RAX);
+    }
+
+    return 0;
+}
+
+// Returns 1 when the builder API runs out of memory for a jump
+int emit_op(VCode *vcode, uint32_t position, VOp *op){
+    MyAss *myass = vcode->myass;
+
+    switch (op->type){
+        case MOV_IMM_VOP_TYPE:{
+            X64Register dst = target(vcode, op->dst);
+
+            myass_mov_r64_imm64(myass, dst, op->imm);
+            store(vcode, op->dst, dst);
+
+            break;
+        }case MOV_VOP_TYPE:{
+            // A spilled source is loaded straight into the destination register
+            store(vcode, op->dst, load(vcode, op->src, target(vcode, op->dst)));
+            break;
+        }case ADD_VOP_TYPE:
+         case SUB_VOP_TYPE:
+         case IMUL_VOP_TYPE:
+         case XOR_VOP_TYPE:{
+            X64Register dst = load(vcode, op->dst, RAX);
+            X64Register src = load(vcode, op->src, R11);
+
+            if(op->type == ADD_VOP_TYPE){
+                myass_add_r64_r64(myass, dst, src);
+            }else if(op->type == SUB_VOP_TYPE){
+                myass_sub_r64_r64(myass, dst, src);
+            }else if(op->type == IMUL_VOP_TYPE){
+                myass_imul_r64_r64(myass, dst, src);
+            }else{
+                myass_xor_r64_r64(myass, dst, src);
+            }
+
+            store(vcode, op->dst, dst);
+
+            break;
+        }case ADD_IMM_VOP_TYPE:
+         case SUB_IMM_VOP_TYPE:{
+            X64Register dst = load(vcode, op->dst, RAX);
+
+            if(op->type == ADD_IMM_VOP_TYPE){
+                myass_add_r64_imm32(myass, dst, (dword)op->imm);
+            }else{
+                myass_sub_r64_imm32(myass, dst, (dword)op->imm);
+            }
+
+            store(vcode, op->dst, dst);
+
+            break;
+        }case DIV_VOP_TYPE:
+         case REM_VOP_TYPE:{
+            X64Register dividend = load(vcode, op->dst, RAX);
+
+            if(dividend != RAX){
+                myass_mov_r64_r64(myass, RAX, dividend);
+            }
+
+            myass_cqo(myass);
+            myass_idiv_r64(myass, load(vcode, op->src, R11));
+            store(vcode, op->dst, op->type == DIV_VOP_TYPE ? RAX : RDX);
+
+            break;
+        }case CMP_VOP_TYPE:{
+            X64Register a = load(vcode, op->dst, RAX);
+            X64Register b = load(vcode, op->src, R11);
+
+            myass_cmp_r64_r64(myass, a, b);
+
+            break;
+        }case CMP_IMM_VOP_TYPE:{
+            myass_cmp_r64_imm32(myass, load(vcode, op->dst, RAX), (dword)op->imm);
+            break;
+        }case BIND_VOP_TYPE:{
+            myass_label_bind(myass, op->label);
+            break;
+        }case JCC_VOP_TYPE:{
+            return myass_jcc_label(myass, (MyAssCondition)op->condition, op->label);
+        }case JMP_VOP_TYPE:{
+            return myass_jmp_label(myass, op->label);
+        }case CALL_VOP_TYPE:{
+            return emit_call(vcode, position, op);
+        }case RET_VOP_TYPE:{
+            X64Register value = load(vcode, op->src, RAX);
+
+            if(value != RAX){
+                myass_mov_r64_r64(myass, RAX, value);
+            }
+
+            emit_epilogue(vcode);
+
+            break;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------------//
+//                               PUBLIC IMPLEMENTATION                                //
+//------------------------------------------------------------------------------------//
+VCode *vcode_create(MyAss *myass, const Allocator *allocator){
+    VCode *vcode = MEMORY_ALLOC(VCode, 1, allocator);
+
+    if(!vcode){
+        return NULL;
+    }
+
+    vcode->myass = myass;
+    vcode->ops = NULL;
+    vcode->ops_len = 0;
+    vcode->ops_capacity = 0;
+    vcode->call_args = NULL;
+    vcode->call_args_len = 0;
+    vcode->call_args_capacity = 0;
+    vcode->intervals = NULL;
+    vcode->intervals_capacity = 0;
+    vcode->allocator = allocator;
+
+    vcode_reset(vcode);
+
+    return vcode;
+}
+
+void vcode_destroy(VCode *vcode){
+    if(!vcode){
+        return;
+    }
+
+    const Allocator *allocator = vcode->allocator;
+
+    MEMORY_DEALLOC(vcode->ops, VOp, vcode->ops_capacity, allocator);
+    MEMORY_DEALLOC(vcode->call_args, VReg, vcode->call_args_capacity, allocator);
+    MEMORY_DEALLOC(vcode->intervals, Interval, vcode->intervals_capacity, allocator);
+    MEMORY_DEALLOC(vcode, VCode, 1, allocator);
+}
+
+void vcode_reset(VCode *vcode){
+    vcode->ops_len = 0;
+    vcode->call_args_len = 0;
+    vcode->vregs_len = 0;
+    vcode->spills = 0;
+    vcode->used_callee_saved = 0;
+    vcode->has_calls = 0;
+    vcode->frame_padding = 0;
+    vcode->out_of_memory = 0;
+
+    for (size_t i = 0; i < VCODE_MAX_ARGS; i++){
+        vcode->args[i] = VCODE_NO_VREG;
+    }
+}
+
+inline VReg vcode_vreg(VCode *vcode){
+    return (VReg)vcode->vregs_len++;
+}
+
+VReg vcode_arg(VCode *vcode, size_t index){
+    assert(index < VCODE_MAX_ARGS && "Only register arguments are supported");
+
+    if(vcode->args[index] == VCODE_NO_VREG){
+        vcode->args[index] = vcode_vreg(vcode);
+    }
+
+    return vcode->args[index];
+}
+
+void vcode_mov_imm(VCode *vcode, VReg dst, qword src){
+    assert(dst < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, MOV_IMM_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = dst;
+    op->imm = src;
+}
+
+inline void vcode_mov(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, MOV_VOP_TYPE, dst, src);
+}
+
+inline void vcode_add(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, ADD_VOP_TYPE, dst, src);
+}
+
+void vcode_add_imm(VCode *vcode, VReg dst, dword src){
+    assert(dst < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, ADD_IMM_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = dst;
+    op->imm = src;
+}
+
+inline void vcode_sub(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, SUB_VOP_TYPE, dst, src);
+}
+
+void vcode_sub_imm(VCode *vcode, VReg dst, dword src){
+    assert(dst < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, SUB_IMM_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = dst;
+    op->imm = src;
+}
+
+inline void vcode_imul(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, IMUL_VOP_TYPE, dst, src);
+}
+
+inline void vcode_xor(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, XOR_VOP_TYPE, dst, src);
+}
+
+inline void vcode_div(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, DIV_VOP_TYPE, dst, src);
+}
+
+inline void vcode_rem(VCode *vcode, VReg dst, VReg src){
+    add_binary_op(vcode, REM_VOP_TYPE, dst, src);
+}
+
+inline void vcode_cmp(VCode *vcode, VReg a, VReg b){
+    add_binary_op(vcode, CMP_VOP_TYPE, a, b);
+}
+
+void vcode_cmp_imm(VCode *vcode, VReg a, dword b){
+    assert(a < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, CMP_IMM_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = a;
+    op->imm = b;
+}
+
+void vcode_label_bind(VCode *vcode, MyAssLabel label){
+    VOp *op = add_op(vcode, BIND_VOP_TYPE);
+
+    if(op){
+        op->label = label;
+    }
+}
+
+void vcode_jcc(VCode *vcode, MyAssCondition condition, MyAssLabel label){
+    VOp *op = add_op(vcode, JCC_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->label = label;
+    op->condition = condition;
+}
+
+void vcode_jmp(VCode *vcode, MyAssLabel label){
+    VOp *op = add_op(vcode, JMP_VOP_TYPE);
+
+    if(op){
+        op->label = label;
+    }
+}
+
+void vcode_call(VCode *vcode, MyAssLabel target, VReg dst, size_t args_len, const VReg *args){
+    assert(args_len <= VCODE_MAX_ARGS && "Only register arguments are supported");
+
+    if(vcode->out_of_memory){
+        return;
+    }
+
+    if(vcode->call_args_len + args_len > vcode->call_args_capacity){
+        size_t new_capacity = vcode->call_args_capacity == 0 ? 64 : vcode->call_args_capacity * 2;
+        VReg *call_args = MEMORY_REALLOC(
+            VReg,
+            vcode->call_args_capacity,
+            new_capacity,
+            vcode->call_args,
+            vcode->allocator
+        );
+
+        if(!call_args){
+            vcode->out_of_memory = 1;
+            return;
+        }
+
+        vcode->call_args = call_args;
+        vcode->call_args_capacity = new_capacity;
+    }
+
+    VOp *op = add_op(vcode, CALL_VOP_TYPE);
+
+    if(!op){
+        return;
+    }
+
+    op->dst = dst;
+    op->label = target;
+    op->args_offset = (uint32_t)vcode->call_args_len;
+    op->args_len = (uint32_t)args_len;
+
+    for (size_t i = 0; i < args_len; i++){
+        assert(args[i] < vcode->vregs_len && "Unknown virtual register");
+        vcode->call_args[vcode->call_args_len++] = args[i];
+    }
+}
+
+void vcode_ret(VCode *vcode, VReg value){
+    assert(value < vcode->vregs_len && "Unknown virtual register");
+
+    VOp *op = add_op(vcode, RET_VOP_TYPE);
+
+    if(op){
+        op->src = value;
+    }
+}
+
+int vcode_emit(VCode *vcode){
+    if(vcode->out_of_memory){
+        return 1;
+    }
+
+    if(vcode->vregs_len > vcode->intervals_capacity){
+        Interval *intervals = MEMORY_REALLOC(
+            Interval,
+            vcode->intervals_capacity,
+            vcode->vregs_len,
+            vcode->intervals,
+            vcode->allocator
+        );
+
+        if(!intervals){
+            return 1;
+        }
+
+        vcode->intervals = intervals;
+        vcode->intervals_capacity = vcode->vregs_len;
+    }
+
+    if(build_intervals(vcode) || allocate_registers(vcode)){
+        return 1;
+    }
+
+    emit_prologue(vcode);
+
+    for (size_t i = 0; i < vcode->ops_len; i++){
+        if(emit_op(vcode, (uint32_t)i + 1, &vcode->ops[i])){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+inline size_t vcode_spills(const VCode *vcode){
+    return vcode->spills;
+}
@@ -0,0 +1,152 @@
+// Checks the line table once MYASS_FLAG_PROFILE_LAYOUT has moved the
+// cold block behind the hot ones, so the instructions no longer come in
+// source order. The first instruction of every block must still map to
+// the line and column it has in the source
+
+#include "essentials/lzarena.h"
+#include "myass.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct block{
+    const char *label;
+    uint64_t count;
+    uint32_t line;   // of the first instruction after the label
+    uint32_t column;
+}Block;
+
+static const char *source =
+    "\n"
+    "main:\n"
+    "    cmp rdi, 0\n"
+    "    jge .hot\n"
+    ".cold:\n"
+    "    mov rax, 2\n"
+    "    ret\n"
+    ".hot:\n"
+    "  mov rax, 1\n"
+    "  add rax, rdi\n"
+    "  ret\n";
+
+static const Block blocks[] = {
+    {"main", 100, 3, 5},
+    {".cold", 0, 6, 5},
+    {".hot", 100, 9, 3}
+};
+
+#define BLOCKS_LEN (sizeof(blocks) / sizeof(blocks[0]))
+
+static size_t check(MyAss *myass, int flags){
+    size_t failures = 0;
+
+    myass_flags(myass, flags);
+
+    if(myass_assemble(myass, strlen(source), source)){
+        fprintf(stderr, "Failed to assemble the test code (flags %d)\n", flags);
+        return 1;
+    }
+
+    size_t code_len = 0;
+    size_t cold_offset = 0;
+    size_t hot_offset = 0;
+
+    myass_code(myass, &code_len);
+    myass_symbol_offset(myass, ".cold", &cold_offset);
+    myass_symbol_offset(myass, ".hot", &hot_offset);
+
+    if((flags & MYASS_FLAG_PROFILE_LAYOUT) && cold_offset < hot_offset){
+        fprintf(stderr, "Layout kept the cold block in front of the hot one\n");
+        failures++;
+    }
+
+    for (size_t i = 0; i < BLOCKS_LEN; i++){
+        const Block *block = &blocks[i];
+        size_t offset = 0;
+        uint32_t line = 0;
+        uint32_t column = 0;
+
+        if(myass_symbol_offset(myass, block->label, &offset) ||
+           myass_lookup_line(myass, offset, &line, &column)){
+            fprintf(stderr, "No line for '%s' (flags %d)\n", block->label, flags);
+            failures++;
+            continue;
+        }
+
+        if(line != block->line || column != block->column){
+            fprintf(
+                stderr,
+                "'%s' at 0x%zx maps to %u:%u, not %u:%u (flags %d)\n",
+                block->label,
+                offset,
+                line,
+                column,
+                block->line,
+                block->column,
+                flags
+            );
+            failures++;
+        }
+    }
+
+    // Every byte must fall on one of the source lines
+    for (size_t offset = 0; offset < code_len; offset++){
+        uint32_t line = 0;
+        uint32_t column = 0;
+
+        if(myass_lookup_line(myass, offset, &line, &column) || line < 3 || line > 11 || column > 15){
+            fprintf(stderr, "Byte 0x%zx maps to %u:%u (flags %d)\n", offset, line, column, flags);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+int main(void){
+    LZArena *arena = lzarena_create(NULL);
+    AllocatorContext allocator_context = {
+        .err_buf = NULL,
+        .behind_allocator = arena
+    };
+    Allocator allocator = {0};
+
+    MEMORY_INIT_ALLOCATOR(
+        &allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &allocator
+    );
+
+    MyAss *myass = myass_create(&allocator);
+
+    if(!myass){
+        fprintf(stderr, "Failed to create the assembler\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < BLOCKS_LEN; i++){
+        if(myass_label_count(myass, blocks[i].label, blocks[i].count)){
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t failures = check(myass, MYASS_FLAG_LINE_TABLE) +
+                      check(myass, MYASS_FLAG_LINE_TABLE | MYASS_FLAG_PROFILE_LAYOUT);
+
+    myass_destroy(myass);
+    lzarena_destroy(arena);
+
+    if(failures > 0){
+        fprintf(stderr, "%zu failures\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("line table: 2 layouts, 0 failures\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+// Stress test of 'myass_retarget': threads keep calling through patch
+// sites while the main thread points them back and forth between two
+// functions. A torn displacement sends a thread anywhere else, so any
+// result but 1 or 2 (or a crash) fails the test
+
+#include "essentials/lzarena.h"
+#include "myass.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define THREADS     4
+#define RETARGETS   1000000
+// Sites get preceded by 0 to SITE_SHIFTS - 1 push/pop pairs, so their
+// displacements start at every offset within a qword before padding
+#define SITE_SHIFTS 8
+#define CODE_LEN    65536
+
+typedef uint64_t (*Function)(void);
+
+typedef struct runner{
+    Function *functions;
+    size_t functions_len;
+    size_t results[3]; // 1, 2 and anything else
+    pthread_t thread;
+}Runner;
+
+static int stop = 0;
+
+static void append(char *buff, size_t *len, const char *text){
+    size_t text_len = strlen(text);
+
+    memcpy(buff + *len, text, text_len);
+    *len += text_len;
+    buff[*len] = '\0';
+}
+
+static size_t build_source(char *buff){
+    char line[64];
+    size_t len = 0;
+
+    append(buff, &len, "one:\n mov rax, 1\n ret\ntwo:\n mov rax, 2\n ret\n");
+
+    for (size_t i = 0; i < SITE_SHIFTS; i++){
+        snprintf(line, sizeof(line), "call_%zu:\n", i);
+        append(buff, &len, line);
+
+        for (size_t j = 0; j < i; j++){
+            append(buff, &len, " push rbx\n pop rbx\n");
+        }
+
+        append(buff, &len, " call one\n ret\n");
+
+        snprintf(line, sizeof(line), "jmp_%zu:\n", i);
+        append(buff, &len, line);
+
+        for (size_t j = 0; j < i; j++){
+            append(buff, &len, " push rbx\n pop rbx\n");
+        }
+
+        append(buff, &len, " jmp one\n");
+    }
+
+    return len;
+}
+
+static void *run(void *arg){
+    Runner *runner = arg;
+
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)){
+        for (size_t i = 0; i < runner->functions_len; i++){
+            uint64_t result = runner->functions[i]();
+
+            runner->results[result == 1 ? 0 : result == 2 ? 1 : 2]++;
+        }
+    }
+
+    return NULL;
+}
+
+int main(void){
+    LZArena *arena = lzarena_create(NULL);
+    AllocatorContext allocator_context = {
+        .err_buf = NULL,
+        .behind_allocator = arena
+    };
+    Allocator allocator = {0};
+
+    MEMORY_INIT_ALLOCATOR(
+        &allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &allocator
+    );
+
+    static char source[CODE_LEN];
+    size_t source_len = build_source(source);
+    MyAss *myass = myass_create(&allocator);
+
+    if(!myass){
+        fprintf(stderr, "Failed to create the assembler\n");
+        return EXIT_FAILURE;
+    }
+
+    myass_flags(myass, MYASS_FLAG_PATCHABLE);
+
+    if(myass_assemble(myass, source_len, source)){
+        fprintf(stderr, "Failed to assemble the test code\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t code_len = 0;
+    size_t sites_len = 0;
+    const byte *code = myass_code(myass, &code_len);
+    const MyAssPatchSite *sites = myass_patch_sites(myass, &sites_len);
+    size_t failures = 0;
+
+    if(sites_len != SITE_SHIFTS * 2){
+        fprintf(stderr, "Expected %d patch sites, got %zu\n", SITE_SHIFTS * 2, sites_len);
+        failures++;
+    }
+
+    // The rel32 must sit in one aligned qword for the CAS to cover it
+    for (size_t i = 0; i < sites_len; i++){
+        size_t misalignment = (sites[i].offset + 1) % sizeof(uint64_t);
+
+        if(misalignment > sizeof(uint64_t) - sizeof(uint32_t)){
+            fprintf(stderr, "Site at 0x%x crosses a qword (%zu)\n", sites[i].offset, misalignment);
+            failures++;
+        }
+    }
+
+    byte *memory = mmap(NULL, code_len, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(memory == MAP_FAILED){
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    memcpy(memory, code, code_len);
+
+    size_t one_offset = 0;
+    size_t two_offset = 0;
+    Function functions[SITE_SHIFTS * 2];
+
+    myass_symbol_offset(myass, "one", &one_offset);
+    myass_symbol_offset(myass, "two", &two_offset);
+
+    for (size_t i = 0; i < SITE_SHIFTS; i++){
+        char name[16];
+        size_t offset = 0;
+
+        snprintf(name, sizeof(name), "call_%zu", i);
+        myass_symbol_offset(myass, name, &offset);
+        functions[i * 2] = (Function)(memory + offset);
+
+        snprintf(name, sizeof(name), "jmp_%zu", i);
+        myass_symbol_offset(myass, name, &offset);
+        functions[i * 2 + 1] = (Function)(memory + offset);
+    }
+
+    Runner runners[THREADS];
+
+    for (size_t i = 0; i < THREADS; i++){
+        runners[i] = (Runner){
+            .functions = functions,
+            .functions_len = SITE_SHIFTS * 2
+        };
+
+        pthread_create(&runners[i].thread, NULL, run, &runners[i]);
+    }
+
+    for (size_t i = 0; i < RETARGETS; i++){
+        uintptr_t target = (uintptr_t)(memory + (i % 2 == 0 ? two_offset : one_offset));
+
+        for (size_t j = 0; j < sites_len; j++){
+            if(myass_retarget(memory + sites[j].offset, target)){
+                fprintf(stderr, "Failed to retarget the site at 0x%x\n", sites[j].offset);
+                failures++;
+            }
+        }
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    size_t results[3] = {0};
+
+    for (size_t i = 0; i < THREADS; i++){
+        pthread_join(runners[i].thread, NULL);
+
+        for (size_t j = 0; j < 3; j++){
+            results[j] += runners[i].results[j];
+        }
+    }
+
+    printf("%d retargets of %zu sites, calls returning 1: %zu, 2: %zu, other: %zu\n", RETARGETS, sites_len, results[0], results[1], results[2]);
+
+    if(results[2] > 0){
+        failures++;
+    }
+
+    if(results[0] == 0 || results[1] == 0){
+        fprintf(stderr, "The threads never saw one of the targets\n");
+        failures++;
+    }
+
+    // Out of rel32 range, and a displacement that crosses a qword
+    if(!myass_retarget(memory + sites[0].offset, (uintptr_t)memory + 0x100000000)){
+        fprintf(stderr, "Retargeted out of the rel32 range\n");
+        failures++;
+    }
+
+    byte *unpadded = (byte *)(((uintptr_t)memory & ~((uintptr_t)7)) + 4);
+
+    if(!myass_retarget(unpadded, (uintptr_t)memory)){
+        fprintf(stderr, "Retargeted a site crossing a qword\n");
+        failures++;
+    }
+
+    munmap(memory, code_len);
+    myass_destroy(myass);
+    lzarena_destroy(arena);
+
+    if(failures > 0){
+        fprintf(stderr, "%zu failures\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
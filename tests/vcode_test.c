@@ -0,0 +1,396 @@
+// Differential test of the 'vcode' register allocator. Random functions
+// of 6 arguments and 20 values, with calls, rem and counted loops nested
+// up to twice, are built with vcode, run, and checked against an
+// interpreter of the same ops. 20 values outnumber the 11 allocatable
+// registers, so every function spills, the calls make intervals cross
+// them, and values live around a loop only stay right when the
+// intervals are stretched over it
+
+#include "essentials/lzarena.h"
+#include "vcode.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#define FUNCTIONS  20000
+#define VALUES     20
+#define MAX_OPS    4096
+#define MAX_DEPTH  2
+#define CODE_LEN   (1024 * 1024)
+
+typedef enum test_op_type{
+    MOV_IMM_TEST_OP,
+    MOV_TEST_OP,
+    ADD_TEST_OP,
+    SUB_TEST_OP,
+    IMUL_TEST_OP,
+    XOR_TEST_OP,
+    REM_TEST_OP,
+    CALL_TEST_OP,
+    ADD_IMM_TEST_OP,
+    LOOP_TEST_OP, // runs the 'body_len' ops after it 'count' times
+    TEST_OPS_LEN
+}TestOpType;
+
+typedef struct test_op{
+    TestOpType type;
+    size_t     dst;
+    size_t     src;
+    size_t     divisor; // also the second call argument
+    int64_t    imm;
+    size_t     body_len;
+    size_t     count;
+}TestOp;
+
+typedef struct function{
+    TestOp ops[MAX_OPS];
+    size_t ops_len;
+    size_t loops;
+    size_t calls;
+}Function;
+
+typedef uint64_t (*Compiled)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+static uint64_t seed = 88172645463325252ULL;
+
+static uint64_t next_random(void){
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    return seed;
+}
+
+// What the called function computes, also built with vcode
+static uint64_t helper(uint64_t x, uint64_t y){
+    return x * 3 - y;
+}
+
+static void generate(Function *function, size_t depth, size_t len){
+    for (size_t i = 0; i < len && function->ops_len < MAX_OPS - 16; i++){
+        TestOp *op = &function->ops[function->ops_len++];
+
+        *op = (TestOp){
+            .type = (TestOpType)(next_random() % TEST_OPS_LEN),
+            .dst = next_random() % VALUES,
+            .src = next_random() % VALUES,
+            .divisor = next_random() % VALUES,
+            .imm = (int64_t)(next_random() % 1000) - 500
+        };
+
+        if(op->type == REM_TEST_OP){
+            op->imm = 1 + (int64_t)(next_random() % 50);
+
+            if(op->divisor == op->dst){
+                op->divisor = (op->dst + 1) % VALUES;
+            }
+        }
+
+        if(op->type == CALL_TEST_OP){
+            function->calls++;
+        }
+
+        if(op->type == LOOP_TEST_OP){
+            if(depth >= MAX_DEPTH){
+                op->type = ADD_TEST_OP;
+                continue;
+            }
+
+            size_t body_start = function->ops_len;
+
+            op->count = next_random() % 5;
+            generate(function, depth + 1, 1 + next_random() % 8);
+            op->body_len = function->ops_len - body_start;
+            function->loops++;
+        }
+    }
+}
+
+// Returns the index of the op after 'index'
+static size_t interpret(const Function *function, size_t index, uint64_t *values){
+    const TestOp *op = &function->ops[index];
+
+    switch (op->type){
+        case MOV_IMM_TEST_OP:{
+            values[op->dst] = (uint64_t)op->imm;
+            break;
+        }case MOV_TEST_OP:{
+            values[op->dst] = values[op->src];
+            break;
+        }case ADD_TEST_OP:{
+            values[op->dst] += values[op->src];
+            break;
+        }case SUB_TEST_OP:{
+            values[op->dst] -= values[op->src];
+            break;
+        }case IMUL_TEST_OP:{
+            values[op->dst] *= values[op->src];
+            break;
+        }case XOR_TEST_OP:{
+            values[op->dst] ^= values[op->src];
+            break;
+        }case REM_TEST_OP:{
+            // Divisors are positive, so idiv never overflows
+            values[op->divisor] = (uint64_t)op->imm;
+            values[op->dst] = (uint64_t)((int64_t)values[op->dst] % op->imm);
+            break;
+        }case CALL_TEST_OP:{
+            values[op->dst] = helper(values[op->src], values[op->divisor]);
+            break;
+        }case ADD_IMM_TEST_OP:{
+            values[op->dst] += (uint64_t)op->imm;
+            break;
+        }case LOOP_TEST_OP:{
+            size_t end = index + 1 + op->body_len;
+
+            for (size_t i = 0; i < op->count; i++){
+                for (size_t j = index + 1; j < end;){
+                    j = interpret(function, j, values);
+                }
+            }
+
+            return end;
+        }default:{
+            break;
+        }
+    }
+
+    return index + 1;
+}
+
+// Loops count down a register of their own:
+//   mov cnt, count
+// top:
+//   cmp cnt, 0
+//   jle done
+//   sub cnt, 1
+//   <body>
+//   jmp top
+// done:
+static size_t build(MyAss *myass, VCode *vcode, MyAssLabel helper_label, const Function *function, size_t index, size_t end, const VReg *vregs){
+    while(index < end){
+        const TestOp *op = &function->ops[index];
+        VReg dst = vregs[op->dst];
+        VReg src = vregs[op->src];
+
+        switch (op->type){
+            case MOV_IMM_TEST_OP:{
+                vcode_mov_imm(vcode, dst, (qword)op->imm);
+                break;
+            }case MOV_TEST_OP:{
+                vcode_mov(vcode, dst, src);
+                break;
+            }case ADD_TEST_OP:{
+                vcode_add(vcode, dst, src);
+                break;
+            }case SUB_TEST_OP:{
+                vcode_sub(vcode, dst, src);
+                break;
+            }case IMUL_TEST_OP:{
+                vcode_imul(vcode, dst, src);
+                break;
+            }case XOR_TEST_OP:{
+                vcode_xor(vcode, dst, src);
+                break;
+            }case REM_TEST_OP:{
+                vcode_mov_imm(vcode, vregs[op->divisor], (qword)op->imm);
+                vcode_rem(vcode, dst, vregs[op->divisor]);
+                break;
+            }case CALL_TEST_OP:{
+                VReg args[2] = {src, vregs[op->divisor]};
+
+                vcode_call(vcode, helper_label, dst, 2, args);
+                break;
+            }case ADD_IMM_TEST_OP:{
+                vcode_add_imm(vcode, dst, (dword)op->imm);
+                break;
+            }case LOOP_TEST_OP:{
+                VReg counter = vcode_vreg(vcode);
+                MyAssLabel top = myass_label_new(myass);
+                MyAssLabel done = myass_label_new(myass);
+                size_t body_end = index + 1 + op->body_len;
+
+                vcode_mov_imm(vcode, counter, (qword)op->count);
+                vcode_label_bind(vcode, top);
+                vcode_cmp_imm(vcode, counter, 0);
+                vcode_jcc(vcode, MYASS_CONDITION_LE, done);
+                vcode_sub_imm(vcode, counter, 1);
+                build(myass, vcode, helper_label, function, index + 1, body_end, vregs);
+                vcode_jmp(vcode, top);
+                vcode_label_bind(vcode, done);
+
+                index = body_end;
+
+                continue;
+            }default:{
+                break;
+            }
+        }
+
+        index++;
+    }
+
+    return index;
+}
+
+// Returns 1 when vcode fails to emit it
+static int emit_helper(MyAss *myass, VCode *vcode, MyAssLabel label){
+    myass_label_bind(myass, label);
+
+    VReg x = vcode_arg(vcode, 0);
+    VReg y = vcode_arg(vcode, 1);
+    VReg result = vcode_vreg(vcode);
+
+    vcode_mov(vcode, result, x);
+    vcode_add(vcode, result, x);
+    vcode_add(vcode, result, x);
+    vcode_sub(vcode, result, y);
+    vcode_ret(vcode, result);
+
+    return vcode_emit(vcode);
+}
+
+int main(void){
+    LZArena *arena = lzarena_create(NULL);
+    AllocatorContext allocator_context = {
+        .err_buf = NULL,
+        .behind_allocator = arena
+    };
+    Allocator allocator = {0};
+
+    MEMORY_INIT_ALLOCATOR(
+        &allocator_context,
+        memory_arena_alloc,
+        memory_arena_realloc,
+        memory_arena_dealloc,
+        &allocator
+    );
+
+    MyAss *myass = myass_create(&allocator);
+    VCode *vcode = myass ? vcode_create(myass, &allocator) : NULL;
+    byte *memory = mmap(NULL, CODE_LEN, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    static Function function;
+    size_t failures = 0;
+    size_t spills = 0;
+    size_t loops = 0;
+    size_t calls = 0;
+
+    if(!vcode || memory == MAP_FAILED){
+        fprintf(stderr, "Failed to set up the test\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < FUNCTIONS; i++){
+        myass_restart(myass);
+        vcode_reset(vcode);
+
+        MyAssLabel helper_label = myass_label_new(myass);
+
+        if(emit_helper(myass, vcode, helper_label)){
+            fprintf(stderr, "Failed to emit the helper\n");
+            return EXIT_FAILURE;
+        }
+
+        vcode_reset(vcode);
+
+        MyAssLabel entry = myass_label_new(myass);
+        size_t entry_offset = 0;
+        uint64_t args[VCODE_MAX_ARGS];
+        uint64_t values[VALUES];
+        VReg vregs[VALUES];
+
+        myass_label_bind(myass, entry);
+        myass_label_offset(myass, entry, &entry_offset);
+
+        for (size_t j = 0; j < VCODE_MAX_ARGS; j++){
+            args[j] = (uint64_t)((int64_t)(next_random() % 2000) - 1000);
+            values[j] = args[j];
+            vregs[j] = vcode_arg(vcode, j);
+        }
+
+        for (size_t j = VCODE_MAX_ARGS; j < VALUES; j++){
+            values[j] = next_random() % 100;
+            vregs[j] = vcode_vreg(vcode);
+            vcode_mov_imm(vcode, vregs[j], values[j]);
+        }
+
+        function.ops_len = 0;
+        function.loops = 0;
+        function.calls = 0;
+        generate(&function, 0, 5 + next_random() % 40);
+        build(myass, vcode, helper_label, &function, 0, function.ops_len, vregs);
+
+        for (size_t j = 0; j < function.ops_len;){
+            j = interpret(&function, j, values);
+        }
+
+        // Every value is read at the end, so none of them dies early
+        VReg sum = vcode_vreg(vcode);
+        uint64_t expected = 0;
+
+        vcode_mov_imm(vcode, sum, 0);
+
+        for (size_t j = 0; j < VALUES; j++){
+            vcode_add(vcode, sum, vregs[j]);
+            expected += values[j];
+        }
+
+        vcode_ret(vcode, sum);
+
+        if(vcode_emit(vcode)){
+            fprintf(stderr, "Failed to emit function %zu\n", i);
+            return EXIT_FAILURE;
+        }
+
+        size_t code_len = 0;
+        const byte *code = myass_code(myass, &code_len);
+
+        if(code_len > CODE_LEN){
+            fprintf(stderr, "Function %zu takes %zu bytes\n", i, code_len);
+            return EXIT_FAILURE;
+        }
+
+        memcpy(memory, code, code_len);
+
+        Compiled compiled = (Compiled)(memory + entry_offset);
+        uint64_t result = compiled(args[0], args[1], args[2], args[3], args[4], args[5]);
+
+        if(result != expected){
+            if(failures < 3){
+                fprintf(stderr, "Function %zu returned %" PRIu64 ", not %" PRIu64 "\n", i, result, expected);
+            }
+
+            failures++;
+        }
+
+        spills += vcode_spills(vcode);
+        loops += function.loops;
+        calls += function.calls;
+    }
+
+    printf(
+        "vcode: %d functions, %zu loops, %zu calls, %.2f spills on average, %zu failures\n",
+        FUNCTIONS,
+        loops,
+        calls,
+        (double)spills / FUNCTIONS,
+        failures
+    );
+
+    munmap(memory, CODE_LEN);
+    vcode_destroy(vcode);
+    myass_destroy(myass);
+    lzarena_destroy(arena);
+
+    // Without spills, loops or calls the paths under test never ran
+    if(spills == 0 || loops == 0 || calls == 0){
+        fprintf(stderr, "The functions did not spill, loop and call\n");
+        failures++;
+    }
+
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}